@@ -0,0 +1,905 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+/**
+ * Benchmark driver. Each benchmark is run by name, with optional arguments,
+ * e.g.
+ *
+ *   $ ./badgerdb_bench scaling 8 1000000
+ *
+ * Run without arguments to list the benchmarks. Numbers are only meaningful
+ * for an optimized build, see the README.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdlib.h>
+#include "btree.h"
+#include "bufHashTbl.h"
+#include "buffer.h"
+#include "file.h"
+#include "io_uring_file.h"
+#include "mmap_page_file.h"
+#include "page.h"
+#include "exceptions/file_not_found_exception.h"
+#include "exceptions/no_such_key_found_exception.h"
+
+using namespace badgerdb;
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * Seconds elapsed since start.
+ */
+double secondsSince(const Clock::time_point start)
+{
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/**
+ * Numeric argument i of the benchmark, or def if it was not given.
+ */
+long argOr(int argc, char** argv, int i, long def)
+{
+	return i < argc ? std::atol(argv[i]) : def;
+}
+
+/**
+ * Removes file name, if it exists.
+ */
+void removeFile(const std::string& name)
+{
+	try
+	{
+		File::remove(name);
+	}
+	catch(const FileNotFoundException &e)
+	{
+	}
+}
+
+/**
+ * Creates a PageFile of numPages pages, each holding one record.
+ */
+void createPageFile(const std::string& name, const std::uint32_t numPages)
+{
+	removeFile(name);
+	PageFile file = PageFile::create(name);
+	const std::string record(64, 'r');
+	for (std::uint32_t i = 0; i < numPages; i++)
+	{
+		PageId pageNo;
+		Page page = file.allocatePage(pageNo);
+		page.insertRecord(record);
+		file.writePage(pageNo, page);
+	}
+}
+
+/**
+ * readPage/unPinPage throughput on a fully cached working set, for 1, 2, 4, ...
+ * up to maxThreads threads. Each thread pins random pages of the set.
+ */
+void scalingBench(int argc, char** argv)
+{
+	const int maxThreads = argOr(argc, argv, 0, std::thread::hardware_concurrency());
+	const long opsPerThread = argOr(argc, argv, 1, 1000000);
+	const std::uint32_t numPages = argOr(argc, argv, 2, 4096);
+	const std::string name = "bench_scaling.0";
+
+	createPageFile(name, numPages);
+	{
+		PageFile file = PageFile::open(name);
+		BufMgr bufMgr(numPages + 64);
+
+		// fault the whole set in once
+		for (PageId pageNo = 1; pageNo <= numPages; pageNo++)
+		{
+			Page* page;
+			bufMgr.readPage(&file, pageNo, page);
+			bufMgr.unPinPage(&file, pageNo, false);
+		}
+
+		std::cout << "threads  Mops/s" << std::endl;
+		for (int threads = 1; threads <= maxThreads; threads *= 2)
+		{
+			const Clock::time_point start = Clock::now();
+			std::vector<std::thread> workers;
+			for (int t = 0; t < threads; t++)
+			{
+				workers.push_back(std::thread([&, t]() {
+					std::mt19937 rng(t);
+					for (long i = 0; i < opsPerThread; i++)
+					{
+						const PageId pageNo = 1 + rng() % numPages;
+						Page* page;
+						bufMgr.readPage(&file, pageNo, page);
+						bufMgr.unPinPage(&file, pageNo, false);
+					}
+				}));
+			}
+			for (std::size_t t = 0; t < workers.size(); t++)
+				workers[t].join();
+			const double seconds = secondsSince(start);
+			std::cout << std::setw(7) << threads << "  " << std::fixed << std::setprecision(2)
+								<< threads * opsPerThread / seconds / 1e6 << std::endl;
+		}
+
+		bufMgr.flushFile(&file);
+	}
+	removeFile(name);
+}
+
+/**
+ * @brief The chained hash table BufHashTbl used to be, kept to compare against:
+ * one heap-allocated bucket per entry, hashed on the address of the File object
+ * plus the page number.
+ */
+class ChainedHashTbl
+{
+ public:
+	ChainedHashTbl(const int htSize) : HTSIZE(htSize), ht(new hashBucket*[htSize])
+	{
+		for (int i = 0; i < HTSIZE; i++)
+			ht[i] = NULL;
+	}
+
+	~ChainedHashTbl()
+	{
+		for (int i = 0; i < HTSIZE; i++)
+		{
+			while (ht[i])
+			{
+				hashBucket* tmpBuc = ht[i];
+				ht[i] = ht[i]->next;
+				delete tmpBuc;
+			}
+		}
+		delete [] ht;
+	}
+
+	void insert(const void* file, const PageId pageNo, const FrameId frameNo)
+	{
+		const int index = hash(file, pageNo);
+		hashBucket* tmpBuc = new hashBucket;
+		tmpBuc->file = file;
+		tmpBuc->pageNo = pageNo;
+		tmpBuc->frameNo = frameNo;
+		tmpBuc->next = ht[index];
+		ht[index] = tmpBuc;
+	}
+
+	bool find(const void* file, const PageId pageNo, FrameId &frameNo)
+	{
+		for (hashBucket* tmpBuc = ht[hash(file, pageNo)]; tmpBuc; tmpBuc = tmpBuc->next)
+		{
+			if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
+			{
+				frameNo = tmpBuc->frameNo;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void remove(const void* file, const PageId pageNo)
+	{
+		const int index = hash(file, pageNo);
+		for (hashBucket** link = &ht[index]; *link; link = &(*link)->next)
+		{
+			if ((*link)->file == file && (*link)->pageNo == pageNo)
+			{
+				hashBucket* tmpBuc = *link;
+				*link = tmpBuc->next;
+				delete tmpBuc;
+				return;
+			}
+		}
+	}
+
+ private:
+	struct hashBucket
+	{
+		const void* file;
+		PageId pageNo;
+		FrameId frameNo;
+		hashBucket* next;
+	};
+
+	int hash(const void* file, const PageId pageNo)
+	{
+		const int tmp = (long)file;
+		return (unsigned)(tmp + pageNo) % HTSIZE;
+	}
+
+	const int HTSIZE;
+	hashBucket** ht;
+};
+
+/**
+ * Cost of a lookup that hits and of a remove followed by an insert (what a
+ * page fault does) in BufHashTbl and in the old chained table. The tables map
+ * numBufs pages of a few files, as a full buffer pool does.
+ */
+void hashTableBench(int argc, char** argv)
+{
+	const std::uint32_t numBufs = argOr(argc, argv, 0, 100000);
+	const long ops = argOr(argc, argv, 1, 10000000);
+	const std::uint32_t numFiles = 4;
+
+	// (file, page) of each frame; the chained table hashes file object addresses
+	std::vector<PageFile> fileObjects;
+	fileObjects.reserve(numFiles);
+	for (std::uint32_t f = 0; f < numFiles; f++)
+	{
+		const std::string name = "bench_hash." + std::to_string(f);
+		removeFile(name);
+		fileObjects.push_back(PageFile::create(name));
+	}
+	std::vector<std::uint32_t> files(numBufs);
+	std::vector<PageId> pages(numBufs);
+	for (std::uint32_t i = 0; i < numBufs; i++)
+	{
+		files[i] = i % numFiles;
+		pages[i] = 1 + i / numFiles;
+	}
+	std::vector<std::uint32_t> probes(1 << 20);
+	std::mt19937 rng(1);
+	for (std::size_t i = 0; i < probes.size(); i++)
+		probes[i] = rng() % numBufs;
+
+	BufHashTbl table(numBufs);
+	ChainedHashTbl chained(numBufs);
+	for (std::uint32_t i = 0; i < numBufs; i++)
+	{
+		table.insert(fileObjects[files[i]].id(), pages[i], i);
+		chained.insert(&fileObjects[files[i]], pages[i], i);
+	}
+
+	const std::size_t mask = probes.size() - 1;
+	FrameId frameNo = 0;
+	std::uint64_t sum = 0;
+	std::cout << "table       lookup ns  fault ns" << std::endl;
+
+	Clock::time_point start = Clock::now();
+	for (long i = 0; i < ops; i++)
+	{
+		const std::uint32_t f = probes[i & mask];
+		table.lookup(fileObjects[files[f]].id(), pages[f], frameNo);
+		sum += frameNo;
+	}
+	const double tableLookup = secondsSince(start) / ops * 1e9;
+	start = Clock::now();
+	for (long i = 0; i < ops; i++)
+	{
+		const std::uint32_t f = probes[i & mask];
+		table.remove(fileObjects[files[f]].id(), pages[f]);
+		pages[f] += numBufs;
+		table.insert(fileObjects[files[f]].id(), pages[f], f);
+	}
+	const double tableFault = secondsSince(start) / ops * 1e9;
+
+	start = Clock::now();
+	for (long i = 0; i < ops; i++)
+	{
+		const std::uint32_t f = probes[i & mask];
+		chained.find(&fileObjects[files[f]], pages[f], frameNo);
+		sum += frameNo;
+	}
+	const double chainedLookup = secondsSince(start) / ops * 1e9;
+	start = Clock::now();
+	for (long i = 0; i < ops; i++)
+	{
+		const std::uint32_t f = probes[i & mask];
+		chained.remove(&fileObjects[files[f]], pages[f]);
+		pages[f] += numBufs;
+		chained.insert(&fileObjects[files[f]], pages[f], f);
+	}
+	const double chainedFault = secondsSince(start) / ops * 1e9;
+
+	std::cout << std::fixed << std::setprecision(1)
+						<< "BufHashTbl  " << std::setw(9) << tableLookup << " " << std::setw(9) << tableFault << std::endl
+						<< "chained     " << std::setw(9) << chainedLookup << " " << std::setw(9) << chainedFault << std::endl
+						<< "(checksum " << sum << ")" << std::endl;
+
+	fileObjects.clear();
+	for (std::uint32_t f = 0; f < numFiles; f++)
+		removeFile("bench_hash." + std::to_string(f));
+}
+
+/**
+ * @brief One page access of a trace: which of the trace's files, and the page.
+ */
+struct TraceAccess
+{
+	int file;
+	PageId pageNo;
+};
+
+/**
+ * Reads a trace recorded by badgerdb_main (see main.cpp): one line per page
+ * request, with the number of the file and the page number.
+ *
+ * @return  False if the trace could not be opened.
+ */
+bool readTrace(const std::string& name, std::vector<TraceAccess>& trace)
+{
+	std::ifstream in(name);
+	if (!in)
+		return false;
+	TraceAccess access;
+	while (in >> access.file >> access.pageNo)
+		trace.push_back(access);
+	return true;
+}
+
+/**
+ * Hit ratio and CPU time per readPage of each replacement policy, replaying a
+ * trace of the pages main.cpp requests from its buffer manager through pools
+ * of the given sizes (25 to 200 frames by default; main.cpp uses 100). Record
+ * the trace first with
+ *
+ *   $ ./badgerdb_main main.trace
+ */
+void policyBench(int argc, char** argv)
+{
+	const std::string traceName = argc > 0 ? argv[0] : "main.trace";
+	std::vector<std::uint32_t> poolSizes;
+	for (int i = 1; i < argc; i++)
+		poolSizes.push_back(std::atoi(argv[i]));
+	if (poolSizes.empty())
+	{
+		poolSizes.push_back(25);
+		poolSizes.push_back(50);
+		poolSizes.push_back(100);
+		poolSizes.push_back(200);
+	}
+
+	std::vector<TraceAccess> trace;
+	if (!readTrace(traceName, trace) || trace.empty())
+	{
+		std::cerr << "no trace in " << traceName << "; record one with ./badgerdb_main "
+							<< traceName << std::endl;
+		return;
+	}
+	// the trace's files, each with as many pages as the trace reads from it
+	std::vector<PageId> maxPage;
+	for (std::size_t i = 0; i < trace.size(); i++)
+	{
+		if (trace[i].file >= (int) maxPage.size())
+			maxPage.resize(trace[i].file + 1, 0);
+		maxPage[trace[i].file] = std::max(maxPage[trace[i].file], trace[i].pageNo);
+	}
+	std::vector<std::string> names;
+	for (std::size_t f = 0; f < maxPage.size(); f++)
+	{
+		names.push_back("bench_trace." + std::to_string(f));
+		createPageFile(names[f], maxPage[f]);
+	}
+
+	const char* policyNames[] = { "CLOCK", "LRU-K", "2Q", "ARC" };
+	const ReplacementPolicyType policies[] = { CLOCK_POLICY, LRUK_POLICY, TWOQ_POLICY, ARC_POLICY };
+	std::cout << trace.size() << " requests" << std::endl
+						<< "frames  policy  hit ratio  ns/readPage" << std::endl;
+	{
+		std::vector<PageFile> files;
+		files.reserve(names.size());
+		for (std::size_t f = 0; f < names.size(); f++)
+			files.push_back(PageFile::open(names[f]));
+		for (std::size_t n = 0; n < poolSizes.size(); n++)
+		{
+			for (int p = 0; p < 4; p++)
+			{
+				BufMgr bufMgr(poolSizes[n], policies[p]);
+				const Clock::time_point start = Clock::now();
+				for (std::size_t i = 0; i < trace.size(); i++)
+				{
+					Page* page;
+					bufMgr.readPage(&files[trace[i].file], trace[i].pageNo, page);
+					bufMgr.unPinPage(&files[trace[i].file], trace[i].pageNo, false);
+				}
+				const double seconds = secondsSince(start);
+				const double hits = 1.0 - (double)bufMgr.getBufStats().diskreads / trace.size();
+				std::cout << std::setw(6) << poolSizes[n] << "  " << std::left << std::setw(8)
+									<< policyNames[p] << std::right << std::fixed << std::setprecision(3)
+									<< std::setw(9) << hits << "  " << std::setprecision(0) << std::setw(11)
+									<< seconds / trace.size() * 1e9 << std::endl;
+			}
+		}
+	}
+	for (std::size_t f = 0; f < names.size(); f++)
+		removeFile(names[f]);
+}
+
+
+/**
+ * Fills file with numPages pages.
+ */
+void fillFile(File& file, const std::uint32_t numPages)
+{
+	const std::string record(64, 'r');
+	for (std::uint32_t i = 0; i < numPages; i++)
+	{
+		PageId pageNo;
+		Page page = file.allocatePage(pageNo);
+		page.insertRecord(record);
+		file.writePage(pageNo, page);
+	}
+}
+
+/**
+ * Random single-page reads per second from file, and reads per second in
+ * batches of batch pages through readPages().
+ */
+void randomReads(File& file, const std::uint32_t numPages, const long reads,
+								 Page* pages, const std::uint32_t batch)
+{
+	std::mt19937 rng(3);
+	Clock::time_point start = Clock::now();
+	for (long i = 0; i < reads; i++)
+		file.readPageInto(1 + rng() % numPages, pages[0]);
+	const double single = reads / secondsSince(start);
+
+	std::vector<PageId> pageNos(batch);
+	std::vector<Page*> batchPages(batch);
+	for (std::uint32_t j = 0; j < batch; j++)
+		batchPages[j] = &pages[j];
+	start = Clock::now();
+	for (long i = 0; i < reads; i += batch)
+	{
+		for (std::uint32_t j = 0; j < batch; j++)
+			pageNos[j] = 1 + rng() % numPages;
+		file.readPages(batch, pageNos.data(), batchPages.data());
+	}
+	const double batched = reads / secondsSince(start);
+
+	std::cout << std::fixed << std::setprecision(0) << std::setw(12) << single
+						<< std::setw(14) << batched << std::endl;
+}
+
+/**
+ * Random-read IOPS of IoUringFile against the stream based BlobFile, one page
+ * at a time and in batches. With direct set, IoUringFile reads with O_DIRECT;
+ * otherwise both read through the page cache, and make the file larger than
+ * RAM to measure the disk.
+ */
+void uringBench(int argc, char** argv)
+{
+	const std::uint32_t numPages = argOr(argc, argv, 0, 16384);
+	const long reads = argOr(argc, argv, 1, 200000);
+	const bool direct = argOr(argc, argv, 2, 0) != 0;
+	// one ring's worth of requests, IoUringFile::QUEUE_DEPTH
+	const std::uint32_t batch = 64;
+	const std::string blobName = "bench_blob.0";
+	const std::string uringName = "bench_uring.0";
+
+	// aligned for O_DIRECT
+	void* mem = NULL;
+	if (posix_memalign(&mem, 4096, sizeof(Page) * batch) != 0)
+		throw std::bad_alloc();
+	Page* pages = static_cast<Page*>(mem);
+	for (std::uint32_t j = 0; j < batch; j++)
+		new (&pages[j]) Page();
+
+	removeFile(blobName);
+	removeFile(uringName);
+	std::cout << "file         single IOPS  batched IOPS" << std::endl;
+	{
+		BlobFile blob(blobName, true);
+		fillFile(blob, numPages);
+		std::cout << "BlobFile    ";
+		randomReads(blob, numPages, reads, pages, batch);
+	}
+	{
+		IoUringFile uring = IoUringFile::create(uringName, direct);
+		fillFile(uring, numPages);
+		std::cout << "IoUringFile ";
+		randomReads(uring, numPages, reads, pages, batch);
+	}
+	removeFile(blobName);
+	removeFile(uringName);
+
+	for (std::uint32_t j = 0; j < batch; j++)
+		pages[j].~Page();
+	free(mem);
+}
+
+/**
+ * Bulk load of a PageFile: allocates and writes numPages pages, reporting the
+ * time per page for each doubling of the file, which stays flat as long as
+ * allocation does not depend on the size of the file.
+ */
+void allocBench(int argc, char** argv)
+{
+	const std::uint32_t numPages = argOr(argc, argv, 0, 1000000);
+	const std::string name = "bench_alloc.0";
+	const std::string record(64, 'r');
+
+	removeFile(name);
+	std::cout << "pages        us/page" << std::endl;
+	{
+		PageFile file = PageFile::create(name);
+		std::uint32_t loaded = 0;
+		for (std::uint32_t step = 1024; loaded < numPages; step *= 2)
+		{
+			const std::uint32_t target = std::min(numPages, step);
+			const std::uint32_t count = target - loaded;
+			const Clock::time_point start = Clock::now();
+			for (; loaded < target; loaded++)
+			{
+				PageId pageNo;
+				Page page = file.allocatePage(pageNo);
+				page.insertRecord(record);
+				file.writePage(pageNo, page);
+			}
+			std::cout << std::setw(7) << loaded << "  " << std::fixed << std::setprecision(2)
+								<< std::setw(11) << secondsSince(start) / count * 1e6 << std::endl;
+		}
+	}
+	removeFile(name);
+}
+
+/**
+ * Reads every cache line of page, so that the whole page is actually fetched.
+ */
+std::uint64_t touchPage(const Page& page)
+{
+	const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&page);
+	std::uint64_t sum = 0;
+	for (std::size_t i = 0; i < sizeof(Page); i += 64)
+		sum += bytes[i];
+	return sum;
+}
+
+/**
+ * Scan and point-probe throughput of MmapPageFile against reading through
+ * PageFile's stream, over a relation of numPages pages. Make the relation
+ * larger than RAM to measure the disk rather than the page cache.
+ */
+void mmapBench(int argc, char** argv)
+{
+	const std::uint32_t numPages = argOr(argc, argv, 0, 100000);
+	const long probes = argOr(argc, argv, 1, 100000);
+	const std::string name = "bench_mmap.0";
+
+	createPageFile(name, numPages);
+	std::uint64_t sum = 0;
+	double seconds[2][2];
+	{
+		PageFile file = PageFile::open(name);
+		Clock::time_point start = Clock::now();
+		for (PageId pageNo = 1; pageNo <= numPages; pageNo++)
+			sum += touchPage(file.readPage(pageNo));
+		seconds[0][0] = secondsSince(start);
+
+		std::mt19937 rng(5);
+		start = Clock::now();
+		for (long i = 0; i < probes; i++)
+			sum += touchPage(file.readPage(1 + rng() % numPages));
+		seconds[0][1] = secondsSince(start);
+	}
+	{
+		MmapPageFile file(name);
+		file.advise(MmapPageFile::SEQUENTIAL_ACCESS);
+		Clock::time_point start = Clock::now();
+		for (PageId pageNo = 1; pageNo <= numPages; pageNo++)
+			sum += touchPage(*file.mappedPage(pageNo));
+		seconds[1][0] = secondsSince(start);
+
+		file.advise(MmapPageFile::RANDOM_ACCESS);
+		std::mt19937 rng(5);
+		start = Clock::now();
+		for (long i = 0; i < probes; i++)
+			sum += touchPage(*file.mappedPage(1 + rng() % numPages));
+		seconds[1][1] = secondsSince(start);
+	}
+	removeFile(name);
+
+	const char* fileNames[] = { "PageFile    ", "MmapPageFile" };
+	std::cout << "file          scan pages/s  probes/s" << std::endl;
+	for (int f = 0; f < 2; f++)
+	{
+		std::cout << fileNames[f] << std::fixed << std::setprecision(0)
+							<< std::setw(14) << numPages / seconds[f][0]
+							<< std::setw(10) << probes / seconds[f][1] << std::endl;
+	}
+	std::cout << "(checksum " << sum << ")" << std::endl;
+}
+
+/**
+ * Time to write back a pool full of dirty pages of one file with flushFile(),
+ * against writing the same pages one writePage() at a time in the random
+ * order of the frames holding them, as flushFile() used to.
+ */
+void flushBench(int argc, char** argv)
+{
+	const std::uint32_t numPages = argOr(argc, argv, 0, 100000);
+	const std::string name = "bench_flush.0";
+
+	createPageFile(name, numPages);
+	std::vector<PageId> order(numPages);
+	for (std::uint32_t i = 0; i < numPages; i++)
+		order[i] = i + 1;
+	std::shuffle(order.begin(), order.end(), std::mt19937(9));
+
+	double seconds[2];
+	{
+		PageFile file = PageFile::open(name);
+		BufMgr bufMgr(numPages);
+		for (std::uint32_t i = 0; i < numPages; i++)
+		{
+			Page* page;
+			bufMgr.readPage(&file, order[i], page);
+			bufMgr.unPinPage(&file, order[i], true);
+		}
+		const Clock::time_point start = Clock::now();
+		bufMgr.flushFile(&file);
+		seconds[0] = secondsSince(start);
+	}
+	{
+		PageFile file = PageFile::open(name);
+		std::vector<Page> pages(numPages);
+		for (std::uint32_t i = 0; i < numPages; i++)
+			pages[i] = file.readPage(order[i]);
+		const Clock::time_point start = Clock::now();
+		for (std::uint32_t i = 0; i < numPages; i++)
+			file.writePage(order[i], pages[i]);
+		file.sync();
+		seconds[1] = secondsSince(start);
+	}
+	removeFile(name);
+
+	std::cout << "write-back          seconds" << std::endl
+						<< std::fixed << std::setprecision(2)
+						<< "flushFile        " << std::setw(10) << seconds[0] << std::endl
+						<< "page by page     " << std::setw(10) << seconds[1] << std::endl;
+}
+
+/**
+ * @brief Record of the relations the benchmarks index, as in main.cpp.
+ */
+struct BenchRecord
+{
+	int i;
+	double d;
+	char s[64];
+};
+
+/**
+ * Creates a relation of numRecords BenchRecords with distinct keys in random
+ * order; key k is stored as i = k, d = k and s = k printed with ten digits.
+ */
+void createRelation(const std::string& name, const std::uint32_t numRecords)
+{
+	std::vector<int> keys(numRecords);
+	for (std::uint32_t k = 0; k < numRecords; k++)
+		keys[k] = k;
+	std::shuffle(keys.begin(), keys.end(), std::mt19937(13));
+
+	removeFile(name);
+	PageFile file = PageFile::create(name);
+	PageId pageNo;
+	Page page = file.allocatePage(pageNo);
+	for (std::uint32_t k = 0; k < numRecords; k++)
+	{
+		BenchRecord record;
+		memset(&record, 0, sizeof(record));
+		record.i = keys[k];
+		record.d = keys[k];
+		snprintf(record.s, sizeof(record.s), "%010d", keys[k]);
+		const std::string bytes(reinterpret_cast<const char*>(&record), sizeof(record));
+		if (!page.hasSpaceForRecord(bytes))
+		{
+			file.writePage(pageNo, page);
+			page = file.allocatePage(pageNo);
+		}
+		page.insertRecord(bytes);
+	}
+	file.writePage(pageNo, page);
+}
+
+/**
+ * Point lookup latency, from the root down to the leaf and back with the
+ * matching record id, of indexes on each type of key over one relation.
+ */
+void searchBench(int argc, char** argv)
+{
+	const std::uint32_t numRecords = argOr(argc, argv, 0, 1000000);
+	const long lookups = argOr(argc, argv, 1, 1000000);
+	const std::string relationName = "bench_search";
+
+	createRelation(relationName, numRecords);
+	std::vector<std::uint32_t> probes(1 << 16);
+	std::mt19937 rng(17);
+	for (std::size_t i = 0; i < probes.size(); i++)
+		probes[i] = rng() % numRecords;
+
+	const char* typeNames[] = { "INTEGER", "DOUBLE", "STRING" };
+	const Datatype types[] = { INTEGER, DOUBLE, STRING };
+	const int offsets[] = { offsetof(BenchRecord, i), offsetof(BenchRecord, d), offsetof(BenchRecord, s) };
+	std::cout << "key type   us/lookup" << std::endl;
+	BufMgr bufMgr(100000);
+	for (int t = 0; t < 3; t++)
+	{
+		std::string indexName;
+		long found = 0;
+		double seconds;
+		{
+			BTreeIndex index(relationName, indexName, &bufMgr, offsets[t], types[t]);
+			const Clock::time_point start = Clock::now();
+			for (long i = 0; i < lookups; i++)
+			{
+				const int key = probes[i & (probes.size() - 1)];
+				const double d = key;
+				char s[64];
+				snprintf(s, sizeof(s), "%010d", key);
+				const void* keyPtr = t == 0 ? (const void*) &key : t == 1 ? (const void*) &d : (const void*) s;
+				try
+				{
+					index.startScan(keyPtr, GTE, keyPtr, LTE);
+					RecordId rid;
+					while (index.next(rid))
+						found++;
+					index.endScan();
+				}
+				catch(const NoSuchKeyFoundException &e)
+				{
+				}
+			}
+			seconds = secondsSince(start);
+		}
+		removeFile(indexName);
+		std::cout << std::left << std::setw(9) << typeNames[t] << std::right << std::fixed
+							<< std::setprecision(2) << std::setw(11) << seconds / lookups * 1e6
+							<< (found == lookups ? "" : "  (keys missing)") << std::endl;
+	}
+	removeFile(relationName);
+}
+
+/**
+ * Concurrent insert and lookup throughput of an INTEGER index with 8, 16 and
+ * 32 threads (or the counts given). Each round indexes a fresh relation of
+ * numRecords records, then every thread inserts its own inserts keys and
+ * afterwards looks up as many existing keys through its own IndexCursor.
+ */
+void btreeBench(int argc, char** argv)
+{
+	const std::uint32_t numRecords = argOr(argc, argv, 0, 200000);
+	const long opsPerThread = argOr(argc, argv, 1, 50000);
+	const std::uint32_t numBufs = argOr(argc, argv, 2, 100000);
+	std::vector<int> threadCounts;
+	for (int i = 3; i < argc; i++)
+		threadCounts.push_back(std::atoi(argv[i]));
+	if (threadCounts.empty())
+	{
+		threadCounts.push_back(8);
+		threadCounts.push_back(16);
+		threadCounts.push_back(32);
+	}
+	const std::string relationName = "bench_btree";
+
+	createRelation(relationName, numRecords);
+	std::cout << "threads  inserts Mops/s  lookups Mops/s" << std::endl;
+	for (std::size_t c = 0; c < threadCounts.size(); c++)
+	{
+		const int threads = threadCounts[c];
+		BufMgr bufMgr(numBufs);
+		std::string indexName;
+		double seconds[2];
+		long found = 0;
+		{
+			BTreeIndex index(relationName, indexName, &bufMgr, offsetof(BenchRecord, i), INTEGER);
+			std::vector<std::thread> workers;
+			Clock::time_point start = Clock::now();
+			for (int t = 0; t < threads; t++)
+			{
+				workers.push_back(std::thread([&, t]() {
+					// keys above the relation's, interleaved between the threads
+					for (long i = 0; i < opsPerThread; i++)
+					{
+						const int key = numRecords + i * threads + t;
+						const RecordId rid = { static_cast<PageId>(1 + i), static_cast<SlotId>(t) };
+						index.insertEntry(&key, rid);
+					}
+				}));
+			}
+			for (std::size_t t = 0; t < workers.size(); t++)
+				workers[t].join();
+			seconds[0] = secondsSince(start);
+
+			std::vector<long> foundBy(threads, 0);
+			workers.clear();
+			start = Clock::now();
+			for (int t = 0; t < threads; t++)
+			{
+				workers.push_back(std::thread([&, t]() {
+					IndexCursor cursor(&index);
+					std::mt19937 rng(t);
+					for (long i = 0; i < opsPerThread; i++)
+					{
+						const int key = rng() % numRecords;
+						try
+						{
+							cursor.startScan(&key, GTE, &key, LTE);
+							RecordId rid;
+							while (cursor.next(rid))
+								foundBy[t]++;
+							cursor.endScan();
+						}
+						catch(const NoSuchKeyFoundException &e)
+						{
+						}
+					}
+				}));
+			}
+			for (std::size_t t = 0; t < workers.size(); t++)
+				workers[t].join();
+			seconds[1] = secondsSince(start);
+			for (int t = 0; t < threads; t++)
+				found += foundBy[t];
+		}
+		removeFile(indexName);
+
+		const double ops = (double) threads * opsPerThread;
+		std::cout << std::setw(7) << threads << std::fixed << std::setprecision(2)
+							<< std::setw(16) << ops / seconds[0] / 1e6
+							<< std::setw(16) << ops / seconds[1] / 1e6
+							<< (found == threads * opsPerThread ? "" : "  (keys missing)") << std::endl;
+	}
+	removeFile(relationName);
+}
+
+/**
+ * @brief A benchmark the driver can run.
+ */
+struct Benchmark
+{
+	const char* name;
+	const char* args;
+	void (*run)(int argc, char** argv);
+};
+
+const Benchmark benchmarks[] = {
+	{ "scaling", "[maxThreads] [opsPerThread] [pages]", scalingBench },
+	{ "hashtable", "[numBufs] [ops]", hashTableBench },
+	{ "policies", "[trace] [numBufs...]", policyBench },
+	{ "uring", "[pages] [reads] [direct]", uringBench },
+	{ "alloc", "[pages]", allocBench },
+	{ "mmap", "[pages] [probes]", mmapBench },
+	{ "flush", "[pages]", flushBench },
+	{ "search", "[records] [lookups]", searchBench },
+	{ "btree", "[records] [opsPerThread] [numBufs] [threads...]", btreeBench },
+};
+
+int main(int argc, char** argv)
+{
+	const std::size_t count = sizeof(benchmarks) / sizeof(benchmarks[0]);
+	for (std::size_t i = 0; argc > 1 && i < count; i++)
+	{
+		if (std::strcmp(argv[1], benchmarks[i].name) == 0)
+		{
+			benchmarks[i].run(argc - 2, argv + 2);
+			return 0;
+		}
+	}
+
+	std::cerr << "usage: " << argv[0] << " <benchmark> [args]" << std::endl;
+	for (std::size_t i = 0; i < count; i++)
+		std::cerr << "  " << benchmarks[i].name << " " << benchmarks[i].args << std::endl;
+	return 1;
+}
@@ -6,7 +6,21 @@
  * University of Wisconsin-Madison.
  */
 #include "btree.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <memory>
+#include <queue>
+#include <thread>
+#include <vector>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define BTREE_AVX2_SEARCH
+#endif
+
 #include "filescan.h"
+#include "mmap_page_file.h"
 #include "exceptions/bad_index_info_exception.h"
 #include "exceptions/end_of_file_exception.h"
 #include "exceptions/scan_not_initialized_exception.h"
@@ -15,6 +29,7 @@
 #include "exceptions/no_such_key_found_exception.h"
 #include "exceptions/file_not_found_exception.h"
 #include "exceptions/bad_scanrange_exception.h"
+#include "exceptions/file_io_exception.h"
 
 namespace badgerdb {
 //=============================================================================
@@ -22,17 +37,405 @@ namespace badgerdb {
 // Private Helper Methods: The following are custom private helper methods.
 //
 //=============================================================================  
+    /**
+    * Reads a key of type T from an attribute or a scan bound.
+    * @param key      pointer to integer / double / char string
+    * @return the key
+    */
+    template <class T>
+    static T read_key(const void *key) {
+      T value;
+      memcpy(&value, key, sizeof(T));
+      return value;
+    }
+    template <>
+    StringKey read_key<StringKey>(const void *key) {
+      StringKey value;//only the first STRINGSIZE characters are kept
+      strncpy(value.data, (const char *) key, STRINGSIZE);
+      return value;
+    }
+    /**
+    * Successor of a leaf in the sibling chain, for read-ahead.
+    * @param page     leaf page
+    * @return page number of the right sibling, 0 for the last leaf.
+    */
+    template <class T>
+    static PageId right_sibling(const Page& page) {
+      return ((const LeafNode<T> *) &page)->rightSibPageNo;
+    }
+    /**
+    * Counts the keys of a short run that sort before key, or that are not
+    * greater than key when Upper is set. Every key is compared, without
+    * branching on the outcome.
+    * @param keys     sorted keys
+    * @param n        number of keys
+    * @param key      key searched for
+    * @return the number of keys counted
+    */
+    template <bool Upper, class T>
+    static int count_before(const T *keys, const int n, const T& key) {
+      int count = 0;
+      for (int i = 0; i < n; i++) count += Upper ? !(key < keys[i]) : keys[i] < key;
+      return count;
+    }
+#ifdef BTREE_AVX2_SEARCH
+    /**
+    * Checks whether the processor has AVX2.
+    * @return True if it has
+    */
+    static bool has_avx2() {
+      __builtin_cpu_init();//may run before the cpu model is set up otherwise
+      return __builtin_cpu_supports("avx2");
+    }
+    /**
+    * Whether count_before compares keys with AVX2; the build itself targets
+    * plain x86-64, so this is settled when the program starts.
+    */
+    static bool vector_search = has_avx2();
+    /**
+    * count_before for integer keys, eight keys per compare.
+    */
+    template <bool Upper>
+    __attribute__((target("avx2")))
+    static int count_before_avx2(const int *keys, const int n, const int& key) {
+      const __m256i probe = _mm256_set1_epi32(key);
+      int count = 0, i = 0;
+      for (; i + 8 <= n; i += 8) {
+        const __m256i run = _mm256_loadu_si256((const __m256i *) (keys + i));
+        const __m256i hits = Upper ? _mm256_cmpgt_epi32(run, probe) 
+          : _mm256_cmpgt_epi32(probe, run);
+        const int mask = _mm256_movemask_ps(_mm256_castsi256_ps(hits));
+        count += Upper ? 8 - __builtin_popcount(mask) : __builtin_popcount(mask);
+      }
+      for (; i < n; i++) count += Upper ? !(key < keys[i]) : keys[i] < key;
+      return count;
+    }
+    /**
+    * count_before for double keys, four keys per compare.
+    */
+    template <bool Upper>
+    __attribute__((target("avx2")))
+    static int count_before_avx2(const double *keys, const int n, const double& key) {
+      const __m256d probe = _mm256_set1_pd(key);
+      int count = 0, i = 0;
+      for (; i + 4 <= n; i += 4) {
+        const __m256d run = _mm256_loadu_pd(keys + i);
+        const __m256d hits = _mm256_cmp_pd(run, probe, Upper ? _CMP_LE_OQ : _CMP_LT_OQ);
+        count += __builtin_popcount(_mm256_movemask_pd(hits));
+      }
+      for (; i < n; i++) count += Upper ? !(key < keys[i]) : keys[i] < key;
+      return count;
+    }
+    template <bool Upper>
+    static int count_before(const int *keys, const int n, const int& key) {
+      return vector_search ? count_before_avx2<Upper>(keys, n, key) 
+        : count_before<Upper, int>(keys, n, key);
+    }
+    template <bool Upper>
+    static int count_before(const double *keys, const int n, const double& key) {
+      return vector_search ? count_before_avx2<Upper>(keys, n, key) 
+        : count_before<Upper, double>(keys, n, key);
+    }
+#endif
+    /**
+    * Finds where key belongs among the sorted keys of a node. A branch-free
+    * binary search narrows the keys down to two cache lines, which are then
+    * counted in one pass.
+    * @param keys     sorted keys
+    * @param n        number of keys
+    * @param key      key searched for
+    * @return the number of keys less than key; with Upper, the number of keys 
+    *         not greater than key
+    */
+    template <bool Upper, class T>
+    static int search_keys(const T *keys, int n, const T& key) {
+      const int run = 128 / sizeof(T) > 0 ? 128 / sizeof(T) : 1;
+      const T *base = keys;
+      while (n > run) {
+        const int half = n / 2;
+        base = (Upper ? !(key < base[half]) : base[half] < key) ? base + half : base;
+        n -= half;
+      }
+      return (int) (base - keys) + count_before<Upper>(base, n, key);
+    }
+    /**
+    * Waits until no writer holds a node and returns its version, to check
+    * against once the node has been read.
+    * @param version  version of the node
+    * @return the version, even
+    */
+    static std::uint64_t read_version(const std::atomic<std::uint64_t>& version) {
+      std::uint64_t seen = version.load(std::memory_order_acquire);
+      while (seen & 1) {
+        std::this_thread::yield();
+        seen = version.load(std::memory_order_acquire);
+      }
+      return seen;
+    }
+    /**
+    * Checks that no writer changed a node since its version was read.
+    * @param version  version of the node
+    * @param seen     version returned by read_version()
+    * @return True if what was read of the node is consistent.
+    */
+    static bool validate_version(const std::atomic<std::uint64_t>& version, 
+      const std::uint64_t seen) {
+      std::atomic_thread_fence(std::memory_order_acquire);
+      return version.load(std::memory_order_relaxed) == seen;
+    }
+    /**
+    * Latches a node for writing, making its version odd.
+    * @param version  version of the node
+    */
+    static void lock_version(std::atomic<std::uint64_t>& version) {
+      std::uint64_t seen = read_version(version);
+      while (!version.compare_exchange_weak(seen, seen + 1, 
+        std::memory_order_acquire)) seen = read_version(version);
+    }
+    /**
+    * Releases a node latched for writing, moving it to a new even version.
+    * @param version  version of the node
+    */
+    static void unlock_version(std::atomic<std::uint64_t>& version) {
+      version.fetch_add(1, std::memory_order_release);
+    }
+    namespace {
+    /**
+    * Sorted run of key-rid pairs kept in a temporary file while an index is
+    * bulk loaded, read back a buffer at a time while the runs are merged.
+    */
+    template <class T>
+    class SortedRun {
+     public:
+      /**
+      * Writes the given sorted pairs to a new temporary file.
+      * @param pairs      sorted pairs
+      * @param filename   name of index file, for errors
+      */
+      SortedRun(const std::vector<RIDKeyPair<T> >& pairs, 
+        const std::string& filename) : next(0) {
+        file = std::tmpfile();
+        if (file == nullptr || std::fwrite(pairs.data(), sizeof(RIDKeyPair<T>),
+          pairs.size(), file) != pairs.size() || std::fflush(file) != 0) {
+          const int error = errno;
+          if (file != nullptr) std::fclose(file);
+          throw FileIOException(Page::INVALID_NUMBER, filename, error);
+        }
+        std::rewind(file);
+        refill();
+      }
+      ~SortedRun() { std::fclose(file); }
+      /**
+      * @return True once every pair has been read.
+      */
+      bool empty() const { return next == buffer.size(); }
+      /**
+      * @return the smallest pair not yet read.
+      */
+      const RIDKeyPair<T>& front() const { return buffer[next]; }
+      /**
+      * Moves on to the next pair.
+      */
+      void pop() {
+        if (++next == buffer.size()) refill();
+      }
+     private:
+      void refill() {
+        buffer.resize(4096);
+        buffer.resize(std::fread(buffer.data(), sizeof(RIDKeyPair<T>), 
+          buffer.size(), file));
+        next = 0;
+      }
+      std::FILE* file;
+      std::vector<RIDKeyPair<T> > buffer;
+      std::size_t next;
+    };
+    }
+    template <> int& BTreeIndex::low_value<int>(ScanState& scan) { 
+      return scan.lowValInt; 
+    }
+    template <> int& BTreeIndex::high_value<int>(ScanState& scan) { 
+      return scan.highValInt; 
+    }
+    template <> double& BTreeIndex::low_value<double>(ScanState& scan) { 
+      return scan.lowValDouble; 
+    }
+    template <> double& BTreeIndex::high_value<double>(ScanState& scan) { 
+      return scan.highValDouble; 
+    }
+    template <> StringKey& BTreeIndex::low_value<StringKey>(ScanState& scan) { 
+      return scan.lowValString; 
+    }
+    template <> StringKey& BTreeIndex::high_value<StringKey>(ScanState& scan) { 
+      return scan.highValString; 
+    }
+    /**
+    * Helper method to point the key-type dependent methods at their versions
+    * for keys of type T.
+    */
+    template <class T>
+    void BTreeIndex::bind_key_type() {
+      insert_entry_fn = &BTreeIndex::insert_entry<T>;
+      start_scan_fn = &BTreeIndex::start_scan<T>;
+      next_fn = &BTreeIndex::next_entry<T>;
+      bulk_load_fn = &BTreeIndex::bulk_load<T>;
+      leafOccupancy = NodeLayout<T>::LEAFSIZE;
+      nodeOccupancy = NodeLayout<T>::NONLEAFSIZE;
+    }
+    /**
+    * Helper method to build the tree bottom-up from every tuple of the
+    * relation. Leaves are filled left to right on consecutive pages, starting
+    * with the root page, so the index file is written in order.
+    * @param fileScan     scan over the relation
+    * @param fillFactor   fraction of the key slots of each node to fill
+    */
+    template <class T>
+    void BTreeIndex::bulk_load(FileScan& fileScan, const double fillFactor) {
+      typedef std::vector<RIDKeyPair<T> > Pairs;
+      const std::size_t run_size = std::max<std::size_t>(1, 
+        BULKLOADSORTBYTES / sizeof(RIDKeyPair<T>));
+      std::vector<std::unique_ptr<SortedRun<T> > > runs;
+      Pairs pairs;
+      RecordId rid;
+      while(fileScan.next(rid)) {//extract every pair, spilling sorted runs
+        const RecordView record = fileScan.getRecordView();
+        RIDKeyPair<T> pair;
+        pair.set(rid, read_key<T>(record.data + attrByteOffset));
+        pairs.push_back(pair);
+        if (pairs.size() == run_size) {
+          std::sort(pairs.begin(), pairs.end());
+          runs.emplace_back(new SortedRun<T>(pairs, file->filename()));
+          pairs.clear();
+        }
+      }
+      std::sort(pairs.begin(), pairs.end());
+      if (!runs.empty() && !pairs.empty()) {
+        runs.emplace_back(new SortedRun<T>(pairs, file->filename()));
+        Pairs().swap(pairs);
+      }
+
+      // Pack the leaves, remembering the first key of each for the level above.
+      const int per_leaf = std::max(1, 
+        std::min(NodeLayout<T>::LEAFSIZE, (int) (NodeLayout<T>::LEAFSIZE * fillFactor)));
+      std::vector<PageKeyPair<T> > level;
+      LeafNode<T>* leaf = nullptr;
+      PageId leaf_pid = rootPageNum;
+      auto append = [&](const RIDKeyPair<T>& pair) {
+        if (leaf == nullptr || leaf->keyCount == per_leaf) {
+          Page* page;
+          PageId pid = rootPageNum;
+          if (leaf == nullptr) bufMgr->readPage(file, pid, page);
+          else {
+            bufMgr->allocPage(file, pid, page);
+            leaf->highKey = pair.key, leaf->rightSibPageNo = pid;
+            bufMgr->unPinPage(file, leaf_pid, true);
+          }
+          leaf = (LeafNode<T> *) page, leaf_pid = pid;
+          leaf->keyCount = 0, leaf->rightSibPageNo = 0;
+          PageKeyPair<T> first;
+          first.set(pid, pair.key);
+          level.push_back(first);
+        }
+        leaf->keyArray[leaf->keyCount] = pair.key, 
+          leaf->ridArray[leaf->keyCount] = pair.rid;
+        leaf->keyCount++;
+      };
+      if (runs.empty()) {
+        for (std::size_t i = 0; i < pairs.size(); i++) append(pairs[i]);
+      } else {//merge the runs, smallest front first
+        auto greater = [&](const std::size_t a, const std::size_t b) {
+          return runs[b]->front() < runs[a]->front();
+        };
+        std::priority_queue<std::size_t, std::vector<std::size_t>, 
+          decltype(greater)> heap(greater);
+        for (std::size_t i = 0; i < runs.size(); i++) heap.push(i);
+        while (!heap.empty()) {
+          const std::size_t i = heap.top();
+          heap.pop();
+          append(runs[i]->front());
+          runs[i]->pop();
+          if (!runs[i]->empty()) heap.push(i);
+        }
+      }
+      if (leaf != nullptr) bufMgr->unPinPage(file, leaf_pid, true);
+
+      // Build each non-leaf level over the one below until one node is left.
+      // Children are spread evenly over the nodes of a level, so that none is
+      // left with a single child.
+      const std::size_t per_node = std::max<std::size_t>(3, 
+        std::min(NodeLayout<T>::NONLEAFSIZE + 1, 
+          (int) ((NodeLayout<T>::NONLEAFSIZE + 1) * fillFactor)));
+      // Each node is linked to the next of its level, which it is unpinned
+      // for, as leaves are.
+      int height = 0;
+      for (; level.size() > 1; height++) {
+        const std::size_t num_nodes = (level.size() + per_node - 1) / per_node;
+        std::vector<PageKeyPair<T> > parents;
+        std::size_t next = 0;
+        NonLeafNode<T>* prev = nullptr;
+        PageId prev_pid = 0;
+        for (std::size_t node = 0; node < num_nodes; node++) {
+          const std::size_t left = num_nodes - node;
+          const std::size_t children = (level.size() - next + left - 1) / left;
+          Page* page;
+          PageId pid;
+          bufMgr->allocPage(file, pid, page);
+          NonLeafNode<T>* nonleaf = (NonLeafNode<T> *) page;
+          nonleaf->level = height == 0 ? 1 : 0, nonleaf->keyCount = children - 1;
+          nonleaf->rightSibPageNo = 0;
+          nonleaf->pageNoArray[0] = level[next].pageNo;
+          for (std::size_t j = 1; j < children; j++) 
+            nonleaf->keyArray[j-1] = level[next + j].key,
+              nonleaf->pageNoArray[j] = level[next + j].pageNo;
+          if (prev != nullptr) {
+            prev->highKey = level[next].key, prev->rightSibPageNo = pid;
+            bufMgr->unPinPage(file, prev_pid, true);
+          }
+          prev = nonleaf, prev_pid = pid;
+          PageKeyPair<T> first;
+          first.set(pid, level[next].key);
+          parents.push_back(first);
+          next += children;
+        }
+        bufMgr->unPinPage(file, prev_pid, true);
+        level.swap(parents);
+      }
+      if (height > 0) {
+        Page* temp;
+        bufMgr->readPage(file, headerPageNum, temp);
+        IndexMetaInfo* meta_info = (IndexMetaInfo *) temp;
+        meta_info->rootPageNo = level[0].pageNo, rootPageNum = level[0].pageNo;
+        meta_info->treeHeight = height, treeHeight = height;
+        bufMgr->unPinPage(file, headerPageNum, true);
+      }
+    }
+    /**
+    * Helper method to read ahead the right siblings of the leaf the scan just
+    * moved to. Issued again once half of the previous read-ahead is consumed.
+    * @param scan     state of the scan
+    * @param next_pid right sibling of the leaf now being scanned
+    */
+    template <class T>
+    const void BTreeIndex::prefetch_leaves(ScanState& scan, const PageId next_pid) {
+      if(scan.leavesUntilPrefetch > 0) {
+        scan.leavesUntilPrefetch--;
+        return;
+      }
+      bufMgr->prefetchChain(file, next_pid, LEAFPREFETCHDEPTH, right_sibling<T>);
+      scan.leavesUntilPrefetch = LEAFPREFETCHDEPTH / 2;
+    }
     /**
     * Helper method to check if the key is satisfied.
-    * @param lowVal   Low value of range, pointer to integer / double / char string
+    * @param lowVal   Low value of range
     * @param lowOp    Low operator (GT/GTE)
-    * @param highVal  High value of range, pointer to integer / double / char string
+    * @param highVal  High value of range
     * @param highOp   High operator (LT/LTE)
     * @param val      Value of the key
     * @return True if satisfied; False otherwise.
     */
-    const bool BTreeIndex::is_key_satisfied(int lowVal, const Operator lowOp, 
-      int highVal, const Operator highOp, int key) {
+    template <class T>
+    const bool BTreeIndex::is_key_satisfied(const T& lowVal, const Operator lowOp, 
+      const T& highVal, const Operator highOp, const T& key) {
       //check each range one by one
       if(lowOp == GTE && highOp == LTE) return key <= highVal && key >= lowVal;
       else if(lowOp == GT && highOp == LTE) return key <= highVal && key > lowVal;
@@ -40,88 +443,167 @@ namespace badgerdb {
       else return key < highVal && key > lowVal;
     }
     /**
-     * Find the next nonleaf position to be inserted.
+     * Find the next nonleaf position to be inserted. The node is read without
+     * a latch and read again if a writer changed it meanwhile.
      * @param cur_page      current page to be checked
      * @param next_pageid   return val for the next level pageid
      * @param key           the key to be checked
+     * @return True if next_pageid is the right sibling, as key is past the 
+     *         keys of the node; False if it is a child.
      */
-    const void BTreeIndex::findnext_nonleaf(NonLeafNodeInt *cur_page, 
-      PageId &next_pageid, int key) {
-      int i = nodeOccupancy;//keep decrement until find the right pos
-      for(;i >= 0 && (cur_page->pageNoArray[i]) == 0;i--);
-      for(;i > 0 && (cur_page->keyArray[i-1]) >= key;i--);
-      next_pageid = cur_page->pageNoArray[i];
+    template <class T>
+    const bool BTreeIndex::findnext_nonleaf(NonLeafNode<T> *cur_page, 
+      PageId &next_pageid, const T& key) {
+      while(true) {
+        const std::uint64_t version = read_version(cur_page->version);
+        const bool past = cur_page->rightSibPageNo != 0 && key > cur_page->highKey;
+        if (past) next_pageid = cur_page->rightSibPageNo;
+        else {//the child right of the keys below key, so equal keys go left
+          const int count = std::min(std::max(cur_page->keyCount, 0), 
+            NodeLayout<T>::NONLEAFSIZE);
+          next_pageid = cur_page->pageNoArray[search_keys<false>(
+            cur_page->keyArray, count, key)];
+        }
+        if (validate_version(cur_page->version, version)) return past;
+      }
     }
     /**
-     * helper method to insert the index entry to the right position of the index file
-     * @param cur_page      current page to be checked
-     * @param cur_pid       current pageid
-     * @param is_leaf       is leaf or not
-     * @param target        actual index to be inserted
-     * @param new_entry     A pageKeyPair:the entry that is pushed up after 
-     *                      splitting a node, or null when no split in child node
+     * Find the leaf a key belongs in, from the root down. No node is latched;
+     * nodes that split meanwhile are followed right.
+     * @param key           the key to be checked
+     * @param path          return val for the non-leaves passed, if not null
+     * @return page number of the leaf
      */
-    const void BTreeIndex::insert(Page *cur_page, PageId cur_pid, bool is_leaf,
-      const RIDKeyPair<int> target, PageKeyPair<int>*& new_entry) {
-      if (is_leaf) {//trivial for leaf
-        LeafNodeInt* leaf = (LeafNodeInt *)cur_page;
-        if (leaf->ridArray[leafOccupancy - 1].page_number == 0) {
-          insert_leaf(leaf, target);
-          bufMgr->unPinPage(file, cur_pid, true);
-          new_entry = nullptr;
-        } else split_leaf(leaf, cur_pid, new_entry, target);
-      } else {
-        Page* next_page;
-        PageId next_pageid;//init
-        NonLeafNodeInt* cur_node = (NonLeafNodeInt*) cur_page;
-        findnext_nonleaf(cur_node, next_pageid, target.key);
-        bufMgr->readPage(file, next_pageid, next_page);
-        is_leaf = cur_node->level == 1;
-        insert(next_page, next_pageid, is_leaf, target, new_entry);
-        if (new_entry == nullptr) bufMgr->unPinPage(file, cur_pid, false);
-        else {
-          if (cur_node->pageNoArray[nodeOccupancy] == 0) {//nonnull
-            insert_nonleaf(cur_node, new_entry);
-            new_entry = nullptr;
-            bufMgr->unPinPage(file, cur_pid, true);//done, unpin page
-          } else {
-            split_nonleaf(cur_node, cur_pid, new_entry);
-          }
+    template <class T>
+    const PageId BTreeIndex::find_leaf(const T& key, std::vector<PageId>* path) {
+      PageId pid = rootPageNum;
+      if (pid == init_rpn) return pid;//root is leaf
+      while(true) {
+        Page* page;
+        bufMgr->readPage(file, pid, page);
+        NonLeafNode<T>* node = (NonLeafNode<T> *) page;
+        PageId next_pid;
+        const bool past = findnext_nonleaf(node, next_pid, key);
+        const bool above_leaves = node->level == 1;//set once, when created
+        bufMgr->unPinPage(file, pid, false);
+        if (!past) {
+          if (path != nullptr) path->push_back(pid);
+          if (above_leaves) return next_pid;
+        }
+        pid = next_pid;
+      }
+    }
+    /**
+     * Find the non-leaf a key belongs in at a height, from the current root.
+     * Used when the root was split after the way down was taken.
+     * @param height        height of the non-leaf above the leaves
+     * @param key           the key to be checked
+     * @return page number of the non-leaf
+     */
+    template <class T>
+    const PageId BTreeIndex::find_nonleaf(const int height, const T& key) {
+      PageId pid;
+      int levels;
+      {
+        std::lock_guard<std::mutex> guard(rootLatch);
+        pid = rootPageNum, levels = treeHeight - height;
+      }
+      while(levels > 0) {
+        Page* page;
+        bufMgr->readPage(file, pid, page);
+        PageId next_pid;
+        if (!findnext_nonleaf((NonLeafNode<T> *) page, next_pid, key)) levels--;
+        bufMgr->unPinPage(file, pid, false);
+        pid = next_pid;
+      }
+      return pid;
+    }
+    /**
+     * Add the entry for a split node to its parent, going up for as long as 
+     * parents split in turn. Only one node is latched at a time.
+     * @param path          non-leaves passed on the way down, root first
+     * @param height        height of the parent above the leaves
+     * @param left_pid      the node that was split
+     * @param new_entry     the entry for its new right half
+     */
+    template <class T>
+    const void BTreeIndex::insert_parent(std::vector<PageId>& path, int height, 
+      PageId left_pid, PageKeyPair<T> new_entry) {
+      while(true) {
+        PageId first_pid;
+        if (!path.empty()) first_pid = path.back(), path.pop_back();
+        else first_pid = find_nonleaf(height, new_entry.key);//the tree grew
+        PageId pid = first_pid;
+        Page* page;
+        bufMgr->readPage(file, pid, page);
+        NonLeafNode<T>* node = (NonLeafNode<T> *) page;
+        lock_version(node->version);
+        int pos;//position of the split node among the children
+        while((pos = std::find(node->pageNoArray, node->pageNoArray + 
+          node->keyCount + 1, left_pid) - node->pageNoArray) > node->keyCount) {
+          // the split node moved right when the parent split, or its own 
+          // entry is still being added by the writer that created it
+          PageId next_pid = node->rightSibPageNo;
+          unlock_version(node->version);
+          bufMgr->unPinPage(file, pid, false);
+          if (next_pid == 0) next_pid = first_pid, std::this_thread::yield();
+          pid = next_pid;
+          bufMgr->readPage(file, pid, page);
+          node = (NonLeafNode<T> *) page;
+          lock_version(node->version);
+        }
+        if (node->keyCount < NodeLayout<T>::NONLEAFSIZE) {//not full
+          insert_nonleaf(node, pos, new_entry);
+          unlock_version(node->version);
+          bufMgr->unPinPage(file, pid, true);//done, unpin page
+          return;
         }
+        if (!split_nonleaf(node, pid, pos, new_entry)) return;
+        left_pid = pid, height++;
       }
     }
     /**
-     * insert the index entry to the index file
-     * @param tobe_split           the node to be split
-     * @param old_pagenum        PageId of the node tobe_split
-     * @param new_entry     A entry that is pushed up after splitting 
+     * split a full nonleaf node while adding an entry to it
+     * @param tobe_split    the node to be split, latched
+     * @param pid           PageId of the node tobe_split
+     * @param pos           position to add the entry at
+     * @param new_entry     the entry to be added to the node; replaced by the 
+     *                      entry that is pushed up after splitting 
+     * @return True if new_entry goes to the parent; False if the root split.
      */
-    const void BTreeIndex::split_nonleaf(NonLeafNodeInt *tobe_split, 
-      PageId pid, PageKeyPair<int> *&new_entry) {
+    template <class T>
+    const bool BTreeIndex::split_nonleaf(NonLeafNode<T> *tobe_split, 
+      PageId pid, const int pos, PageKeyPair<T>& new_entry) {
+      const int size = NodeLayout<T>::NONLEAFSIZE;
       Page* new_page;
       PageId new_pid;//new nonleaf node init
-      PageKeyPair<int> pushup_entry;//entry to be pushed up
+      PageKeyPair<T> pushup_entry;//entry to be pushed up
       bufMgr->allocPage(file, new_pid, new_page);
-      NonLeafNodeInt *new_node = (NonLeafNodeInt *) new_page;
-      int pushup_index = nodeOccupancy/2, mid = nodeOccupancy/2;
-      if (nodeOccupancy % 2 == 0) 
-        pushup_index = new_entry->key < tobe_split->keyArray[mid] ? mid - 1 : mid;
+      NonLeafNode<T> *new_node = (NonLeafNode<T> *) new_page;
+      const int pushup_index = size/2;
       pushup_entry.set(new_pid, tobe_split->keyArray[pushup_index]);
-      mid = pushup_index + 1;// move half the entries to the new node
-      for(int i = mid; i < nodeOccupancy; i++) 
-        new_node->keyArray[i - mid] = tobe_split->keyArray[i], 
-          new_node->pageNoArray[i - mid] = tobe_split->pageNoArray[i + 1], 
-          tobe_split->pageNoArray[i + 1] = (PageId) 0, 
-          tobe_split->keyArray[i + 1] = 0;
-      new_node->level = tobe_split->level,tobe_split->keyArray[pushup_index] = 0,
-      tobe_split->pageNoArray[pushup_index] = (PageId) 0;
+      // the keys right of the one pushed up, their children and the right 
+      // sibling move to the new node
+      const int mid = pushup_index + 1;
+      std::copy(tobe_split->keyArray + mid, tobe_split->keyArray + size, 
+        new_node->keyArray);
+      std::copy(tobe_split->pageNoArray + mid, tobe_split->pageNoArray + size + 1, 
+        new_node->pageNoArray);
+      new_node->level = tobe_split->level, new_node->keyCount = size - mid;
+      new_node->highKey = tobe_split->highKey, 
+        new_node->rightSibPageNo = tobe_split->rightSibPageNo;
       // remove the entry that is pushed up from current node
-      insert_nonleaf(new_entry->key < new_node->keyArray[0]
-                     ? tobe_split : new_node, new_entry);
-      new_entry = &pushup_entry;
+      tobe_split->keyCount = pushup_index;
+      if (pos < mid) insert_nonleaf(tobe_split, pos, new_entry);
+      else insert_nonleaf(new_node, pos - mid, new_entry);
+      tobe_split->highKey = pushup_entry.key, tobe_split->rightSibPageNo = new_pid;
+      new_entry = pushup_entry;
+      const bool is_root = pid == rootPageNum;
+      if (is_root) update_root(pid, new_entry);
+      unlock_version(tobe_split->version);
       bufMgr->unPinPage(file, pid, true);
       bufMgr->unPinPage(file, new_pid, true);
-      if (pid == rootPageNum)  update_root(pid, new_entry);
+      return !is_root;
     }
     /**
      * For root that needs to be split, create a new root and insert the pushed-up 
@@ -129,94 +611,253 @@ namespace badgerdb {
      * @param firstpage_inroot   the pageid of the first pointer in the root page
      * @param new_entry     the entry that is pushed up
      */
+    template <class T>
     const void BTreeIndex::update_root(PageId firstpage_inroot, 
-      PageKeyPair<int> *new_entry) {
+      const PageKeyPair<T>& new_entry) {
       Page* new_root;
       PageId new_root_pid; 
       Page* temp;
       bufMgr->allocPage(file, new_root_pid, new_root);
-      NonLeafNodeInt *new_root_page = (NonLeafNodeInt *)new_root;
+      NonLeafNode<T> *new_root_page = (NonLeafNode<T> *)new_root;
       //update metadata
       new_root_page->level = init_rpn == rootPageNum ? 1 : 0,
         new_root_page->pageNoArray[0] = firstpage_inroot;
-      new_root_page->pageNoArray[1] = new_entry->pageNo, 
-        new_root_page->keyArray[0] = new_entry->key;
+      new_root_page->pageNoArray[1] = new_entry.pageNo, 
+        new_root_page->keyArray[0] = new_entry.key, new_root_page->keyCount = 1;
+      new_root_page->rightSibPageNo = 0;
+      std::lock_guard<std::mutex> guard(rootLatch);
       bufMgr->readPage(file, headerPageNum, temp);
       IndexMetaInfo* meta_info = (IndexMetaInfo *) temp;
-      meta_info->rootPageNo = new_root_pid, rootPageNum = new_root_pid;
+      meta_info->rootPageNo = new_root_pid, meta_info->treeHeight = treeHeight + 1;
       bufMgr->unPinPage(file, headerPageNum, true);
+      treeHeight++, rootPageNum = new_root_pid;
       bufMgr->unPinPage(file, new_root_pid, true);
     }
     /**
      * split leaf node that is full
-     * @param full_node          full leaf node
+     * @param full_node          full leaf node, latched
      * @param num_leafpage   the number of page of that leaf
-     * @param new_entry the entry to be pushed up
+     * @param new_entry return val for the entry to be pushed up
      * @param target     the entry to be inserted
+     * @return True if new_entry goes to the parent; False if the root split.
      */
-    const void BTreeIndex::split_leaf(LeafNodeInt *full_node, PageId num_leafpage, 
-      PageKeyPair<int> *&new_entry, const RIDKeyPair<int> target) {
+    template <class T>
+    const bool BTreeIndex::split_leaf(LeafNode<T> *full_node, PageId num_leafpage, 
+      PageKeyPair<T>& new_entry, const RIDKeyPair<T>& target) {
+      const int size = NodeLayout<T>::LEAFSIZE;
       Page *new_page;
       PageId new_pid; 
-      PageKeyPair<int> newKeyPair; 
       bufMgr->allocPage(file, new_pid, new_page);
-      LeafNodeInt *newLeafNode = (LeafNodeInt *)new_page;
-      int mid = leafOccupancy/2;
-      if (leafOccupancy %2 == 1 
+      LeafNode<T> *newLeafNode = (LeafNode<T> *)new_page;
+      int mid = size/2;
+      if (size %2 == 1 
         && target.key > full_node->keyArray[mid]) mid = mid + 1;//odd move ahead
-      for(int i = mid; i < leafOccupancy; i++) {//copy half to new leaf node
-        newLeafNode->keyArray[i-mid] = full_node->keyArray[i], 
-          newLeafNode->ridArray[i-mid] = full_node->ridArray[i];
-        full_node->keyArray[i] = 0, full_node->ridArray[i].page_number = 0;
-      }
+      //copy half to new leaf node
+      std::copy(full_node->keyArray + mid, full_node->keyArray + size, 
+        newLeafNode->keyArray);
+      std::copy(full_node->ridArray + mid, full_node->ridArray + size, 
+        newLeafNode->ridArray);
+      newLeafNode->keyCount = size - mid, full_node->keyCount = mid;
       if (target.key > full_node->keyArray[mid-1]) insert_leaf(newLeafNode, target);
       else insert_leaf(full_node, target);
-      newLeafNode->rightSibPageNo = full_node->rightSibPageNo, 
-        full_node->rightSibPageNo = new_pid, new_entry = new PageKeyPair<int>();
+      //the new leaf takes over the right sibling and the high key
+      newLeafNode->highKey = full_node->highKey,
+        newLeafNode->rightSibPageNo = full_node->rightSibPageNo;
+      full_node->highKey = newLeafNode->keyArray[0], 
+        full_node->rightSibPageNo = new_pid;
       //the smallest key from second page
-      newKeyPair.set(new_pid, newLeafNode->keyArray[0]);
-      new_entry = &newKeyPair;
+      new_entry.set(new_pid, newLeafNode->keyArray[0]);
+      //curpage is root!
+      const bool is_root = num_leafpage == rootPageNum;
+      if (is_root) update_root(num_leafpage, new_entry);
+      unlock_version(full_node->version);
       bufMgr->unPinPage(file, num_leafpage, true);
       bufMgr->unPinPage(file, new_pid, true);
-      //curpage is root!
-      if (num_leafpage == rootPageNum) update_root(num_leafpage, new_entry);
+      return !is_root;
     }
     /**
      * insert an entry into a leaf node
      * @param leaf     leaf node that needs to be inserted into
      * @param entry    then entry needed to be inserted
      */
-    const void BTreeIndex::insert_leaf(LeafNodeInt *leaf, RIDKeyPair<int> entry) {
-      if (leaf->ridArray[0].page_number == 0) {//empty
-        leaf->keyArray[0] = entry.key, 
-          leaf->ridArray[0] = entry.rid;
-      } else {
-        int i = leafOccupancy - 1;
-        for(;i >= 0 && (leaf->ridArray[i].page_number == 0);i--);
-        for(;i >= 0 && (leaf->keyArray[i] > entry.key);i--) {
-          leaf->keyArray[i+1] = leaf->keyArray[i],
-            leaf->ridArray[i+1] = leaf->ridArray[i];
-        }
-        //do the work
-        leaf->keyArray[i+1] = entry.key,leaf->ridArray[i+1] = entry.rid;
-      }
+    template <class T>
+    const void BTreeIndex::insert_leaf(LeafNode<T> *leaf, const RIDKeyPair<T>& entry) {
+      const int count = leaf->keyCount;//after the keys not greater than it
+      const int i = search_keys<true>(leaf->keyArray, count, entry.key);
+      std::copy_backward(leaf->keyArray + i, leaf->keyArray + count, 
+        leaf->keyArray + count + 1);
+      std::copy_backward(leaf->ridArray + i, leaf->ridArray + count, 
+        leaf->ridArray + count + 1);
+      //do the work
+      leaf->keyArray[i] = entry.key, leaf->ridArray[i] = entry.rid;
+      leaf->keyCount = count + 1;
     }
     /**
      * insert an entry into a nonleaf node
      * @param nonleaf  nonleaf node that need to be inserted into
+     * @param pos      position of the key of the entry
      * @param entry    then entry needed to be inserted
      *
      */
-    const void BTreeIndex::insert_nonleaf(NonLeafNodeInt *nonleaf, 
-      PageKeyPair<int> *entry) {
-      int i = nodeOccupancy;//keep decrement until find the right position
-      for(;i >= 0 && (nonleaf->pageNoArray[i] == 0);i--);
-      for(;i > 0 && (nonleaf->keyArray[i-1] > entry->key);i--) {
-        nonleaf->keyArray[i] = nonleaf->keyArray[i-1],
-          nonleaf->pageNoArray[i+1] = nonleaf->pageNoArray[i];
-      }
+    template <class T>
+    const void BTreeIndex::insert_nonleaf(NonLeafNode<T> *nonleaf, const int pos,
+      const PageKeyPair<T>& entry) {
+      const int count = nonleaf->keyCount;
+      std::copy_backward(nonleaf->keyArray + pos, nonleaf->keyArray + count, 
+        nonleaf->keyArray + count + 1);
+      std::copy_backward(nonleaf->pageNoArray + pos + 1, 
+        nonleaf->pageNoArray + count + 1, nonleaf->pageNoArray + count + 2);
       //do the work
-      nonleaf->keyArray[i] = entry->key,nonleaf->pageNoArray[i+1] = entry->pageNo;
+      nonleaf->keyArray[pos] = entry.key, nonleaf->pageNoArray[pos+1] = entry.pageNo;
+      nonleaf->keyCount = count + 1;
+    }
+    /**
+     * Insert a new entry using the pair <value,rid>, for keys of type T.
+     * The leaf is latched once found, and moved right from if it split after
+     * the way down was taken.
+     * @param key     Key to insert, pointer to integer/double/char string
+     * @param rid     Record ID of a record whose entry is getting 
+     * inserted into the index.
+     */
+    template <class T>
+    void BTreeIndex::insert_entry(const void *key, const RecordId rid) {
+      RIDKeyPair<T> entry;
+      entry.set(rid, read_key<T>(key));
+      std::vector<PageId> path;
+      PageId pid = find_leaf(entry.key, &path);
+      Page* page;
+      bufMgr->readPage(file, pid, page);
+      LeafNode<T>* leaf = (LeafNode<T> *) page;
+      lock_version(leaf->version);
+      while(leaf->rightSibPageNo != 0 && entry.key > leaf->highKey) {
+        const PageId next_pid = leaf->rightSibPageNo;
+        unlock_version(leaf->version);
+        bufMgr->unPinPage(file, pid, false);
+        pid = next_pid;
+        bufMgr->readPage(file, pid, page);
+        leaf = (LeafNode<T> *) page;
+        lock_version(leaf->version);
+      }
+      if (leaf->keyCount < NodeLayout<T>::LEAFSIZE) {
+        insert_leaf(leaf, entry);
+        unlock_version(leaf->version);
+        bufMgr->unPinPage(file, pid, true);
+        return;
+      }
+      PageKeyPair<T> new_entry;
+      if (split_leaf(leaf, pid, new_entry, entry)) 
+        insert_parent(path, 1, pid, new_entry);
+    }
+    /**
+     * Begin a filtered scan of the index, for keys of type T.
+     * @param scan    state of the scan
+     * @param lowVal  Low value of range, pointer to integer / double / char string
+     * @param lowOp   Low operator (GT/GTE)
+     * @param highVal High value of range, pointer to integer / double / char string
+     * @param highOp  High operator (LT/LTE)
+     * @param rewind  start from the leaf read last if the range starts in it
+     */
+    template <class T>
+    void BTreeIndex::start_scan(ScanState& scan, const void* lowValParm,
+               const Operator lowOpParm,
+               const void* highValParm,
+               const Operator highOpParm,
+               const bool rewind) {
+      const T lowVal = read_key<T>(lowValParm), highVal = read_key<T>(highValParm);
+      if(!((lowOpParm == GT or lowOpParm == GTE) and (highOpParm == LT 
+        or highOpParm == LTE))) throw BadOpcodesException();
+      if(lowVal > highVal) throw BadScanrangeException();
+      scan.executing = false;//end a scan already running
+      low_value<T>(scan) = lowVal, high_value<T>(scan) = highVal;
+      scan.lowOp = lowOpParm, scan.highOp = highOpParm;
+      scan.leavesUntilPrefetch = 0;
+      PageId pid = rewind && scan.currentPageNum != 0 
+        && starts_in_leaf(scan.currentPageNum, lowVal, lowOpParm) 
+        ? scan.currentPageNum : find_leaf(lowVal, nullptr);
+      while(true) {//find the first leaf with a key in range
+        read_leaf<T>(scan, pid);
+        if(!scan.rids.empty()) break;
+        if(scan.nextPageNum == 0) throw NoSuchKeyFoundException();
+        pid = scan.nextPageNum;
+      }
+      scan.executing = true;
+    }
+    /**
+     * Check if the first key of a range is in a leaf. Keys left of the leaf are
+     * not greater than its first key, so they are out of range when the first
+     * key is below the low value, or equal to it for GT.
+     * @param pid     page number of the leaf
+     * @param lowVal  Low value of range
+     * @param lowOp   Low operator (GT/GTE)
+     * @return True if a scan of the range can start from the leaf.
+     */
+    template <class T>
+    const bool BTreeIndex::starts_in_leaf(const PageId pid, const T& lowVal, 
+      const Operator lowOp) {
+      Page* page;
+      bufMgr->readPage(file, pid, page);
+      LeafNode<T>* leaf = (LeafNode<T> *) page;
+      bool starts;
+      while(true) {
+        const std::uint64_t version = read_version(leaf->version);
+        const T& first = leaf->keyArray[0];
+        starts = leaf->keyCount > 0 
+          && (pid == init_rpn || (lowOp == GT ? first <= lowVal : first < lowVal))
+          && (leaf->rightSibPageNo == 0 || lowVal <= leaf->highKey);
+        if (validate_version(leaf->version, version)) break;
+      }
+      bufMgr->unPinPage(file, pid, false);
+      return starts;
+    }
+    /**
+     * Copy the record ids matching a scan out of a leaf. The leaf is read 
+     * without a latch and read again if a writer changed it meanwhile.
+     * @param scan    state of the scan
+     * @param pid     page number of the leaf
+     */
+    template <class T>
+    const void BTreeIndex::read_leaf(ScanState& scan, const PageId pid) {
+      const T& lowVal = low_value<T>(scan);
+      const T& highVal = high_value<T>(scan);
+      Page* page;
+      bufMgr->readPage(file, pid, page);
+      LeafNode<T>* leaf = (LeafNode<T> *) page;
+      PageId next_pid;
+      while(true) {
+        const std::uint64_t version = read_version(leaf->version);
+        const int count = std::min(std::max(leaf->keyCount, 0), 
+          NodeLayout<T>::LEAFSIZE);
+        int i = scan.lowOp == GT 
+          ? search_keys<true>(leaf->keyArray, count, lowVal)
+          : search_keys<false>(leaf->keyArray, count, lowVal);
+        scan.rids.clear();
+        for(; i < count && is_key_satisfied(lowVal, scan.lowOp, highVal, 
+          scan.highOp, leaf->keyArray[i]); i++) scan.rids.push_back(leaf->ridArray[i]);
+        //a key past the range ends the scan in this leaf
+        next_pid = i < count ? 0 : leaf->rightSibPageNo;
+        if (validate_version(leaf->version, version)) break;
+      }
+      scan.nextEntry = 0, scan.nextPageNum = next_pid, scan.currentPageNum = pid;
+      if (next_pid != 0) prefetch_leaves<T>(scan, next_pid);
+      bufMgr->unPinPage(file, pid, false);
+    }
+    /**
+     * Fetch the record id of the next index entry that matches the scan, for
+     * keys of type T.
+     * @param scan    state of the scan
+     * @param outRid  RecordId of next record found that satisfies the scan 
+     * criteria returned in this
+     * @return True if a record id was returned; false if the scan is complete.
+     */
+    template <class T>
+    bool BTreeIndex::next_entry(ScanState& scan, RecordId& outRid) {
+      if(!scan.executing) throw ScanNotInitializedException();
+      while(scan.nextEntry == scan.rids.size()) {//current leaf used up
+        if(scan.nextPageNum == 0) return false;
+        read_leaf<T>(scan, scan.nextPageNum);
+      }
+      outRid = scan.rids[scan.nextEntry++];
+      return true;
     }
 //=============================================================================
 //
@@ -235,6 +876,8 @@ namespace badgerdb {
      * @param attrByteOffset      Offset of attribute, over which index is to be 
      *                            built, in the record
      * @param attrType            Datatype of attribute over which index is built
+     * @param fillFactor          Fraction of the key slots of each node filled
+     *                            when the index is built, in (0, 1]
      * @throws  BadIndexInfoException     If the index file already exists for the 
      * corresponding attribute, but values in metapage(relationName, attribute byte 
      * offset, attribute type etc.) do not match with values received through
@@ -244,12 +887,19 @@ namespace badgerdb {
             std::string & outIndexName,
             BufMgr *bufMgrIn,
             const int attrByteOffset,
-            const Datatype attrType) {
-      bufMgr = bufMgrIn, leafOccupancy = INTARRAYLEAFSIZE, 
-      nodeOccupancy = INTARRAYNONLEAFSIZE, scanExecuting = false;
+            const Datatype attrType,
+            const double fillFactor) {
+      bufMgr = bufMgrIn;
+      attributeType = attrType, this->attrByteOffset = attrByteOffset;
       std::ostringstream idxStr;//concat to get index ame
       idxStr << relationName << "." << attrByteOffset;
       outIndexName = idxStr.str();
+      switch(attrType) {//pick the node layout once for every later call
+        case INTEGER: bind_key_type<int>(); break;
+        case DOUBLE: bind_key_type<double>(); break;
+        case STRING: bind_key_type<StringKey>(); break;
+        default: throw BadIndexInfoException(outIndexName);
+      }
       try {
         file = new BlobFile(outIndexName, false),
           headerPageNum = file->getFirstPageNo();
@@ -257,35 +907,51 @@ namespace badgerdb {
         bufMgr->readPage(file, headerPageNum, header_page);
         IndexMetaInfo *meta_info = (IndexMetaInfo *)header_page;
         rootPageNum = meta_info->rootPageNo;//check if index info is valid
+        treeHeight = meta_info->treeHeight;
+        init_rpn = headerPageNum + 1;//the root starts on the page after the meta page
         if (relationName!=meta_info->relationName || 
           attrByteOffset!=meta_info->attrByteOffset || 
-          attrType!=meta_info->attrType) throw BadIndexInfoException(outIndexName);
+          attrType!=meta_info->attrType || 
+          meta_info->nodeFormat!=INDEXNODEFORMAT) throw BadIndexInfoException(outIndexName);
         bufMgr->unPinPage(file, headerPageNum, false);
       } catch(FileNotFoundException e) {
         Page *header_page;
         Page *root_page;
-        RecordId rid;//not found file so open a new file 
+        //not found file so open a new file 
         file = new BlobFile(outIndexName, true);
+        PageId root_pid;
         bufMgr->allocPage(file, headerPageNum, header_page);
-        bufMgr->allocPage(file, rootPageNum, root_page);
+        bufMgr->allocPage(file, root_pid, root_page);
+        rootPageNum = root_pid;
         IndexMetaInfo *meta_info = (IndexMetaInfo *)header_page;
         meta_info->attrByteOffset = attrByteOffset, 
           meta_info->attrType = attrType,
-          meta_info->rootPageNo = rootPageNum, init_rpn = rootPageNum;
+          meta_info->rootPageNo = rootPageNum, init_rpn = rootPageNum,
+          meta_info->treeHeight = 0, treeHeight = 0,
+          meta_info->nodeFormat = INDEXNODEFORMAT;
         strncpy((char *)(&(meta_info->relationName)), relationName.c_str(), 20);
         meta_info->relationName[19] = 0;//terminate str
-        LeafNodeInt *root = (LeafNodeInt *)root_page;
-        root->rightSibPageNo = 0;
+        // the root starts as an empty leaf with no sibling
+        switch(attrType) {
+          case INTEGER: ((LeafNodeInt *)root_page)->keyCount = 0, 
+            ((LeafNodeInt *)root_page)->rightSibPageNo = 0; break;
+          case DOUBLE: ((LeafNodeDouble *)root_page)->keyCount = 0, 
+            ((LeafNodeDouble *)root_page)->rightSibPageNo = 0; break;
+          case STRING: ((LeafNodeString *)root_page)->keyCount = 0, 
+            ((LeafNodeString *)root_page)->rightSibPageNo = 0; break;
+        }
         bufMgr->unPinPage(file, headerPageNum, true);
         bufMgr->unPinPage(file, rootPageNum, true);
-        FileScan fileScan(relationName, bufMgr);
-        try {
-            while(1) {//scan everything
-                fileScan.scanNext(rid);
-                std::string record = fileScan.getRecord();
-                insertEntry(record.c_str() + attrByteOffset, rid);
-            }
-        } catch (EndOfFileException e) { bufMgr->flushFile(file); }
+        // the relation is only read; scan it in place through a mapping, once
+        // the pages and header of it held by the buffer pool are on disk
+        {
+          PageFile relationFile = PageFile::open(relationName);
+          bufMgr->flushFile(&relationFile);
+        }
+        MmapPageFile relation(relationName);
+        FileScan fileScan(&relation);
+        (this->*bulk_load_fn)(fileScan, fillFactor);
+        bufMgr->flushFile(file);
       }
     }
     /**
@@ -297,7 +963,7 @@ namespace badgerdb {
      * caught in here itself. 
      * */
     BTreeIndex::~BTreeIndex() {
-      scanExecuting = false;
+      scan.executing = false;
       bufMgr->flushFile(BTreeIndex::file);
       delete file;
       file = nullptr;
@@ -316,12 +982,7 @@ namespace badgerdb {
      * inserted into the index.
     **/
     const void BTreeIndex::insertEntry(const void *key, const RecordId rid) {
-      RIDKeyPair<int> entry;Page* root;
-      entry.set(rid, *((int *)key));
-      bufMgr->readPage(file, rootPageNum, root);
-      PageKeyPair<int> *new_entry = nullptr;
-      insert(root, rootPageNum, init_rpn == rootPageNum ? 
-        true : false, entry, new_entry);
+      (this->*insert_entry_fn)(key, rid);
     }
     /**
      * Begin a filtered scan of the index.  For instance, if the method is called 
@@ -331,7 +992,8 @@ namespace badgerdb {
      * Set up all the variables for scan. Start from root to find out the 
      * leaf page that contains
      * the first RecordID
-     * that satisfies the scan parameters. Keep that page pinned in the buffer pool.
+     * that satisfies the scan parameters, and copy out the record ids of that
+     * page that satisfy them.
      * @param lowVal  Low value of range, pointer to integer / double / char string
      * @param lowOp   Low operator (GT/GTE)
      * @param highVal High value of range, pointer to integer / double / char string
@@ -346,65 +1008,15 @@ namespace badgerdb {
                const Operator lowOpParm,
                const void* highValParm,
                const Operator highOpParm) {
-      lowValInt = *((int *)lowValParm), highValInt = *((int *)highValParm);
-      if(!((lowOpParm == GT or lowOpParm == GTE) and (highOpParm == LT 
-        or highOpParm == LTE))) throw BadOpcodesException();
-      if(lowValInt > highValInt) throw BadScanrangeException();
-      lowOp = lowOpParm, highOp = highOpParm;
-      if(scanExecuting) endScan();
-      currentPageNum = rootPageNum;
-      bufMgr->readPage(file, currentPageNum, currentPageData);
-      //read root_page into the buffer pool
-      if(init_rpn != rootPageNum) {//not leaf
-        NonLeafNodeInt* curr = (NonLeafNodeInt *) currentPageData;
-        bool found_leaf = false; 
-        PageId next_page;
-        while(!found_leaf) {
-          curr = (NonLeafNodeInt *) currentPageData; 
-          //if this is the level above the leaf, then the next level = leaf
-          if(curr->level == 1) found_leaf = true;
-          findnext_nonleaf(curr, next_page, lowValInt);
-          bufMgr->unPinPage(file, currentPageNum, false);
-          currentPageNum = next_page;
-          bufMgr->readPage(file, currentPageNum, currentPageData);//read next
-        }
-      }
-      bool found = false;//find the smallest one
-      while(!found){
-        LeafNodeInt* currentNode = (LeafNodeInt *) currentPageData;
-        if(currentNode->ridArray[0].page_number == 0) {//isnull
-          bufMgr->unPinPage(file, currentPageNum, false);
-          throw NoSuchKeyFoundException();
-        }
-        bool isnull = false;//traverse from l to r
-        for(int i = 0; i < leafOccupancy and !isnull; i++) {
-          int key = currentNode->keyArray[i];
-          if(i < leafOccupancy - 1 
-            and currentNode->ridArray[i + 1].page_number == 0) isnull = true;
-          //Check if the next one in the key is not inserted
-          if(is_key_satisfied(lowValInt, lowOp, highValInt, highOp, key)) {
-            nextEntry = i, found = true, scanExecuting = true;
-            break;
-          } else if ((highOp == LT and key >= highValInt) 
-            or (highOp == LTE and key > highValInt)) {
-            bufMgr->unPinPage(file, currentPageNum, false);
-            throw NoSuchKeyFoundException();
-          }
-          if(i == leafOccupancy - 1 or isnull) {//no match go to next leaf then
-            bufMgr->unPinPage(file, currentPageNum, false);
-            if(currentNode->rightSibPageNo == 0) throw NoSuchKeyFoundException();
-            currentPageNum = currentNode->rightSibPageNo;
-            bufMgr->readPage(file, currentPageNum, currentPageData);
-          }
-        }
-      }
-      }
+      (this->*start_scan_fn)(scan, lowValParm, lowOpParm, highValParm, highOpParm, 
+        false);
+    }
     /**
      * Fetch the record id of the next index entry that matches the scan.
      * Return the next record from current page being scanned. 
      * If current page has been scanned to its entirety, move on to the 
      * right sibling of current page, if any exists, to start scanning that 
-     * page. Make sure to unpin any pages that are no longer required.
+     * page. Entries inserted by other threads meanwhile may be skipped.
      * @param outRid  RecordId of next record found that satisfies the scan 
      * criteria returned in this
      * @throws ScanNotInitializedException If no scan has been initialized.
@@ -412,34 +1024,120 @@ namespace badgerdb {
      * scan criteria, are left to be scanned.
     **/
     const void BTreeIndex::scanNext(RecordId& outRid) {
-      if(!scanExecuting) throw ScanNotInitializedException();
-      LeafNodeInt* currentNode = (LeafNodeInt *) currentPageData;
-      if(currentNode->ridArray[nextEntry].page_number == 0 
-        or nextEntry == leafOccupancy) {
-        bufMgr->unPinPage(file, currentPageNum, false);
-        if(currentNode->rightSibPageNo == 0) throw IndexScanCompletedException();
-        currentPageNum = currentNode->rightSibPageNo;
-        bufMgr->readPage(file, currentPageNum, currentPageData);
-        currentNode = (LeafNodeInt *) currentPageData, nextEntry = 0;
-      }
-      int key = currentNode->keyArray[nextEntry];
-      if(!is_key_satisfied(lowValInt, lowOp, highValInt, highOp, key)) 
-        throw IndexScanCompletedException();
-      else {
-        outRid = currentNode->ridArray[nextEntry];
-        nextEntry++; // current page has been fully scanned
-      }
+      if(!next(outRid)) throw IndexScanCompletedException();
     }
     /**
-     * Terminate the current scan. Unpin any pinned pages. 
-     * Reset scan specific variables.
+     * Fetch the record id of the next index entry that matches the scan,
+     * without throwing at the end of the scan.
+     * @param outRid  RecordId of next record found that satisfies the scan 
+     * criteria returned in this
+     * @return True if a record id was returned; false if the scan is complete.
+     * @throws ScanNotInitializedException If no scan has been initialized.
+    **/
+    bool BTreeIndex::next(RecordId& outRid) {
+      return (this->*next_fn)(scan, outRid);
+    }
+    /**
+     * Terminate the current scan. Reset scan specific variables.
      * @throws ScanNotInitializedException If no scan has been initialized.
     **/
     const void BTreeIndex::endScan() {
-      if(!scanExecuting) throw ScanNotInitializedException();
-      scanExecuting = false;
-      bufMgr->unPinPage(file, currentPageNum, false);
-      currentPageData = nullptr,currentPageNum = static_cast<PageId>(-1),
-        nextEntry = -1;//reset
+      if(!scan.executing) throw ScanNotInitializedException();
+      scan.executing = false;
+      scan.rids.clear(), scan.nextEntry = 0, scan.nextPageNum = 0;//reset
+    }
+    /**
+     * Choose whether searches inside nodes may use AVX2.
+     * @param enable  True to allow AVX2
+     * @return True if searches use AVX2 from now on.
+    **/
+    bool BTreeIndex::setVectorSearch(const bool enable) {
+#ifdef BTREE_AVX2_SEARCH
+      vector_search = enable && has_avx2();
+      return vector_search;
+#else
+      return false;
+#endif
+    }
+//=============================================================================
+//
+// IndexCursor: a scan over a BTreeIndex with its own state.
+//
+//=============================================================================
+    /**
+     * IndexCursor Constructor.
+     * @param indexIn  Index to scan
+     */
+    IndexCursor::IndexCursor(BTreeIndex *indexIn) : index(indexIn) {
+    }
+    /**
+     * Begin a filtered scan of the index, from the root.
+     * @param lowVal  Low value of range, pointer to integer / double / char string
+     * @param lowOp   Low operator (GT/GTE)
+     * @param highVal High value of range, pointer to integer / double / char string
+     * @param highOp  High operator (LT/LTE)
+     * @throws  BadOpcodesException If lowOp and highOp do not contain one of their 
+     * their expected values 
+     * @throws  BadScanrangeException If lowVal > highval
+     * @throws  NoSuchKeyFoundException If there is no key in the B+ tree that 
+     * satisfies the scan criteria.
+    **/
+    const void IndexCursor::startScan(const void* lowValParm,
+               const Operator lowOpParm,
+               const void* highValParm,
+               const Operator highOpParm) {
+      (index->*index->start_scan_fn)(scan, lowValParm, lowOpParm, highValParm, 
+        highOpParm, false);
+    }
+    /**
+     * Begin a filtered scan of the index with new bounds, from the leaf read
+     * last if the new range starts in it.
+     * @param lowVal  Low value of range, pointer to integer / double / char string
+     * @param lowOp   Low operator (GT/GTE)
+     * @param highVal High value of range, pointer to integer / double / char string
+     * @param highOp  High operator (LT/LTE)
+     * @throws  BadOpcodesException If lowOp and highOp do not contain one of their 
+     * their expected values 
+     * @throws  BadScanrangeException If lowVal > highval
+     * @throws  NoSuchKeyFoundException If there is no key in the B+ tree that 
+     * satisfies the scan criteria.
+    **/
+    const void IndexCursor::rewind(const void* lowValParm,
+               const Operator lowOpParm,
+               const void* highValParm,
+               const Operator highOpParm) {
+      (index->*index->start_scan_fn)(scan, lowValParm, lowOpParm, highValParm, 
+        highOpParm, true);
+    }
+    /**
+     * Fetch the record id of the next index entry that matches the scan.
+     * @param outRid  RecordId of next record found that satisfies the scan 
+     * criteria returned in this
+     * @throws ScanNotInitializedException If no scan has been initialized.
+     * @throws IndexScanCompletedException If no more records, satisfying the 
+     * scan criteria, are left to be scanned.
+    **/
+    const void IndexCursor::scanNext(RecordId& outRid) {
+      if(!next(outRid)) throw IndexScanCompletedException();
+    }
+    /**
+     * Fetch the record id of the next index entry that matches the scan,
+     * without throwing at the end of the scan.
+     * @param outRid  RecordId of next record found that satisfies the scan 
+     * criteria returned in this
+     * @return True if a record id was returned; false if the scan is complete.
+     * @throws ScanNotInitializedException If no scan has been initialized.
+    **/
+    bool IndexCursor::next(RecordId& outRid) {
+      return (index->*index->next_fn)(scan, outRid);
+    }
+    /**
+     * Terminate the scan of the cursor.
+     * @throws ScanNotInitializedException If no scan has been initialized.
+    **/
+    const void IndexCursor::endScan() {
+      if(!scan.executing) throw ScanNotInitializedException();
+      scan.executing = false;
+      scan.rids.clear(), scan.nextEntry = 0, scan.nextPageNum = 0;//reset
     }
 }
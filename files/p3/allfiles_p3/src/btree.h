@@ -7,10 +7,14 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <iostream>
+#include <mutex>
 #include <string>
 #include "string.h"
 #include <sstream>
+#include <vector>
 
 #include "types.h"
 #include "page.h"
@@ -20,6 +24,8 @@
 namespace badgerdb
 {
 
+class FileScan;
+
 /**
  * @brief Datatype enumeration type.
  */
@@ -42,17 +48,95 @@ enum Operator
 };
 
 
+/**
+ * @brief Number of characters of a STRING attribute that make up its key.
+ */
+const  int STRINGSIZE = 10;
+
+/**
+ * @brief Key of a STRING attribute: its first STRINGSIZE characters, padded with
+ * zeros if the string is shorter. Compares like the strings it was made from.
+ */
+struct StringKey{
+	char data[ STRINGSIZE ];
+
+	int compare( const StringKey& other ) const
+	{
+		return strncmp( data, other.data, STRINGSIZE );
+	}
+	bool operator<( const StringKey& other ) const { return compare( other ) < 0; }
+	bool operator>( const StringKey& other ) const { return compare( other ) > 0; }
+	bool operator<=( const StringKey& other ) const { return compare( other ) <= 0; }
+	bool operator>=( const StringKey& other ) const { return compare( other ) >= 0; }
+	bool operator==( const StringKey& other ) const { return compare( other ) == 0; }
+	bool operator!=( const StringKey& other ) const { return compare( other ) != 0; }
+};
+
+/**
+ * @brief Fan-out of the B+Tree nodes for keys of type T, fixed at compile time.
+ */
+template <class T>
+struct NodeLayout{
+  /**
+   * Fields of a leaf in front of its keys, as laid out in LeafNode.
+   */
+	struct LeafHeader{ std::uint64_t version; int keyCount; T highKey; };
+
+  /**
+   * Fields of a non-leaf in front of its keys, as laid out in NonLeafNode.
+   */
+	struct NonLeafHeader{ std::uint64_t version; int level; int keyCount; T highKey; PageId rightSibPageNo; };
+
+  /**
+   * Number of key slots in a leaf.
+   */
+	//                                                 header                 sibling ptr             key               rid
+	static const int LEAFSIZE = ( Page::SIZE - sizeof( LeafHeader ) - sizeof( PageId ) ) / ( sizeof( T ) + sizeof( RecordId ) );
+
+  /**
+   * Number of key slots in a non-leaf.
+   */
+	//                                                    header                 extra pageNo               key       pageNo
+	static const int NONLEAFSIZE = ( Page::SIZE - sizeof( NonLeafHeader ) - sizeof( PageId ) ) / ( sizeof( T ) + sizeof( PageId ) );
+};
+
+template <class T>
+const int NodeLayout<T>::LEAFSIZE;
+
+template <class T>
+const int NodeLayout<T>::NONLEAFSIZE;
+
 /**
  * @brief Number of key slots in B+Tree leaf for INTEGER key.
  */
-//                                                  sibling ptr             key               rid
-const  int INTARRAYLEAFSIZE = ( Page::SIZE - sizeof( PageId ) ) / ( sizeof( int ) + sizeof( RecordId ) );
+const  int INTARRAYLEAFSIZE = NodeLayout<int>::LEAFSIZE;
 
 /**
  * @brief Number of key slots in B+Tree non-leaf for INTEGER key.
  */
-//                                                     level     extra pageNo                  key       pageNo
-const  int INTARRAYNONLEAFSIZE = ( Page::SIZE - sizeof( int ) - sizeof( PageId ) ) / ( sizeof( int ) + sizeof( PageId ) );
+const  int INTARRAYNONLEAFSIZE = NodeLayout<int>::NONLEAFSIZE;
+
+/**
+ * @brief Layout of the nodes of index files written by this version, kept in their meta page. Files
+ * with nodes of another layout are rejected when opened.
+ */
+const  int INDEXNODEFORMAT = 2;
+
+/**
+ * @brief Number of leaves read ahead of an index scan along the sibling chain.
+ */
+const  int LEAFPREFETCHDEPTH = 8;
+
+/**
+ * @brief Default fraction of the key slots of each node filled when an index is built from its relation.
+ */
+const  double BULKLOADFILLFACTOR = 1.0;
+
+/**
+ * @brief Memory used to sort key-rid pairs while an index is built from its relation. Pairs beyond it are
+ * sorted in runs on disk and merged.
+ */
+const  std::size_t BULKLOADSORTBYTES = 64 * 1024 * 1024;
 
 /**
  * @brief Structure to store a key-rid pair. It is used to pass the pair to functions that 
@@ -128,6 +212,16 @@ struct IndexMetaInfo{
    * Page number of root page of the B+ Tree inside the file index file.
    */
 	PageId rootPageNo;
+
+  /**
+   * Number of non-leaf levels above the leaves, 0 while the root is a leaf.
+   */
+	int treeHeight;
+
+  /**
+   * Layout of the nodes of the index, INDEXNODEFORMAT when the file was created by this version.
+   */
+	int nodeFormat;
 };
 
 /*
@@ -135,42 +229,83 @@ Each node is a page, so once we read the page in we just cast the pointer to the
 These structures basically are the format in which the information is stored in the pages for the index file depending on what kind of 
 node they are. The level memeber of each non leaf structure seen below is set to 1 if the nodes 
 at this level are just above the leaf nodes. Otherwise set to 0.
+Nodes are linked to their right sibling at every level, and each but the last of a level records the highest key
+it may hold, so a reader that reaches a node after it split can move right to find the keys that left it.
 */
 
 /**
- * @brief Structure for all non-leaf nodes when the key is of INTEGER type.
+ * @brief Structure for all non-leaf nodes with keys of type T.
 */
-struct NonLeafNodeInt{
+template <class T>
+struct NonLeafNode{
+  /**
+   * Version of the node, odd while a writer holds it. Readers do not latch the node; they check the version
+   * is unchanged once they have read it.
+   */
+	std::atomic<std::uint64_t> version;
+
   /**
    * Level of the node in the tree.
    */
 	int level;
 
+  /**
+   * Number of keys in use; the node has one more child than keys.
+   */
+	int keyCount;
+
+  /**
+   * Highest key the node may hold, the key separating it from its right sibling. Unset in the last node of a level.
+   */
+	T highKey;
+
+  /**
+   * Page number of the non-leaf on the right side at the same level, 0 for the last node of a level.
+   */
+	PageId rightSibPageNo;
+
   /**
    * Stores keys.
    */
-	int keyArray[ INTARRAYNONLEAFSIZE ];
+	T keyArray[ NodeLayout<T>::NONLEAFSIZE ];
 
   /**
    * Stores page numbers of child pages which themselves are other non-leaf/leaf nodes in the tree.
    */
-	PageId pageNoArray[ INTARRAYNONLEAFSIZE + 1 ];
+	PageId pageNoArray[ NodeLayout<T>::NONLEAFSIZE + 1 ];
 };
 
 
 /**
- * @brief Structure for all leaf nodes when the key is of INTEGER type.
+ * @brief Structure for all leaf nodes with keys of type T.
 */
-struct LeafNodeInt{
+template <class T>
+struct LeafNode{
+  /**
+   * Version of the node, odd while a writer holds it. Readers do not latch the node; they check the version
+   * is unchanged once they have read it.
+   */
+	std::atomic<std::uint64_t> version;
+
+  /**
+   * Number of key-rid pairs in use, at the front of the arrays.
+   */
+	int keyCount;
+
+  /**
+   * Highest key the leaf may hold, the key separating it from its right sibling. Unset in the last leaf.
+   */
+	T highKey;
+
   /**
    * Stores keys.
    */
-	int keyArray[ INTARRAYLEAFSIZE ];
+	T keyArray[ NodeLayout<T>::LEAFSIZE ];
 
   /**
    * Stores RecordIds.
    */
-	RecordId ridArray[ INTARRAYLEAFSIZE ];
+	RecordId ridArray[ NodeLayout<T>::LEAFSIZE ];
 
   /**
    * Page number of the leaf on the right side.
@@ -179,13 +314,141 @@ struct LeafNodeInt{
 	PageId rightSibPageNo;
 };
 
+/**
+ * @brief Structure for all non-leaf nodes when the key is of INTEGER type.
+*/
+typedef NonLeafNode<int> NonLeafNodeInt;
+
+/**
+ * @brief Structure for all leaf nodes when the key is of INTEGER type.
+*/
+typedef LeafNode<int> LeafNodeInt;
+
+/**
+ * @brief Structure for all non-leaf nodes when the key is of DOUBLE type.
+*/
+typedef NonLeafNode<double> NonLeafNodeDouble;
+
+/**
+ * @brief Structure for all leaf nodes when the key is of DOUBLE type.
+*/
+typedef LeafNode<double> LeafNodeDouble;
+
+/**
+ * @brief Structure for all non-leaf nodes when the key is of STRING type.
+*/
+typedef NonLeafNode<StringKey> NonLeafNodeString;
+
+/**
+ * @brief Structure for all leaf nodes when the key is of STRING type.
+*/
+typedef LeafNode<StringKey> LeafNodeString;
+
+static_assert(sizeof(NonLeafNodeInt) <= Page::SIZE && sizeof(LeafNodeInt) <= Page::SIZE,
+              "INTEGER nodes must fit in a page.");
+static_assert(sizeof(NonLeafNodeDouble) <= Page::SIZE && sizeof(LeafNodeDouble) <= Page::SIZE,
+              "DOUBLE nodes must fit in a page.");
+static_assert(sizeof(NonLeafNodeString) <= Page::SIZE && sizeof(LeafNodeString) <= Page::SIZE,
+              "STRING nodes must fit in a page.");
+
+/**
+ * @brief State of a scan over a BTreeIndex. The record ids matching the scan are copied out of one leaf at a
+ * time, so a scan keeps no page pinned between calls and never holds up inserts into the leaf it is on.
+*/
+struct ScanState{
+  /**
+   * True if the scan has been started.
+   */
+	bool executing;
+
+  /**
+   * Low INTEGER value for scan.
+   */
+	int lowValInt;
+
+  /**
+   * Low DOUBLE value for scan.
+   */
+	double lowValDouble;
+
+  /**
+   * Low STRING value for scan.
+   */
+	StringKey lowValString;
+
+  /**
+   * High INTEGER value for scan.
+   */
+	int highValInt;
+
+  /**
+   * High DOUBLE value for scan.
+   */
+	double highValDouble;
+
+  /**
+   * High STRING value for scan.
+   */
+	StringKey highValString;
+
+  /**
+   * Low Operator. Can only be GT(>) or GTE(>=).
+   */
+	Operator lowOp;
+
+  /**
+   * High Operator. Can only be LT(<) or LTE(<=).
+   */
+	Operator highOp;
+
+  /**
+   * Record ids matching the scan, copied from the leaf read last.
+   */
+	std::vector<RecordId> rids;
+
+  /**
+   * Index of the next of the copied record ids to return.
+   */
+	std::size_t nextEntry;
+
+  /**
+   * Page number of the leaf to read once the copied record ids are used up. It is the right sibling the last
+   * leaf had when it was read, so entries that leaf lost to a split since are not returned twice. 0 once
+   * no leaf is left or a key past the range has been seen.
+   */
+	PageId nextPageNum;
+
+  /**
+   * Page number of the leaf read last, 0 before the first. A scan restarted with IndexCursor::rewind() starts
+   * from it when the new range starts in it, instead of from the root.
+   */
+	PageId currentPageNum;
+
+  /**
+   * Leaves left to read before the next read-ahead of right siblings.
+   */
+	int leavesUntilPrefetch;
+
+  /**
+   * Constructs the state of a scan that has not been started.
+   */
+	ScanState() : executing(false), nextEntry(0), nextPageNum(0), currentPageNum(0), leavesUntilPrefetch(0) {}
+};
+
 
 /**
  * @brief BTreeIndex class. It implements a B+ Tree index on a single attribute of a
- * relation. This index supports only one scan at a time.
+ * relation. The scan built into the index (startScan/scanNext/endScan) is a single one; any number of
+ * further scans can run at once through IndexCursor objects. Entries may be inserted from several threads
+ * at once, also while scans run: the tree is a B-link tree whose readers validate node versions
+ * instead of latching, and writers latch one node at a time.
+ * The node layouts and the code working on them are templates over the type of key; the type of the
+ * attribute picks their specialization once, when the index is opened.
 */
 class BTreeIndex {
 
+  friend class IndexCursor;
+
  private:
 
   /**
@@ -206,7 +469,17 @@ class BTreeIndex {
   /**
    * page number of root page of B+ tree inside index file.
    */
-	PageId	rootPageNum;
+	std::atomic<PageId>	rootPageNum;
+
+  /**
+   * Number of non-leaf levels above the leaves, 0 while the root is a leaf.
+   */
+	int treeHeight;
+
+  /**
+   * Held while the root is replaced and the meta page updated, and to read rootPageNum and treeHeight together.
+   */
+	std::mutex rootLatch;
 
   /**
    * Datatype of attribute over which index is built.
@@ -232,151 +505,233 @@ class BTreeIndex {
 	// MEMBERS SPECIFIC TO SCANNING
 
   /**
-   * True if an index scan has been started.
+   * State of the scan run through startScan(), scanNext() and endScan().
    */
-	bool		scanExecuting;
+	ScanState scan;
+
+  /*
+  * pageid of root before split。
+  */
+  PageId init_rpn;//added field
 
   /**
-   * Index of next entry to be scanned in current leaf being scanned.
+   * insertEntry() for the type of key of the index, chosen once when the index is opened.
    */
-	int			nextEntry;
+	void (BTreeIndex::*insert_entry_fn)(const void* key, const RecordId rid);
 
   /**
-   * Page number of current page being scanned.
+   * startScan() for the type of key of the index, chosen once when the index is opened.
    */
-	PageId	currentPageNum;
+	void (BTreeIndex::*start_scan_fn)(ScanState& scan, const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp, const bool rewind);
 
   /**
-   * Current Page being scanned.
+   * next() for the type of key of the index, chosen once when the index is opened.
    */
-	Page		*currentPageData;
+	bool (BTreeIndex::*next_fn)(ScanState& scan, RecordId& outRid);
 
   /**
-   * Low INTEGER value for scan.
+   * bulk_load() for the type of key of the index, chosen once when the index is opened.
    */
-	int			lowValInt;
+	void (BTreeIndex::*bulk_load_fn)(FileScan& fileScan, const double fillFactor);
 
   /**
-   * Low DOUBLE value for scan.
+   * Points the key-type dependent methods at their versions for keys of type T.
    */
-	double	lowValDouble;
+  template <class T>
+  void bind_key_type();//added private helper method
 
   /**
-   * Low STRING value for scan.
+   * Returns the low value of a scan, for keys of type T.
    */
-	std::string	lowValString;
+  template <class T>
+  static T& low_value(ScanState& scan);//added private helper method
 
   /**
-   * High INTEGER value for scan.
+   * Returns the high value of a scan, for keys of type T.
    */
-	int			highValInt;
+  template <class T>
+  static T& high_value(ScanState& scan);//added private helper method
 
   /**
-   * High DOUBLE value for scan.
+   * insertEntry() for keys of type T.
+   * @param key     Key to insert, pointer to integer/double/char string
+   * @param rid     Record ID of a record whose entry is getting inserted into the index.
    */
-	double	highValDouble;
+  template <class T>
+  void insert_entry(const void* key, const RecordId rid);//added private helper method
 
   /**
-   * High STRING value for scan.
+   * startScan() for keys of type T.
+   * @param scan     state of the scan to start
+   * @param lowVal   Low value of range, pointer to integer / double / char string
+   * @param lowOp    Low operator (GT/GTE)
+   * @param highVal  High value of range, pointer to integer / double / char string
+   * @param highOp   High operator (LT/LTE)
+   * @param rewind   true to start from the leaf the scan read last if the range starts in it
    */
-	std::string highValString;
-	
+  template <class T>
+  void start_scan(ScanState& scan, const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp, const bool rewind);//added private helper method
+
   /**
-   * Low Operator. Can only be GT(>) or GTE(>=).
+   * Check if the first key of a range is in a leaf, so a scan of the range can start from the leaf.
+   * @param pid      page number of the leaf
+   * @param lowVal   Low value of range
+   * @param lowOp    Low operator (GT/GTE)
+   * @return True if no leaf left of it holds a key of the range, and the range starts before its high key.
    */
-	Operator	lowOp;
+  template <class T>
+  const bool starts_in_leaf(const PageId pid, const T& lowVal, const Operator lowOp);//added private helper method
 
   /**
-   * High Operator. Can only be LT(<) or LTE(<=).
+   * next() for keys of type T.
+   * @param scan     state of the scan
+   * @param outRid   RecordId of next record found that satisfies the scan criteria returned in this
+   * @return True if a record id was returned; false if the scan is complete.
    */
-	Operator	highOp;
+  template <class T>
+  bool next_entry(ScanState& scan, RecordId& outRid);//added private helper method
 
-  /*
-  * pageid of root before split。
-  */
-  PageId init_rpn;//added field
+  /**
+   * Copy the record ids matching a scan out of a leaf, and note which leaf the scan reads next.
+   * @param scan     state of the scan
+   * @param pid      page number of the leaf
+   */
+  template <class T>
+  const void read_leaf(ScanState& scan, const PageId pid);//added private helper method
+
+  /**
+   * Build the tree bottom-up from every tuple of the relation, for keys of type T. The key-rid pairs are
+   * sorted, externally if they exceed BULKLOADSORTBYTES, then packed into leaves left to right and the
+   * non-leaf levels are built over them. The tree must be empty.
+   * @param fileScan     scan over the relation
+   * @param fillFactor   fraction of the key slots of each node to fill
+   */
+  template <class T>
+  void bulk_load(FileScan& fileScan, const double fillFactor);//added private helper method
 
   /**
    * Check if the key is satisfied.
-   * @param lowVal   Low value of range, pointer to integer / double / char string
+   * @param lowVal   Low value of range
    * @param lowOp    Low operator (GT/GTE)
-   * @param highVal  High value of range, pointer to integer / double / char string
+   * @param highVal  High value of range
    * @param highOp   High operator (LT/LTE)
    * @param val      Value of the key
    * @return True if satisfies; False otherwise.
    */
-
-  const bool is_key_satisfied(int lowVal, const Operator lowOp, int highVal, const Operator highOp, int key);//added private helper method
+  template <class T>
+  const bool is_key_satisfied(const T& lowVal, const Operator lowOp, const T& highVal, const Operator highOp, const T& key);//added private helper method
   /**
-   * Find the next nonleaf position to be inserted.
+   * Find the next nonleaf position to be inserted, without latching the node.
    * @param cur_page       current page to be checked
    * @param next_pageid   return val for the next level pageid
    * @param key           the key to be checked
+   * @return True if key is past the keys of the node and next_pageid is its right sibling; False if it is a child.
   */
-  const void findnext_nonleaf(NonLeafNodeInt *cur_page, PageId& next_pageid, int key);//added private helper method
-  
+  template <class T>
+  const bool findnext_nonleaf(NonLeafNode<T> *cur_page, PageId& next_pageid, const T& key);//added private helper method
+
   /**
-   * helper method to insert the index entry to the right position of the index file
-   * @param cur_page           current page to be checked
-   * @param cur_pid       current pageid
-   * @param is_leaf        is leaf or not
-   * @param target         actual index to be inserted
-   * @param new_entry     A pageKeyPair:the entry that is pushed up after splitting a node, or null when no split in child node
+   * Find the leaf a key belongs in, without latching any node.
+   * @param key           the key to be checked
+   * @param path          if not null, return val for the non-leaves passed on the way down, root first
+   * @return the page number of the leaf; it may have split by the time it is read.
   */
-  const void insert(Page *cur_page, PageId cur_pid, bool is_leaf, const RIDKeyPair<int> target, PageKeyPair<int> *& new_entry);//added private helper method
-  
+  template <class T>
+  const PageId find_leaf(const T& key, std::vector<PageId>* path);//added private helper method
+
+  /**
+   * Find the non-leaf a key belongs in at the given height, from the current root.
+   * @param height        height of the non-leaf above the leaves, at least 1
+   * @param key           the key to be checked
+   * @return the page number of the non-leaf.
+  */
+  template <class T>
+  const PageId find_nonleaf(const int height, const T& key);//added private helper method
+
+  /**
+   * Add the entry for a node that was split to its parent, splitting the parent and further ancestors as
+   * needed.
+   * @param path           non-leaves passed on the way down to the node, root first; used up on return
+   * @param height         height of the parent above the leaves
+   * @param left_pid       page number of the node that was split
+   * @param new_entry      the entry for the new right half of the node
+  */
+  template <class T>
+  const void insert_parent(std::vector<PageId>& path, int height, PageId left_pid, PageKeyPair<T> new_entry);//added private helper method
 
   /**
-   * insert the index entry to the index file
+   * split nonleaf node that is full, adding an entry to it. The node must be latched; it is released.
    * @param tobe_split           the node to be split
-   * @param old_pagenum        PageId of the node tobe_split
-   * @param new_entry     A entry that is pushed up after splitting 
+   * @param pid           PageId of the node tobe_split
+   * @param pos           position in the node to add the entry at
+   * @param new_entry     the entry to be added to the node; replaced by the entry that is pushed up after splitting
+   * @return True if new_entry has to be added to the parent; False if the root was split.
   */
-  const void split_nonleaf(NonLeafNodeInt *tobe_split, PageId pid, PageKeyPair<int> *&new_entry);//added private helper method
+  template <class T>
+  const bool split_nonleaf(NonLeafNode<T> *tobe_split, PageId pid, const int pos, PageKeyPair<T>& new_entry);//added private helper method
   
   /**
-   * For root that needs to be split, create a new root and insert the pushed-up entry and do the update
+   * For root that needs to be split, create a new root and insert the pushed-up entry and do the update.
+   * The old root must still be latched, so no node can be split past it until the new root is in place.
    * @param firstpage_inroot   the pageid of the first pointer in the root page
    * @param new_entry     the entry that is pushed up
   */
-  const void update_root(PageId firstpage_inroot, PageKeyPair<int> *new_entry);//added private helper method
+  template <class T>
+  const void update_root(PageId firstpage_inroot, const PageKeyPair<T>& new_entry);//added private helper method
   /**
-   * split leaf node that is full
+   * split leaf node that is full, inserting an entry. The leaf must be latched; it is released.
    * @param full_node          full leaf node
    * @param num_leafpage   the number of page of that leaf
-   * @param new_entry the entry to be pushed up
+   * @param new_entry return val for the entry to be pushed up
    * @param target     the entry to be inserted
+   * @return True if new_entry has to be added to the parent; False if the root was split.
   */
-  const void split_leaf(LeafNodeInt *full_node, PageId num_leafpage, PageKeyPair<int> *&new_entry, const RIDKeyPair<int> target);//added private helper method
+  template <class T>
+  const bool split_leaf(LeafNode<T> *full_node, PageId num_leafpage, PageKeyPair<T>& new_entry, const RIDKeyPair<T>& target);//added private helper method
   /**
    * insert an entry into a leaf node
    * @param leaf     leaf node that needs to be inserted into
    * @param entry    then entry needed to be inserted
    */
-  const void insert_leaf(LeafNodeInt *leaf, RIDKeyPair<int> entry);//added private helper method
+  template <class T>
+  const void insert_leaf(LeafNode<T> *leaf, const RIDKeyPair<T>& entry);//added private helper method
   /**
    * insert an entry into a nonleaf node
    * @param nonleaf  nonleaf node that need to be inserted into
+   * @param pos      position of the key of the entry; its page goes right of the child at pos
    * @param entry    then entry needed to be inserted
    *
    */
-  const void insert_nonleaf(NonLeafNodeInt *nonleaf, PageKeyPair<int> *entry);//added private helper method
+  template <class T>
+  const void insert_nonleaf(NonLeafNode<T> *nonleaf, const int pos, const PageKeyPair<T>& entry);//added private helper method
+  /**
+   * read ahead the right siblings of the leaf the scan just moved to
+   * @param scan     state of the scan
+   * @param next_pid right sibling of the leaf now being scanned
+   */
+  template <class T>
+  const void prefetch_leaves(ScanState& scan, const PageId next_pid);//added private helper method
   
 public: 
   /**
    * BTreeIndex Constructor. 
 	 * Check to see if the corresponding index file exists. If so, open the file.
 	 * If not, create it and insert entries for every tuple in the base relation using FileScan class.
+	 * The entries are sorted and the tree is built bottom-up, with each node filled to the fill factor.
+	 * The relation is read through a mapping of its file, after its pages in the buffer pool are written back.
    *
    * @param relationName        Name of file.
    * @param outIndexName        Return the name of index file.
    * @param bufMgrIn						Buffer Manager Instance
    * @param attrByteOffset			Offset of attribute, over which index is to be built, in the record
    * @param attrType						Datatype of attribute over which index is built
+   * @param fillFactor					Fraction of the key slots of each node filled when the index is built, in (0, 1]
    * @throws  BadIndexInfoException     If the index file already exists for the corresponding attribute, but values in metapage(relationName, attribute byte offset, attribute type etc.) do not match with values received through constructor parameters.
+   * @throws  PagePinnedException       If the index is built while a page of the relation is pinned in the buffer pool.
    */
 	BTreeIndex(const std::string & relationName, std::string & outIndexName,
-						BufMgr *bufMgrIn,	const int attrByteOffset,	const Datatype attrType);
+						BufMgr *bufMgrIn,	const int attrByteOffset,	const Datatype attrType,
+						const double fillFactor = BULKLOADFILLFACTOR);
   /**
    * BTreeIndex Destructor. 
 	 * End any initialized scan, flush index file, after unpinning any pinned pages, from the buffer manager
@@ -403,7 +758,7 @@ public:
 	 * greater than "a" and less than or equal to "d".
 	 * If another scan is already executing, that needs to be ended here.
 	 * Set up all the variables for scan. Start from root to find out the leaf page that contains the first RecordID
-	 * that satisfies the scan parameters. Keep that page pinned in the buffer pool.
+	 * that satisfies the scan parameters, and copy out the record ids of that page that satisfy them.
    * @param lowVal	Low value of range, pointer to integer / double / char string
    * @param lowOp		Low operator (GT/GTE)
    * @param highVal	High value of range, pointer to integer / double / char string
@@ -417,7 +772,7 @@ public:
 
   /**
 	 * Fetch the record id of the next index entry that matches the scan.
-	 * Return the next record from current page being scanned. If current page has been scanned to its entirety, move on to the right sibling of current page, if any exists, to start scanning that page. Make sure to unpin any pages that are no longer required.
+	 * Return the next record from current page being scanned. If current page has been scanned to its entirety, move on to the right sibling of current page, if any exists, to start scanning that page. Entries inserted by other threads while the scan runs may or may not be returned.
    * @param outRid	RecordId of next record found that satisfies the scan criteria returned in this
 	 * @throws ScanNotInitializedException If no scan has been initialized.
 	 * @throws IndexScanCompletedException If no more records, satisfying the scan criteria, are left to be scanned.
@@ -426,7 +781,105 @@ public:
 
 
   /**
-	 * Terminate the current scan. Unpin any pinned pages. Reset scan specific variables.
+	 * Fetch the record id of the next index entry that matches the scan, without throwing at the end of the scan.
+	 * Behaves like scanNext(), but reports completion through its return value so that callers iterating to the end
+	 * of a range do not pay for an exception.
+   * @param outRid	RecordId of next record found that satisfies the scan criteria returned in this
+	 * @return True if a record id was returned; false if no more records satisfy the scan criteria.
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	**/
+	bool next(RecordId& outRid);
+
+
+  /**
+	 * Terminate the current scan. Reset scan specific variables.
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	**/
+	const void endScan();
+
+
+  /**
+	 * Choose whether searches inside nodes may compare keys with AVX2 instructions, when the processor has them.
+	 * They do by default. Turning it off, while no index is in use, runs the portable search instead.
+   * @param enable	True to allow AVX2
+	 * @return True if searches use AVX2 from now on.
+	**/
+	static bool setVectorSearch(const bool enable);
+};
+
+/**
+ * @brief IndexCursor class. A scan over a BTreeIndex that keeps its own state, so that any number of cursors
+ * can scan one index at once, alongside the scan of the index itself and from several threads. Like that
+ * scan, a cursor copies the matching record ids out of one leaf at a time and keeps no page pinned between
+ * calls. A cursor must not outlive its index.
+*/
+class IndexCursor {
+
+ private:
+
+  /**
+   * Index scanned.
+   */
+	BTreeIndex	*index;
+
+  /**
+   * State of the scan.
+   */
+	ScanState scan;
+
+public:
+  /**
+   * IndexCursor Constructor. The cursor has no scan started.
+   * @param indexIn	Index to scan
+   */
+	IndexCursor(BTreeIndex *indexIn);
+
+  /**
+	 * Begin a filtered scan of the index, as BTreeIndex::startScan(), ending the scan of this cursor if one is
+	 * executing. The scans of other cursors are not affected.
+   * @param lowVal	Low value of range, pointer to integer / double / char string
+   * @param lowOp		Low operator (GT/GTE)
+   * @param highVal	High value of range, pointer to integer / double / char string
+   * @param highOp	High operator (LT/LTE)
+   * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values 
+   * @throws  BadScanrangeException If lowVal > highval
+	 * @throws  NoSuchKeyFoundException If there is no key in the B+ tree that satisfies the scan criteria.
+	**/
+	const void startScan(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+
+  /**
+	 * Begin a filtered scan of the index with new bounds, like startScan(). If the new range starts in the leaf
+	 * the cursor read last, the scan starts from that leaf rather than from the root, so that the inner scan
+	 * of an index nested loop join over ascending keys does not walk down the tree for every outer tuple.
+   * @param lowVal	Low value of range, pointer to integer / double / char string
+   * @param lowOp		Low operator (GT/GTE)
+   * @param highVal	High value of range, pointer to integer / double / char string
+   * @param highOp	High operator (LT/LTE)
+   * @throws  BadOpcodesException If lowOp and highOp do not contain one of their their expected values 
+   * @throws  BadScanrangeException If lowVal > highval
+	 * @throws  NoSuchKeyFoundException If there is no key in the B+ tree that satisfies the scan criteria.
+	**/
+	const void rewind(const void* lowVal, const Operator lowOp, const void* highVal, const Operator highOp);
+
+  /**
+	 * Fetch the record id of the next index entry that matches the scan of this cursor.
+   * @param outRid	RecordId of next record found that satisfies the scan criteria returned in this
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	 * @throws IndexScanCompletedException If no more records, satisfying the scan criteria, are left to be scanned.
+	**/
+	const void scanNext(RecordId& outRid);
+
+  /**
+	 * Fetch the record id of the next index entry that matches the scan of this cursor, without throwing at
+	 * the end of the scan.
+   * @param outRid	RecordId of next record found that satisfies the scan criteria returned in this
+	 * @return True if a record id was returned; false if no more records satisfy the scan criteria.
+	 * @throws ScanNotInitializedException If no scan has been initialized.
+	**/
+	bool next(RecordId& outRid);
+
+  /**
+	 * Terminate the scan of this cursor. The cursor may be started again.
 	 * @throws ScanNotInitializedException If no scan has been initialized.
 	**/
 	const void endScan();
@@ -5,8 +5,11 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <algorithm>
 #include <memory>
 #include <iostream>
+#include <cstdlib>
+#include <cstring>
 #include "buffer.h"
 #include "bufHashTbl.h"
 #include "exceptions/hash_already_present_exception.h"
@@ -15,100 +18,164 @@
 
 namespace badgerdb {
 
-int BufHashTbl::hash(const File* file, const PageId pageNo)
+std::uint64_t BufHashTbl::hash(const std::uint64_t key)
 {
-  int tmp, value;
-  tmp = (long)file;  // cast of pointer to the file object to an integer
-  value = (tmp + pageNo) % HTSIZE;
-  return value;
+  // run the key through the 64-bit murmur3 finalizer, so consecutive pages of
+  // one file spread over all slots
+  std::uint64_t h = key * 0x9E3779B97F4A7C15ULL;
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+  return h;
 }
 
-BufHashTbl::BufHashTbl(int htSize)
-	: HTSIZE(htSize)
+BufHashTbl::BufHashTbl(const std::uint32_t numBufs)
 {
-  // allocate an array of pointers to hashBuckets
-  ht = new hashBucket* [htSize];
-  for(int i=0; i < HTSIZE; i++)
-    ht[i] = NULL;
+  // use more partitions only when each is expected to hold a few hundred
+  // entries, so that an unlucky skew can not overflow one
+  numPartitions = 1;
+  while (numPartitions < MAX_PARTITIONS && numBufs / (numPartitions * 2) >= 256)
+    numPartitions *= 2;
+
+  // each partition gets room for twice its share of the frames, keeping the
+  // load factor at or below one half
+  std::uint64_t perPartition = (static_cast<std::uint64_t>(numBufs) + numPartitions - 1) / numPartitions;
+  std::uint32_t slotsPerPartition = 16;
+  while (slotsPerPartition < 2 * perPartition)
+    slotsPerPartition *= 2;
+
+  const std::size_t bytes = sizeof(hashBucket) * slotsPerPartition * numPartitions;
+  void* mem = NULL;
+  if (posix_memalign(&mem, 64, bytes) != 0)
+    throw HashTableException();
+  memset(mem, 0, bytes);
+  slotArray = static_cast<hashBucket*>(mem);
+
+  partitions = new hashPartition[numPartitions];
+  for (std::uint32_t i = 0; i < numPartitions; i++)
+  {
+    partitions[i].slots = slotArray + static_cast<std::size_t>(i) * slotsPerPartition;
+    partitions[i].mask = slotsPerPartition - 1;
+  }
 }
 
 BufHashTbl::~BufHashTbl()
 {
-  for(int i = 0; i < HTSIZE; i++) {
-    hashBucket* tmpBuf = ht[i];
-    while (ht[i]) {
-      tmpBuf = ht[i];
-      ht[i] = ht[i]->next;
-      delete tmpBuf;
-    }
-  }
-  delete [] ht;
+  delete [] partitions;
+  free(slotArray);
 }
 
-void BufHashTbl::insert(const File* file, const PageId pageNo, const FrameId frameNo)
+std::int64_t BufHashTbl::findSlot(const hashPartition& part, const std::uint64_t hashValue,
+                              const std::uint64_t key) const
 {
-  int index = hash(file, pageNo);
-
-  hashBucket* tmpBuc = ht[index];
-  while (tmpBuc) {
-    if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
-  		throw HashAlreadyPresentException(tmpBuc->file->filename(), tmpBuc->pageNo, tmpBuc->frameNo);
-    tmpBuc = tmpBuc->next;
+  std::uint32_t index = hashValue & part.mask;
+  for (std::uint32_t dist = 0; dist <= part.mask; dist++)
+  {
+    const hashBucket& slot = part.slots[index];
+    if (slot.key == 0)
+      return -1;
+    if (slot.key == key)
+      return index;
+
+    // Robin Hood invariant: had the key been present, it would have displaced
+    // any entry closer to its home slot than we are to ours
+    const std::uint32_t slotDist = (index - hash(slot.key)) & part.mask;
+    if (slotDist < dist)
+      return -1;
+    index = (index + 1) & part.mask;
   }
-
-  tmpBuc = new hashBucket;
-  if (!tmpBuc)
-  	throw HashTableException();
-
-  tmpBuc->file = (File*) file;
-  tmpBuc->pageNo = pageNo;
-  tmpBuc->frameNo = frameNo;
-  tmpBuc->next = ht[index];
-  ht[index] = tmpBuc;
+  return -1;
 }
 
-void BufHashTbl::lookup(const File* file, const PageId pageNo, FrameId &frameNo) 
+void BufHashTbl::insert(const FileId fileId, const PageId pageNo, const FrameId frameNo)
 {
-  int index = hash(file, pageNo);
-  hashBucket* tmpBuc = ht[index];
-  while (tmpBuc) {
-    if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
+  const std::uint64_t k = key(fileId, pageNo);
+  const std::uint64_t h = hash(k);
+  hashPartition& part = partitionOf(h);
+
+  const std::int64_t existing = findSlot(part, h, k);
+  if (existing >= 0)
+  {
+    const hashBucket& slot = part.slots[existing];
+    throw HashAlreadyPresentException(File::filename(fileId), pageNo, slot.frameNo);
+  }
+
+  hashBucket entry;
+  entry.key = k;
+  entry.frameNo = frameNo;
+
+  std::uint32_t index = h & part.mask;
+  std::uint32_t dist = 0;
+  for (std::uint32_t probes = 0; probes <= part.mask; probes++)
+  {
+    hashBucket& slot = part.slots[index];
+    if (slot.key == 0)
     {
-      frameNo = tmpBuc->frameNo; // return frameNo by reference
+      slot = entry;
       return;
     }
-    tmpBuc = tmpBuc->next;
+
+    // take the slot from an entry that is closer to its home than we are and
+    // carry on inserting that entry instead
+    const std::uint32_t slotDist = (index - hash(slot.key)) & part.mask;
+    if (slotDist < dist)
+    {
+      std::swap(entry, slot);
+      dist = slotDist;
+    }
+    index = (index + 1) & part.mask;
+    dist++;
   }
 
-  throw HashNotFoundException(file->filename(), pageNo);
+  throw HashTableException();
 }
 
-void BufHashTbl::remove(const File* file, const PageId pageNo) {
-
-  int index = hash(file, pageNo);
-  hashBucket* tmpBuc = ht[index];
-  hashBucket* prevBuc = NULL;
+void BufHashTbl::lookup(const FileId fileId, const PageId pageNo, FrameId &frameNo)
+{
+  if (!find(fileId, pageNo, frameNo))
+    throw HashNotFoundException(File::filename(fileId), pageNo);
+}
 
-  while (tmpBuc)
-	{
-    if (tmpBuc->file == file && tmpBuc->pageNo == pageNo)
-		{
-      if(prevBuc) 
-				prevBuc->next = tmpBuc->next;
-      else
-				ht[index] = tmpBuc->next;
+bool BufHashTbl::find(const FileId fileId, const PageId pageNo, FrameId &frameNo)
+{
+  const std::uint64_t k = key(fileId, pageNo);
+  const std::uint64_t h = hash(k);
+  const hashPartition& part = partitionOf(h);
+  const std::int64_t index = findSlot(part, h, k);
+  if (index < 0)
+    return false;
+
+  frameNo = part.slots[index].frameNo; // return frameNo by reference
+  return true;
+}
 
-      delete tmpBuc;
+void BufHashTbl::remove(const FileId fileId, const PageId pageNo) {
+
+  const std::uint64_t k = key(fileId, pageNo);
+  const std::uint64_t h = hash(k);
+  hashPartition& part = partitionOf(h);
+  std::int64_t found = findSlot(part, h, k);
+  if (found < 0)
+    throw HashNotFoundException(File::filename(fileId), pageNo);
+
+  // backward-shift deletion: pull following displaced entries one slot closer
+  // to home until we reach an empty slot or one already at home
+  std::uint32_t index = found;
+  while (true)
+  {
+    const std::uint32_t next = (index + 1) & part.mask;
+    hashBucket& nextSlot = part.slots[next];
+    if (nextSlot.key == 0 ||
+        ((next - hash(nextSlot.key)) & part.mask) == 0)
+    {
+      part.slots[index].key = 0;
       return;
     }
-		else
-		{
-      prevBuc = tmpBuc;
-      tmpBuc = tmpBuc->next;
-    }
+    part.slots[index] = nextSlot;
+    index = next;
   }
-
-  throw HashNotFoundException(file->filename(), pageNo);
 }
 
 }
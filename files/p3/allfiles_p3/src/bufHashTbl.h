@@ -7,103 +7,199 @@
 
 #pragma once
 
+#include <cstdint>
+#include <mutex>
 #include "file.h"
 
 namespace badgerdb {
 
 /**
 * @brief Declarations for buffer pool hash table
+*
+* One slot of the open-addressing table. Four slots fit in a cache line.
 */
 struct hashBucket {
 	/**
-	 * pointer a file object (more on this below)
+	 * page key: the file id in the high half, the page number in the low
+	 * half; 0 if the slot is empty, as no open file has id File::INVALID_ID
+	 */
+	std::uint64_t key;
+
+	/**
+	 * frame number of page in the buffer pool
 	 */
-	File *file;
+	FrameId frameNo;
+};
+
 
+/**
+* @brief One independently latched partition of the hash table, padded so that
+* neighbouring partitions do not share a cache line.
+*/
+struct hashPartition {
 	/**
-	 * page number within a file
+	 * Latch for all slots belonging to this partition
 	 */
-	PageId pageNo;
+	std::mutex latch;
 
 	/**
-	 * frame number of page in the buffer pool
+	 * Slots of this partition, a power of two in number
 	 */
-	FrameId frameNo;
+	hashBucket* slots;
 
 	/**
-	 * Next node in the hash table
+	 * Number of slots minus one
 	 */
-	hashBucket*   next;
+	std::uint32_t mask;
+
+	/**
+	 * Padding up to a cache line
+	 */
+	char pad[64 - ((sizeof(std::mutex) + sizeof(hashBucket*) + sizeof(std::uint32_t)) % 64)];
 };
 
 
 /**
 * @brief Hash table class to keep track of pages in the buffer pool
 *
-* @warning This class is not threadsafe.
+* The table is split into up to MAX_PARTITIONS partitions, each an
+* open-addressing table with linear probing and Robin Hood displacement, guarded
+* by its own latch. All slots are preallocated, cache-line aligned, from the
+* number of frames: a partition has room for twice the frames expected to map to
+* it, so probes stay short and insert/remove never allocate.
+*
+* The table itself does not take the latches: callers must hold
+* latch(fileId, pageNo) around insert(), lookup(), find() and remove() for that
+* key, so
+* that a lookup can be combined with other work (e.g. pinning the frame)
+* atomically.
 */
 class BufHashTbl
 {
  private:
 	/**
-	 *	Size of Hash Table
+	 * Number of partitions, a power of two
+	 */
+  std::uint32_t numPartitions;
+
+	/**
+	 * Partitions of the table
 	 */
-  int HTSIZE;
+  hashPartition* partitions;
+
 	/**
-	 * Actual Hash table object
+	 * Backing storage of the slots of all partitions
 	 */
-  hashBucket**  ht;
+  hashBucket* slotArray;
 
 	/**
-	 * returns hash value between 0 and HTSIZE-1 computed using file and pageNo
+	 * returns hash value computed from a page key. The low bits select the
+	 * home slot within a partition, the high bits select the partition.
 	 *
-	 * @param file   	File object
-	 * @param pageNo  Page number in the file
+	 * @param key   	Page key
 	 * @return  			Hash value.
 	 */
-  int	 hash(const File* file, const PageId pageNo);
+  static std::uint64_t hash(const std::uint64_t key);
+
+	/**
+	 * Returns the partition a hash value belongs to.
+	 */
+  hashPartition& partitionOf(const std::uint64_t hashValue)
+  {
+		return partitions[(hashValue >> 32) & (numPartitions - 1)];
+  }
+
+	/**
+	 * Returns the slot holding the key in the partition, or -1.
+	 */
+  std::int64_t findSlot(const hashPartition& part, const std::uint64_t hashValue,
+                    const std::uint64_t key) const;
 
  public:
 	/**
+	 * Maximum number of independently latched partitions
+	 */
+  static const std::uint32_t MAX_PARTITIONS = 16;
+
+	/**
+	 * Returns the key of page pageNo of the file with id fileId, which fits the
+	 * whole identity of a page in 64 bits.
+	 *
+	 * @param fileId  Id of the file
+	 * @param pageNo  Page number in the file
+	 * @return  			Page key.
+	 */
+  static std::uint64_t key(const FileId fileId, const PageId pageNo)
+  {
+		return (static_cast<std::uint64_t>(fileId) << 32) | pageNo;
+  }
+
+	/**
    * Constructor of BufHashTbl class
+	 *
+	 * @param numBufs	Number of frames in the buffer pool, i.e. the maximum number of entries
 	 */
-	BufHashTbl(const int htSize);  // constructor
+	BufHashTbl(const std::uint32_t numBufs);  // constructor
 
 	/**
    * Destructor of BufHashTbl class
 	 */
   ~BufHashTbl(); // destructor
-	
+
 	/**
-   * Insert entry into hash table mapping (file, pageNo) to frameNo.
+   * Insert entry into hash table mapping (fileId, pageNo) to frameNo.
 	 *
-	 * @param file   	File object
+	 * @param fileId 	Id of the file
 	 * @param pageNo 	Page number in the file
 	 * @param frameNo Frame number assigned to that page of the file
    * @throws  HashAlreadyPresentException	if the corresponding page already exists in the hash table
-   * @throws  HashTableException (optional) if could not create a new bucket as running of memory
+   * @throws  HashTableException if the partition has no free slot left
 	 */
-  void insert(const File* file, const PageId pageNo, const FrameId frameNo);
+  void insert(const FileId fileId, const PageId pageNo, const FrameId frameNo);
 
 	/**
-   * Check if (file, pageNo) is currently in the buffer pool (ie. in
+   * Check if (fileId, pageNo) is currently in the buffer pool (ie. in
    * the hash table).
 	 *
-	 * @param file  	File object
+	 * @param fileId	Id of the file
 	 * @param pageNo	Page number in the file
 	 * @param frameNo Frame number reference
-   * @throws HashNotFoundException if the page entry is not found in the hash table 
+   * @throws HashNotFoundException if the page entry is not found in the hash table
+	 */
+  void lookup(const FileId fileId, const PageId pageNo, FrameId &frameNo);
+
+	/**
+   * Check if (fileId, pageNo) is currently in the buffer pool without throwing.
+   * This is the variant used on the buffer manager's hot paths, where a miss is
+   * the normal outcome rather than an error.
+	 *
+	 * @param fileId	Id of the file
+	 * @param pageNo	Page number in the file
+	 * @param frameNo Frame number reference, set only if the entry is found
+	 * @return  			True if the entry is found.
+	 */
+  bool find(const FileId fileId, const PageId pageNo, FrameId &frameNo);
+
+	/**
+   * Delete entry (fileId,pageNo) from hash table.
+	 *
+	 * @param fileId 	Id of the file
+	 * @param pageNo  Page number in the file
+   * @throws HashNotFoundException if the page entry is not found in the hash table
 	 */
-  void lookup(const File* file, const PageId pageNo, FrameId &frameNo);
+  void remove(const FileId fileId, const PageId pageNo);
 
 	/**
-   * Delete entry (file,pageNo) from hash table.
+   * Returns the latch guarding the partition (fileId,pageNo) hashes to.
 	 *
-	 * @param file   	File object
+	 * @param fileId 	Id of the file
 	 * @param pageNo  Page number in the file
-   * @throws HashNotFoundException if the page entry is not found in the hash table 
+	 * @return  			Partition latch.
 	 */
-  void remove(const File* file, const PageId pageNo);  
+  std::mutex& latch(const FileId fileId, const PageId pageNo)
+  {
+		return partitionOf(hash(key(fileId, pageNo))).latch;
+  }
 };
 
 }
@@ -5,6 +5,12 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <sys/mman.h>
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <map>
+#include <new>
 #include <memory>
 #include <iostream>
 #include "buffer.h"
@@ -20,133 +26,323 @@ namespace badgerdb {
 // Constructor of the class BufMgr
 //----------------------------------------
 
-BufMgr::BufMgr(std::uint32_t bufs)
-	: numBufs(bufs) {
+BufMgr::BufMgr(std::uint32_t bufs, ReplacementPolicyType policyType,
+               BufPoolMode poolMode)
+	: numBufs(bufs), poolMode(poolMode), traceHook(NULL), poolBytes(0) {
 	bufDescTable = new BufDesc[bufs];
 
   for (FrameId i = 0; i < bufs; i++) 
   {
   	bufDescTable[i].frameNo = i;
+  	bufDescTable[i].loading = false;
   	bufDescTable[i].valid = false;
   }
 
-  bufPool = new Page[bufs];
+  allocPool();
 
-  int htsize = ((((int) (bufs * 1.2))*2)/2)+1;
-  hashTable = new BufHashTbl (htsize);  // allocate the buffer hash table
+  hashTable = new BufHashTbl (bufs);  // allocate the buffer hash table
 
-  clockHand = bufs - 1;
+  policy = ReplacementPolicy::create(policyType, bufs);
+
+  bgStop = false;
+  bgKick = false;
+
+  prefetchActive = File::INVALID_ID;
+  prefetchStop = false;
 }
 
 
 BufMgr::~BufMgr() {
-  //Flush out all unwritten pages
+  if (prefetcher.joinable())
+  {
+    {
+      std::lock_guard<std::mutex> guard(prefetchLatch);
+      prefetchStop = true;
+    }
+    prefetchWake.notify_one();
+    prefetcher.join();
+  }
+  stopBgWriter();
+
+  //Flush out all unwritten pages, a file at a time
+  std::map<FileId, std::vector<FrameId> > dirtyFrames;
   for (std::uint32_t i = 0; i < numBufs; i++) 
   {
   	BufDesc* tmpbuf = &bufDescTable[i];
   	if (tmpbuf->valid == true && tmpbuf->dirty == true)
 		{
-			tmpbuf->file->writePage(tmpbuf->pageNo, bufPool[i]);
+			dirtyFrames[tmpbuf->fileId].push_back(i);
   	}
   }
+  for (std::map<FileId, std::vector<FrameId> >::iterator it = dirtyFrames.begin();
+       it != dirtyFrames.end(); ++it)
+  {
+    // any File object still open on the file will do. A destructor must not
+    // throw; a file that can't be written loses its pages, the others don't.
+    try
+    {
+      File::withOpenFile(it->first, bufDescTable[it->second.front()].file,
+                         [&](File& file) {
+        writeBackFrames(&file, it->second);
+        file.sync();
+      });
+    }
+    catch(...)
+    {
+    }
+  }
 
+  delete policy;
+  delete hashTable;
   delete [] bufDescTable;
-  delete [] bufPool;
+  if (poolMode == HUGE_PAGE_POOL)
+  {
+    munmap(bufPool, poolBytes);
+  }
+  else
+  {
+    delete [] bufPool;
+  }
 }
 
-void BufMgr::allocBuf(FrameId & frame) 
+void BufMgr::allocPool()
 {
-  // perform first part of clock algorithm to search for 
-  // open buffer frame
-  // Assumes non-concurrent access to buffer manager
-  std::uint32_t numScanned = 0;
-  bool found = 0;
+  if (poolMode == HEAP_POOL)
+  {
+    bufPool = new Page[numBufs];
+    return;
+  }
 
-  while (numScanned < 2*numBufs)	//Need to scn twice
+  // Every frame is overwritten by a read or allocation before it is used, so
+  // the zero-filled pages of an anonymous mapping need no initialization, and
+  // the kernel only backs them with memory on first touch.
+  const std::size_t hugePage = 2 * 1024 * 1024;
+  poolBytes = (static_cast<std::size_t>(numBufs) * Page::SIZE + hugePage - 1)
+              / hugePage * hugePage;
+  void* mem = MAP_FAILED;
+#ifdef MAP_HUGETLB
+  // reserve explicit huge pages up front: without a reservation, running out
+  // of them would raise SIGBUS on first touch instead of failing here
+  mem = mmap(NULL, poolBytes, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+  if (mem == MAP_FAILED)
   {
-    // advance the clock
-    advanceClock();
-    numScanned++;
+    // no huge pages reserved; ask for transparent huge pages instead
+    mem = mmap(NULL, poolBytes, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+      throw std::bad_alloc();
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(mem, poolBytes, MADV_HUGEPAGE);
+#endif
+  }
+  bufPool = static_cast<Page*>(mem);
+}
+
+bool BufMgr::tryClaim(const FrameId frame, const bool secondChance)
+{
+  BufDesc* tmpbuf = &bufDescTable[frame];
 
-    // if invalid, use frame
-    if (! bufDescTable[clockHand].valid)
+  // frame is being set up, flushed or evicted by someone else
+  if (! tmpbuf->latch.tryLock())
+  {
+    return false;
+  }
+
+  // if invalid, use frame
+  if (! tmpbuf->valid)
+  {
+    return true;
+  }
+
+  if (secondChance && tmpbuf->refbit)
+  {
+    // has been referenced, clear the bit
+    bufStats.accesses++;
+    tmpbuf->refbit = false;
+  }
+  // check to see if someone has it pinned. The page stays in the hash table
+  // until allocBuf has written it back, so a concurrent readPage finds this
+  // frame rather than the stale copy on disk.
+  else if (tmpbuf->pinCnt == 0)
+  {
+    return true;
+  }
+
+  tmpbuf->latch.unlock();
+  return false;
+}
+
+void BufMgr::allocBuf(FrameId & frame) 
+{
+  FrameId victim = 0;
+  for (;;)
+  {
+    // check for full buffer pool
+    if (!policy->pickVictim(*this, victim))
+    {
+      throw BufferExceededException();
+    }
+
+    BufDesc* tmpbuf = &bufDescTable[victim];
+    if (! tmpbuf->valid)
     {
       break;
     }
 
-    // is valid, check referenced bit
-    if (! bufDescTable[clockHand].refbit)
+    // flush any existing changes to disk if necessary
+    try
     {
-      // check to see if someone has it pinned
-      if (bufDescTable[clockHand].pinCnt == 0)
+      if (writeBackFrame(victim))
       {
-        // hasn't been referenced and is not pinned, use it
-        // remove previous entry from hash table
-        hashTable->remove(bufDescTable[clockHand].file, bufDescTable[clockHand].pageNo);
-        found = true;
-        break;
+        bufStats.diskwrites++;
+        bufStats.foregroundwrites++;
+
+        // the background writer, if running, fell behind: have it run a round now
+        {
+          std::lock_guard<std::mutex> guard(bgLatch);
+          bgKick = true;
+        }
+        bgWake.notify_one();
       }
     }
-    else
+    catch(...)
     {
-      // has been referenced, clear the bit
-      bufStats.accesses++;
-      bufDescTable[clockHand].refbit = false;
+      // the page is still mapped and dirty; hand it back to the policy
+      policy->restore(victim);
+      tmpbuf->latch.unlock();
+      throw;
     }
-  }
-  
-  // check for full buffer pool
-  if (!found && numScanned >= 2*numBufs)
-  {
-    throw BufferExceededException();
-  }
-  
-  // flush any existing changes to disk if necessary
-  if (bufDescTable[clockHand].dirty)
-  {
-    bufStats.diskwrites++;
-    //status = bufDescTable[clockHand].file->writePage(bufDescTable[clockHand].pageNo,
-    bufDescTable[clockHand].file->writePage(bufDescTable[clockHand].pageNo, bufPool[clockHand]);
+
+    // remove previous entry from hash table. Pins are only taken under the
+    // partition latch, so re-check the page while holding it.
+    bool evicted = false;
+    {
+      std::lock_guard<std::mutex> guard(hashTable->latch(tmpbuf->fileId, tmpbuf->pageNo));
+      if (tmpbuf->pinCnt == 0 && ! tmpbuf->dirty)
+      {
+        hashTable->remove(tmpbuf->fileId, tmpbuf->pageNo);
+        evicted = true;
+      }
+    }
+    if (evicted)
+    {
+      break;
+    }
+
+    // pinned again while it was being written: keep it and try another frame
+    policy->restore(victim);
+    tmpbuf->latch.unlock();
   }
 
 	//Reset all the BufDesc entry for the frame before returning the frame
-  bufDescTable[clockHand].Clear();
+  bufDescTable[victim].Clear();
 
   // return new frame number
-  frame = clockHand;
+  frame = victim;
 } // end allocBuf
 
 	
 void BufMgr::readPage(File* file, const PageId pageNo, Page*& page)
 {
-  // check to see if it is already in the buffer pool
-  // std::cout << "readPage called on file.page " << file << "." << pageNo << endl;
-  FrameId frameNo = 0;
-	try
-	{
-  	hashTable->lookup(file, pageNo, frameNo);
-
-    // set the referenced bit
-    bufDescTable[frameNo].refbit = true;
-    bufDescTable[frameNo].pinCnt++;
-    page = &bufPool[frameNo];
-  }
-  catch(HashNotFoundException e) //not in the buffer pool, must allocate a new page
+  if (traceHook)
+    traceHook(file, pageNo);
+  for (;;)
   {
+    // check to see if it is already in the buffer pool
+    FrameId frameNo = 0;
+    bool hit = false;
+    bool loading = false;
+    {
+      std::lock_guard<std::mutex> guard(hashTable->latch(file->id(), pageNo));
+      if (hashTable->find(file->id(), pageNo, frameNo))
+      {
+        loading = bufDescTable[frameNo].loading;
+        if (!loading)
+        {
+          // set the referenced bit
+          bufDescTable[frameNo].refbit = true;
+          bufDescTable[frameNo].pinCnt++;
+          page = &bufPool[frameNo];
+          hit = true;
+        }
+      }
+    }
+    if (hit)
+    {
+      policy->recordAccess(frameNo);
+      return;
+    }
+    if (loading)
+    {
+      // another thread is reading the page in; wait for it and look again
+      bufDescTable[frameNo].latch.lock();
+      bufDescTable[frameNo].latch.unlock();
+      continue;
+    }
+
+    //not in the buffer pool, must allocate a new page
     // alloc a new frame
     allocBuf(frameNo);
 
-    // read the page into the new frame
-    bufStats.diskreads++;
-    //status = file->readPage(pageNo, &bufPool[frameNo]);
-    bufPool[frameNo] = file->readPage(pageNo);
+    // map the frame before reading the page into it. A copy read while the
+    // page is unmapped could be stale by the time it is mapped: another thread
+    // may load, modify and evict the page in between.
+    bool mapped = false;
+    {
+      std::lock_guard<std::mutex> guard(hashTable->latch(file->id(), pageNo));
+      FrameId existing;
+      if (!hashTable->find(file->id(), pageNo, existing))
+      {
+        // set up the entry properly
+        bufDescTable[frameNo].Set(file, pageNo);
+        bufDescTable[frameNo].loading = true;
 
-    // set up the entry properly
-    bufDescTable[frameNo].Set(file, pageNo);
+        // insert in the hash table
+        hashTable->insert(file->id(), pageNo, frameNo);
+        mapped = true;
+      }
+    }
+    if (!mapped)
+    {
+      // another thread faulted the same page in meanwhile; give our frame back
+      policy->recordRemove(frameNo);
+      bufDescTable[frameNo].latch.unlock();
+      continue;
+    }
+
+    try
+    {
+      bufStats.diskreads++;
+      // read straight into the frame, with O_DIRECT if the file supports it
+      file->readPageInto(pageNo, bufPool[frameNo]);
+    }
+    catch(...)
+    {
+      {
+        std::lock_guard<std::mutex> guard(hashTable->latch(file->id(), pageNo));
+        hashTable->remove(file->id(), pageNo);
+        bufDescTable[frameNo].Clear();
+      }
+      policy->recordRemove(frameNo);
+      bufDescTable[frameNo].latch.unlock();
+      throw;
+    }
+
+    {
+      std::lock_guard<std::mutex> guard(hashTable->latch(file->id(), pageNo));
+      bufDescTable[frameNo].loading = false;
+    }
     page = &bufPool[frameNo];
 
-    // insert in the hash table
-    hashTable->insert(file, pageNo, frameNo);
+    // policy hooks must run outside partition latches, as a policy holds its
+    // own lock while claiming frames
+    policy->recordLoad(frameNo, file->id(), pageNo);
+    bufDescTable[frameNo].latch.unlock();
+    return;
   }
 }
 
@@ -154,9 +350,11 @@ void BufMgr::readPage(File* file, const PageId pageNo, Page*& page)
 void BufMgr::unPinPage(File* file, const PageId pageNo, 
 			     const bool dirty) 
 {
+  std::lock_guard<std::mutex> guard(hashTable->latch(file->id(), pageNo));
+
   // lookup in hashtable
   FrameId frameNo = 0;
-  hashTable->lookup(file, pageNo, frameNo);
+  hashTable->lookup(file->id(), pageNo, frameNo);
 
   if (dirty == true) bufDescTable[frameNo].dirty = dirty;
 
@@ -170,26 +368,95 @@ void BufMgr::unPinPage(File* file, const PageId pageNo,
 
 void BufMgr::flushFile(const File* file) 
 {
-  for (std::uint32_t i = 0; i < numBufs; i++)
+  // a prefetch in progress may have a page of the file pinned
+  cancelPrefetch(file);
+
+  // Dirty frames stay latched until they have been written back together,
+  // even if a pinned page stops the walk, as they are out of the hash table.
+  std::vector<FrameId> dirtyFrames;
+  std::exception_ptr error;
+  for (std::uint32_t i = 0; i < numBufs && !error; i++)
 	{
   	BufDesc* tmpbuf = &(bufDescTable[i]);
-  	if(tmpbuf->valid == true && tmpbuf->file == file)
+		tmpbuf->latch.lock();
+		try
 		{
-	    if (tmpbuf->pinCnt > 0)
-  			throw PagePinnedException(file->filename(), tmpbuf->pageNo, tmpbuf->frameNo);
-
-	    if (tmpbuf->dirty == true)
+			if(tmpbuf->valid == true && tmpbuf->fileId == file->id())
 			{
-				//if ((status = tmpbuf->file->writePage(tmpbuf->pageNo, &(bufPool[i]))) != OK)
-				tmpbuf->file->writePage(tmpbuf->pageNo, bufPool[i]);
-				tmpbuf->dirty = false;
-    	}
+				{
+					std::lock_guard<std::mutex> guard(hashTable->latch(file->id(), tmpbuf->pageNo));
+					if (tmpbuf->pinCnt > 0)
+						throw PagePinnedException(file->filename(), tmpbuf->pageNo, tmpbuf->frameNo);
+
+					hashTable->remove(file->id(),tmpbuf->pageNo);
+				}
+
+				if (tmpbuf->dirty == true)
+				{
+					dirtyFrames.push_back(i);
+					continue;
+				}
+
+				tmpbuf->Clear();
+				policy->recordRemove(i);
+			}
+			else if (tmpbuf->valid == false && tmpbuf->fileId == file->id())
+				throw BadBufferException(tmpbuf->frameNo, tmpbuf->dirty, tmpbuf->valid, tmpbuf->refbit);
+		}
+		catch(...)
+		{
+			error = std::current_exception();
+		}
+		tmpbuf->latch.unlock();
+  }
 
-    	hashTable->remove(file,tmpbuf->pageNo);
-    	tmpbuf->Clear();
-  	}
-		else if (tmpbuf->valid == false && tmpbuf->file == file)
-  		throw BadBufferException(tmpbuf->frameNo, tmpbuf->dirty, tmpbuf->valid, tmpbuf->refbit);
+  try
+  {
+    if (!dirtyFrames.empty())
+    {
+      File::withOpenFile(file->id(), file, [&](File& openFile) {
+        writeBackFrames(&openFile, dirtyFrames);
+      });
+    }
+  }
+  catch(...)
+  {
+    error = std::current_exception();
+  }
+
+  for (std::size_t j = 0; j < dirtyFrames.size(); j++)
+  {
+    bufDescTable[dirtyFrames[j]].Clear();
+    policy->recordRemove(dirtyFrames[j]);
+    bufDescTable[dirtyFrames[j]].latch.unlock();
+  }
+
+  if (error)
+  {
+    std::rethrow_exception(error);
+  }
+
+  // the file header is cached by the file and written back lazily
+  file->sync();
+}
+
+void BufMgr::writeBackFrames(File* file, std::vector<FrameId>& frames)
+{
+  std::sort(frames.begin(), frames.end(),
+            [this](const FrameId a, const FrameId b) {
+              return bufDescTable[a].pageNo < bufDescTable[b].pageNo;
+            });
+  std::vector<PageId> pageNos(frames.size());
+  std::vector<const Page*> pages(frames.size());
+  for (std::size_t i = 0; i < frames.size(); i++)
+  {
+    pageNos[i] = bufDescTable[frames[i]].pageNo;
+    pages[i] = &bufPool[frames[i]];
+  }
+  file->writePages(frames.size(), pageNos.data(), pages.data());
+  for (std::size_t i = 0; i < frames.size(); i++)
+  {
+    bufDescTable[frames[i]].dirty = false;
   }
 }
 
@@ -198,15 +465,63 @@ void BufMgr::disposePage(File* file, const PageId pageNo)
 	//Deallocate from file altogether
   //See if it is in the buffer pool
   FrameId frameNo = 0;
-  hashTable->lookup(file, pageNo, frameNo);
+  {
+    std::lock_guard<std::mutex> guard(hashTable->latch(file->id(), pageNo));
+    hashTable->lookup(file->id(), pageNo, frameNo);
+  }
 
-	// clear the page
-	bufDescTable[frameNo].Clear();
+  // frame latches are taken before partition latches, so re-check the mapping
+  // once we hold both
+  BufDesc* tmpbuf = &bufDescTable[frameNo];
+  bool removed = false;
+  PageId prevPageNo = Page::INVALID_NUMBER;
+  PageId nextPageNo = Page::INVALID_NUMBER;
+  tmpbuf->latch.lock();
+  {
+    std::lock_guard<std::mutex> guard(hashTable->latch(file->id(), pageNo));
+    if (tmpbuf->valid && tmpbuf->fileId == file->id() && tmpbuf->pageNo == pageNo)
+    {
+      hashTable->remove(file->id(), pageNo);
+      prevPageNo = bufPool[frameNo].prev_page_number();
+      nextPageNo = bufPool[frameNo].next_page_number();
 
-	hashTable->remove(file, pageNo);
+      // clear the page
+      tmpbuf->Clear();
+      removed = true;
+    }
+  }
+  if (removed)
+    policy->recordRemove(frameNo);
+  tmpbuf->latch.unlock();
 
   // deallocate it in the file	
   file->deletePage(pageNo);
+
+  // the file unlinked the page on disk; keep cached neighbours in step. Only
+  // files with a used-page chain get here, the others refuse deletePage.
+  if (removed)
+  {
+    if (prevPageNo != Page::INVALID_NUMBER)
+      setCachedNext(file, prevPageNo, nextPageNo);
+    if (nextPageNo != Page::INVALID_NUMBER)
+      setCachedPrev(file, nextPageNo, prevPageNo);
+  }
+}
+
+void BufMgr::setCachedNext(File* file, const PageId pageNo, const PageId nextPageNo)
+{
+  FrameId frameNo;
+  std::lock_guard<std::mutex> guard(hashTable->latch(file->id(), pageNo));
+  if (hashTable->find(file->id(), pageNo, frameNo))
+    bufPool[frameNo].set_next_page_number(nextPageNo);
+}
+
+void BufMgr::setCachedPrev(File* file, const PageId pageNo, const PageId prevPageNo)
+{
+  FrameId frameNo;
+  std::lock_guard<std::mutex> guard(hashTable->latch(file->id(), pageNo));
+  if (hashTable->find(file->id(), pageNo, frameNo))
+    bufPool[frameNo].set_prev_page_number(prevPageNo);
 }
 
 
@@ -219,14 +534,359 @@ void BufMgr::allocPage(File* file, PageId &pageNo, Page*& page)
 
   // allocate a new page in the file
 	//std::cerr << "buffer data size:" << bufPool[frameNo].data_.length() << "\n";
-  bufPool[frameNo] = file->allocatePage(pageNo);
+  try
+  {
+    file->allocatePageInto(pageNo, bufPool[frameNo]);
+  }
+  catch(...)
+  {
+    policy->recordRemove(frameNo);
+    bufDescTable[frameNo].latch.unlock();
+    throw;
+  }
   page = &bufPool[frameNo];
+  if (traceHook)
+    traceHook(file, pageNo);
+
+  // the file linked the new page after its old tail on disk; update the tail
+  // if it is cached. Pages of files without a chain have no predecessor.
+  if (page->prev_page_number() != Page::INVALID_NUMBER)
+    setCachedNext(file, page->prev_page_number(), pageNo);
+
+  {
+    std::lock_guard<std::mutex> guard(hashTable->latch(file->id(), pageNo));
+
+    // set up the entry properly
+    bufDescTable[frameNo].Set(file, pageNo);
+
+    // insert in the hash table
+    hashTable->insert(file->id(), pageNo, frameNo);
+  }
+  policy->recordLoad(frameNo, file->id(), pageNo);
+  bufDescTable[frameNo].latch.unlock();
+}
+
+void BufMgr::prefetch(File* file, const std::vector<PageId>& pageNos)
+{
+  for (std::size_t i = 0; i < pageNos.size(); i++)
+    prefetch(file, pageNos[i], 1);
+}
 
-  // set up the entry properly
-  bufDescTable[frameNo].Set(file, pageNo);
+void BufMgr::prefetch(File* file, const PageId pageNo, const std::uint32_t count)
+{
+  PrefetchRequest request;
+  request.file = file;
+  request.pageNo = pageNo;
+  request.count = count;
+  request.next = NULL;
+  queuePrefetch(request);
+}
+
+void BufMgr::prefetchChain(File* file, const PageId pageNo, const std::uint32_t count, NextPageFn next)
+{
+  PrefetchRequest request;
+  request.file = file;
+  request.pageNo = pageNo;
+  request.count = count;
+  request.next = next;
+  queuePrefetch(request);
+}
+
+void BufMgr::queuePrefetch(const PrefetchRequest& request)
+{
+  if (request.count == 0 || request.pageNo == Page::INVALID_NUMBER)
+    return;
+
+  {
+    std::lock_guard<std::mutex> guard(prefetchLatch);
+    if (prefetchQueue.size() >= MAX_PREFETCH_REQUESTS)
+      return;
+    prefetchQueue.push_back(request);
+    if (!prefetcher.joinable())
+      prefetcher = std::thread(&BufMgr::prefetchLoop, this);
+  }
+  prefetchWake.notify_one();
+}
+
+void BufMgr::cancelPrefetch(const File* file)
+{
+  std::unique_lock<std::mutex> lock(prefetchLatch);
+  for (std::deque<PrefetchRequest>::iterator it = prefetchQueue.begin(); it != prefetchQueue.end(); )
+  {
+    if (it->file->id() == file->id())
+      it = prefetchQueue.erase(it);
+    else
+      ++it;
+  }
+  while (prefetchActive == file->id())
+    prefetchDone.wait(lock);
+}
 
-  // insert in the hash table
-  hashTable->insert(file, pageNo, frameNo);
+void BufMgr::prefetchLoop()
+{
+  std::unique_lock<std::mutex> lock(prefetchLatch);
+  while (true)
+  {
+    while (!prefetchStop && prefetchQueue.empty())
+      prefetchWake.wait(lock);
+    if (prefetchStop)
+      break;
+
+    const PrefetchRequest request = prefetchQueue.front();
+    prefetchQueue.pop_front();
+    prefetchActive = request.file->id();
+    lock.unlock();
+
+    // runs of known page numbers are read in batches, so that a backend that
+    // can keep many reads in flight gets to do so
+    bool batched = request.next == NULL;
+    for (std::uint32_t i = 0; batched && i < request.count; i += PREFETCH_BATCH)
+    {
+      std::vector<PageId> pageNos;
+      for (std::uint32_t j = i; j < request.count && j < i + PREFETCH_BATCH; j++)
+        pageNos.push_back(request.pageNo + j);
+      batched = prefetchBatch(request.file, pageNos);
+    }
+
+    // otherwise go through readPage, one page at a time, so that hits, misses
+    // and races with other readers of the same page are handled as for any
+    // other reader; the pin is dropped right away
+    PageId pageNo = request.pageNo;
+    for (std::uint32_t i = 0; !batched && i < request.count && pageNo != Page::INVALID_NUMBER; i++)
+    {
+      Page* page = NULL;
+      try
+      {
+        readPage(request.file, pageNo, page);
+      }
+      catch(...)
+      {
+        // past the end of the file, a deleted page or no free frame: give up
+        // on the rest of the run
+        break;
+      }
+      const PageId nextNo = request.next != NULL ? request.next(*page) : pageNo + 1;
+      unPinPage(request.file, pageNo, false);
+      pageNo = nextNo;
+    }
+
+    lock.lock();
+    prefetchActive = File::INVALID_ID;
+    prefetchDone.notify_all();
+  }
+}
+
+bool BufMgr::prefetchBatch(File* file, const std::vector<PageId>& pageNos)
+{
+  // claim a frame for every page that is not in the pool. Leave most of the
+  // pool to the threads that actually need pages.
+  const std::size_t maxFrames = std::max<std::size_t>(1, numBufs / 4);
+  std::vector<PageId> missing;
+  std::vector<FrameId> frames;
+  std::vector<Page*> pages;
+  for (std::size_t i = 0; i < pageNos.size() && frames.size() < maxFrames; i++)
+  {
+    FrameId frameNo;
+    {
+      std::lock_guard<std::mutex> guard(hashTable->latch(file->id(), pageNos[i]));
+      if (hashTable->find(file->id(), pageNos[i], frameNo))
+        continue;
+    }
+    try
+    {
+      allocBuf(frameNo);
+    }
+    catch(...)
+    {
+      break;
+    }
+
+    // map the frame unpinned before the read, as readPage() does
+    bool mapped = false;
+    {
+      std::lock_guard<std::mutex> guard(hashTable->latch(file->id(), pageNos[i]));
+      FrameId existing;
+      if (!hashTable->find(file->id(), pageNos[i], existing))
+      {
+        bufDescTable[frameNo].Set(file, pageNos[i]);
+        bufDescTable[frameNo].pinCnt = 0;
+        bufDescTable[frameNo].loading = true;
+        hashTable->insert(file->id(), pageNos[i], frameNo);
+        mapped = true;
+      }
+    }
+    if (!mapped)
+    {
+      policy->recordRemove(frameNo);
+      bufDescTable[frameNo].latch.unlock();
+      continue;
+    }
+    missing.push_back(pageNos[i]);
+    frames.push_back(frameNo);
+    pages.push_back(&bufPool[frameNo]);
+  }
+
+  bool read = true;
+  try
+  {
+    bufStats.diskreads += missing.size();
+    file->readPages(missing.size(), missing.data(), pages.data());
+  }
+  catch(...)
+  {
+    read = false;
+  }
+
+  for (std::size_t i = 0; i < frames.size(); i++)
+  {
+    {
+      std::lock_guard<std::mutex> guard(hashTable->latch(file->id(), missing[i]));
+      if (read)
+      {
+        bufDescTable[frames[i]].loading = false;
+      }
+      else
+      {
+        hashTable->remove(file->id(), missing[i]);
+        bufDescTable[frames[i]].Clear();
+      }
+    }
+    if (read)
+      policy->recordLoad(frames[i], file->id(), missing[i]);
+    else
+      policy->recordRemove(frames[i]);
+    bufDescTable[frames[i]].latch.unlock();
+  }
+  return read;
+}
+
+bool BufMgr::writeBackFrame(const FrameId frame)
+{
+  BufDesc* tmpbuf = &bufDescTable[frame];
+
+  // holding the frame latch keeps the frame from being evicted or flushed, but
+  // not from being pinned. Pins are only taken under the partition latch, so
+  // copy the page while holding it; whoever pins and modifies the page later
+  // marks it dirty again when unpinning.
+  Page snapshot;
+  {
+    std::lock_guard<std::mutex> guard(hashTable->latch(tmpbuf->fileId, tmpbuf->pageNo));
+    if (! tmpbuf->valid || tmpbuf->pinCnt > 0 || ! tmpbuf->dirty)
+    {
+      return false;
+    }
+    tmpbuf->dirty = false;
+    snapshot = bufPool[frame];
+  }
+
+  // the File object the page was read through may have been closed since;
+  // a page of a file closed without flushFile() can't be written anywhere
+  try
+  {
+    return File::withOpenFile(tmpbuf->fileId, tmpbuf->file, [&](File& file) {
+      file.writePage(tmpbuf->pageNo, snapshot);
+    });
+  }
+  catch(...)
+  {
+    tmpbuf->dirty = true;
+    throw;
+  }
+}
+
+bool BufMgr::cleanFrame(const FrameId frame)
+{
+  BufDesc* tmpbuf = &bufDescTable[frame];
+  if (! tmpbuf->dirty || ! tmpbuf->latch.tryLock())
+  {
+    return false;
+  }
+
+  bool written = false;
+  try
+  {
+    written = writeBackFrame(frame);
+  }
+  catch(...)
+  {
+    // nobody to report to from the writer thread; leave the page for the
+    // foreground write, which will throw to its caller
+  }
+  tmpbuf->latch.unlock();
+
+  if (written)
+  {
+    bufStats.diskwrites++;
+    bufStats.backgroundwrites++;
+  }
+  return written;
+}
+
+void BufMgr::bgWriterLoop()
+{
+  std::vector<FrameId> candidates;
+  std::unique_lock<std::mutex> lock(bgLatch);
+  while (!bgStop)
+  {
+    const bool kicked = bgKick;
+    bgKick = false;
+    lock.unlock();
+
+    std::uint32_t dirtyFrames = 0;
+    for (std::uint32_t i = 0; i < numBufs; i++)
+    {
+      if (bufDescTable[i].dirty)
+        dirtyFrames++;
+    }
+    const double ratio = numBufs == 0 ? 0 : static_cast<double>(dirtyFrames) / numBufs;
+
+    // above the high watermark clean everything the policy would evict, in
+    // order and without a limit; otherwise only the next few victims
+    const bool urgent = ratio >= bgConfig.highWatermark;
+    std::uint32_t written = 0;
+    if (kicked || ratio > bgConfig.lowWatermark)
+    {
+      candidates.clear();
+      policy->nextVictims(urgent ? numBufs : bgConfig.lookahead, candidates);
+      for (std::size_t i = 0; i < candidates.size(); i++)
+      {
+        if (!urgent && written >= bgConfig.pagesPerRound)
+          break;
+        if (cleanFrame(candidates[i]))
+          written++;
+      }
+    }
+
+    lock.lock();
+    // pause unless still urgent and making progress; dirty pages that are all
+    // pinned would otherwise have us spin
+    if (!bgStop && !bgKick && !(urgent && written > 0))
+      bgWake.wait_for(lock, std::chrono::milliseconds(bgConfig.roundDelayMs));
+  }
+}
+
+void BufMgr::startBgWriter(const BgWriterConfig& config)
+{
+  if (bgWriter.joinable())
+    return;
+
+  bgConfig = config;
+  bgStop = false;
+  bgKick = false;
+  bgWriter = std::thread(&BufMgr::bgWriterLoop, this);
+}
+
+void BufMgr::stopBgWriter()
+{
+  if (!bgWriter.joinable())
+    return;
+
+  {
+    std::lock_guard<std::mutex> guard(bgLatch);
+    bgStop = true;
+  }
+  bgWake.notify_one();
+  bgWriter.join();
 }
 
 void BufMgr::printSelf(void) 
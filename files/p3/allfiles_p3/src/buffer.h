@@ -9,10 +9,27 @@
 
 #include "file.h"
 #include "bufHashTbl.h"
+#include "latch.h"
+#include "replacementPolicy.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace badgerdb {
 
+/**
+ * @brief How the memory of the buffer pool is allocated.
+ */
+enum BufPoolMode
+{
+	HEAP_POOL = 0,			/* One Page array from the heap, initialized up front */
+	HUGE_PAGE_POOL = 1	/* Anonymous mapping backed by 2 MB huge pages, zero-filled lazily */
+};
+
 /**
 * forward declaration of BufMgr class 
 */
@@ -27,9 +44,17 @@ class BufDesc {
 
  private:
 	/**
-   * Pointer to file to which corresponding frame is assigned
+   * File object the page was read through. It may have been closed since, so
+   * pages are written back through File::withOpenFile(), which prefers it if
+   * it is still open.
+	 */
+  const File* file;
+
+	/**
+   * Id of the file, which together with pageNo identifies the page; any File
+   * object on the same file finds the frame
 	 */
-  File* file;
+  FileId fileId;
 
 	/**
    * Page within file to which corresponding frame is assigned
@@ -42,24 +67,42 @@ class BufDesc {
   FrameId	frameNo;
 
 	/**
-   * Number of times this page has been pinned
+   * Number of times this page has been pinned. Only incremented while holding
+   * the hash table latch for (file, pageNo), so that eviction can check it
+   * and unmap the frame atomically.
 	 */
-  int pinCnt;
+  std::atomic<int> pinCnt;
 
 	/**
    * True if page is dirty;  false otherwise
 	 */
-  bool dirty;
+  std::atomic<bool> dirty;
 
 	/**
    * True if page is valid
 	 */
   bool valid;
 
+	/**
+   * True while the page is being read into the frame. The frame is mapped in
+   * the hash table before the read, so that nobody else reads the page too,
+   * but must not be pinned until the read is done. Only changed while holding
+   * the hash table latch for (file, pageNo).
+	 */
+  bool loading;
+
 	/**
    * Has this buffer frame been reference recently
 	 */
-  bool refbit;
+  std::atomic<bool> refbit;
+
+	/**
+   * Latch held while the frame is being (re)assigned: from the
+   * moment the policy claims it until its old page has been written back and
+   * the new one read in, and while it is flushed or disposed. Always acquired
+   * before any hash table latch.
+	 */
+  FrameLatch latch;
 
 	/**
    * Initialize buffer frame for a new user
@@ -68,10 +111,12 @@ class BufDesc {
 	{
     pinCnt = 0;
 		file = NULL;
+		fileId = File::INVALID_ID;
 		pageNo = Page::INVALID_NUMBER;
     dirty = false;
     refbit = false;
 		valid = false;
+		loading = false;
   };
 
 	/**
@@ -84,27 +129,29 @@ class BufDesc {
   void Set(File* filePtr, PageId pageNum)
 	{ 
 		file = filePtr;
+		fileId = filePtr->id();
     pageNo = pageNum;
     pinCnt = 1;
     dirty = false;
     valid = true;
+    loading = false;
     refbit = true;
   }
 
   void Print()
 	{
-		if(file != NULL)
+		if(fileId != File::INVALID_ID)
 		{
-			std::cout << "file:" << file->filename() << " ";
+			std::cout << "file:" << File::filename(fileId) << " ";
 			std::cout << "pageNo:" << pageNo << " ";
 		}
 		else
 			std::cout << "file:NULL ";
 
 		std::cout << "valid:" << valid << " ";
-		std::cout << "pinCnt:" << pinCnt << " ";
-		std::cout << "dirty:" << dirty << " ";
-		std::cout << "refbit:" << refbit << "\n";
+		std::cout << "pinCnt:" << pinCnt.load() << " ";
+		std::cout << "dirty:" << dirty.load() << " ";
+		std::cout << "refbit:" << refbit.load() << "\n";
   }
 
 	/**
@@ -125,17 +172,27 @@ struct BufStats
 	/**
    * Total number of accesses to buffer pool
 	 */
-  int accesses;
+  std::atomic<int> accesses;
 
 	/**
    * Number of pages read from disk (including allocs)
 	 */
-  int diskreads;
+  std::atomic<int> diskreads;
 
 	/**
    * Number of pages written back to disk
 	 */
-  int diskwrites;
+  std::atomic<int> diskwrites;
+
+	/**
+   * Number of dirty pages written back by a thread that needed a free frame
+	 */
+  std::atomic<int> foregroundwrites;
+
+	/**
+   * Number of dirty pages written back by the background writer
+	 */
+  std::atomic<int> backgroundwrites;
 
 	/**
    * Clear all values 
@@ -143,6 +200,7 @@ struct BufStats
   void clear()
   {
 		accesses = diskreads = diskwrites = 0;
+		foregroundwrites = backgroundwrites = 0;
   }
       
 	/**
@@ -156,16 +214,74 @@ struct BufStats
 
 
 /**
-* @brief The central class which manages the buffer pool including frame allocation and deallocation to pages in the file 
+* @brief Returns the page that follows page in a chain of pages, or
+* Page::INVALID_NUMBER at the end of the chain. See BufMgr::prefetchChain().
+*/
+typedef PageId (*NextPageFn)(const Page& page);
+
+
+/**
+* @brief Told of a page requested from the buffer manager, hit or miss. See
+* BufMgr::setTraceHook().
+*/
+typedef void (*PageTraceFn)(const File* file, const PageId pageNo);
+
+
+/**
+* @brief Settings of the background writer, see BufMgr::startBgWriter()
 */
-class BufMgr 
+struct BgWriterConfig
 {
- private:
 	/**
-   * Current position of clockhand in our buffer pool
+   * Most pages written per round while the dirty ratio is between the watermarks
+	 */
+  std::uint32_t pagesPerRound;
+
+	/**
+   * Pause between rounds in milliseconds, unless above the high watermark
+	 */
+  std::uint32_t roundDelayMs;
+
+	/**
+   * Number of frames ahead of the replacement policy examined per round
 	 */
-  FrameId clockHand;
+  std::uint32_t lookahead;
 
+	/**
+   * Fraction of dirty frames below which the writer stays idle, unless a thread
+   * had to write back a victim itself
+	 */
+  double lowWatermark;
+
+	/**
+   * Fraction of dirty frames above which the writer cleans without pausing or
+   * limiting itself to pagesPerRound
+	 */
+  double highWatermark;
+
+	/**
+   * Constructor of BgWriterConfig class, with defaults
+	 */
+  BgWriterConfig()
+		: pagesPerRound(64), roundDelayMs(10), lookahead(256),
+		  lowWatermark(0.05), highWatermark(0.5)
+  {
+  }
+};
+
+
+/**
+* @brief The central class which manages the buffer pool including frame allocation and deallocation to pages in the file 
+*
+* All public methods may be called concurrently. Lookups, pins and unpins only
+* take the latch of the hash table partition the page maps to, and frames are
+* claimed for eviction through their own latch. Which frame is evicted is left
+* to the ReplacementPolicy chosen at construction; the default CLOCK policy
+* takes no pool-wide lock at all.
+*/
+class BufMgr : private FrameClaimer
+{
+ private:
 	/**
    * Number of frames in the buffer pool
 	 */
@@ -187,7 +303,184 @@ class BufMgr
   BufStats bufStats;
 
 	/**
-	 * Allocate a free frame.  
+   * Decides which frame to evict; told about every hit, load and removal
+	 */
+  ReplacementPolicy* policy;
+
+	/**
+   * How bufPool was allocated
+	 */
+  BufPoolMode poolMode;
+
+	/**
+   * Told of every page requested, or NULL
+	 */
+  PageTraceFn traceHook;
+
+	/**
+   * Length of the mapping holding bufPool in HUGE_PAGE_POOL mode
+	 */
+  std::size_t poolBytes;
+
+	/**
+   * Allocates bufPool according to poolMode
+	 */
+  void allocPool();
+
+	/**
+   * Background writer thread, if running
+	 */
+  std::thread bgWriter;
+
+	/**
+   * Settings of the background writer
+	 */
+  BgWriterConfig bgConfig;
+
+	/**
+   * Set to ask the background writer to exit
+	 */
+  bool bgStop;
+
+	/**
+   * Set by a thread that had to write a dirty victim itself
+	 */
+  bool bgKick;
+
+	/**
+   * Guards bgStop and bgKick; bgWake is signalled with it to stop or wake the writer
+	 */
+  std::mutex bgLatch;
+
+	/**
+   * Wakes the background writer early, e.g. after a foreground write
+	 */
+  std::condition_variable bgWake;
+
+	/**
+   * Body of the background writer thread
+	 */
+  void bgWriterLoop();
+
+	/**
+	 * @brief A run of pages to be read in by the prefetch thread
+	 */
+  struct PrefetchRequest
+  {
+		/**
+		 * File to read from
+		 */
+    File* file;
+
+		/**
+		 * First page of the run
+		 */
+    PageId pageNo;
+
+		/**
+		 * Number of pages in the run
+		 */
+    std::uint32_t count;
+
+		/**
+		 * Successor of a page in the run; NULL for consecutive page numbers
+		 */
+    NextPageFn next;
+  };
+
+	/**
+   * Most requests queued for the prefetch thread; further requests are dropped
+	 */
+  static const std::size_t MAX_PREFETCH_REQUESTS = 64;
+
+	/**
+   * Prefetch thread, started by the first prefetch request
+	 */
+  std::thread prefetcher;
+
+	/**
+   * Requests waiting for the prefetch thread
+	 */
+  std::deque<PrefetchRequest> prefetchQueue;
+
+	/**
+   * Id of the file of the request the prefetch thread is working on, or
+   * File::INVALID_ID
+	 */
+  FileId prefetchActive;
+
+	/**
+   * Set to ask the prefetch thread to exit
+	 */
+  bool prefetchStop;
+
+	/**
+   * Guards the prefetch queue, prefetchActive and prefetchStop
+	 */
+  std::mutex prefetchLatch;
+
+	/**
+   * Signalled when a request is queued or the prefetch thread should stop
+	 */
+  std::condition_variable prefetchWake;
+
+	/**
+   * Signalled when the prefetch thread finishes a request
+	 */
+  std::condition_variable prefetchDone;
+
+	/**
+   * Queues a prefetch request, starting the prefetch thread if needed
+	 */
+  void queuePrefetch(const PrefetchRequest& request);
+
+	/**
+   * Body of the prefetch thread
+	 */
+  void prefetchLoop();
+
+	/**
+   * Most pages the prefetch thread reads in one batch
+	 */
+  static const std::size_t PREFETCH_BATCH = 32;
+
+	/**
+	 * Reads the pages that are not in the buffer pool yet with one batched read
+	 * (File::readPages) and leaves them unpinned.
+	 *
+	 * @param file   	File object
+	 * @param pageNos	Page numbers to read
+	 * @return  			False if the batch could not be read as a whole.
+	 */
+  bool prefetchBatch(File* file, const std::vector<PageId>& pageNos);
+
+	/**
+	 * Writes back a copy of the page in frame if it is valid, dirty and
+	 * unpinned. The caller holds the frame's latch; the page may be pinned
+	 * again while the copy is written.
+	 *
+	 * @param frame		Frame to write back
+	 * @return  			True if the page was written; false if it was clean or
+	 * 								pinned, or if its file is no longer open (the page is
+	 * 								then dropped).
+	 * @throws  			Any exception from the write; the page is left dirty.
+	 */
+  bool writeBackFrame(const FrameId frame);
+
+	/**
+	 * Writes frame back to disk if it is valid, dirty and unpinned, without
+	 * evicting it. Frames that are latched are skipped.
+	 *
+	 * @param frame		Frame to clean
+	 * @return  			True if the frame was written.
+	 */
+  bool cleanFrame(const FrameId frame);
+
+	/**
+	 * Allocate a free frame. The frame is returned unmapped, cleared and with its
+	 * latch held; the caller must release it once the frame has been
+	 * set up (or given up, reporting the empty frame to the policy with
+	 * recordRemove()).
 	 *
 	 * @param frame   	Frame reference, frame ID of allocated frame returned via this variable
 	 * @throws BufferExceededException If no such buffer is found which can be allocated
@@ -195,12 +488,46 @@ class BufMgr
   void allocBuf(FrameId & frame);
 
 	/**
-   * Advance clock to next frame in the buffer pool
+	 * Takes frame for eviction if it is not latched or pinned. Called by the
+	 * replacement policy from within allocBuf().
+	 *
+	 * @param frame					Frame proposed as victim
+	 * @param secondChance	If true, refuse a frame whose refbit is set (clearing it)
+	 * @return  						True if the frame's latch is now held. A valid frame is left
+	 * 											in the hash table for allocBuf() to write back and unmap.
+	 */
+  bool tryClaim(const FrameId frame, const bool secondChance);
+
+	/**
+	 * Sets the next page pointer of a page if it is in the buffer pool, after
+	 * the file has changed it on disk. PageFile::writePage() never writes the
+	 * pointers back, so this only keeps the cached copy from going stale.
+	 *
+	 * @param file   				File object
+	 * @param pageNo  			Page number
+	 * @param nextPageNo		New next page number
 	 */
-  void advanceClock()
-  {
-		clockHand = (clockHand + 1) % numBufs;
-  }
+  void setCachedNext(File* file, const PageId pageNo, const PageId nextPageNo);
+
+	/**
+	 * Sets the previous page pointer of a page if it is in the buffer pool. See
+	 * setCachedNext().
+	 *
+	 * @param file   				File object
+	 * @param pageNo  			Page number
+	 * @param prevPageNo		New previous page number
+	 */
+  void setCachedPrev(File* file, const PageId pageNo, const PageId prevPageNo);
+
+	/**
+	 * Writes the given dirty frames of a file back to it in one batch, in order
+	 * of page number, so that the file can merge adjacent pages into vectored
+	 * writes. The frames must not change while this runs.
+	 *
+	 * @param file   				File object
+	 * @param frames				Frames holding pages of the file
+	 */
+  void writeBackFrames(File* file, std::vector<FrameId>& frames);
 
 
  public:
@@ -211,11 +538,21 @@ class BufMgr
 
 	/**
    * Constructor of BufMgr class
-	 */
-  BufMgr(std::uint32_t bufs);
+	 *
+	 * @param bufs		Number of frames in the buffer pool
+	 * @param policyType	Replacement policy to use
+	 * @param poolMode		How to allocate the frames. HUGE_PAGE_POOL maps them from
+	 *									2 MB huge pages (transparent huge pages if none are
+	 *									reserved), aligned for O_DIRECT, and touches no frame
+	 *									until it is first used, so large pools start instantly.
+	 */
+  BufMgr(std::uint32_t bufs, ReplacementPolicyType policyType = CLOCK_POLICY,
+         BufPoolMode poolMode = HEAP_POOL);
 	
 	/**
-   * Destructor of BufMgr class
+   * Destructor of BufMgr class. Writes back the dirty pages of every file
+	 * still open; errors writing one file are swallowed so the rest are
+	 * still written.
 	 */
   ~BufMgr();
 
@@ -251,7 +588,9 @@ class BufMgr
   void allocPage(File* file, PageId &PageNo, Page*& page); 
 
 	/**
-	 * Writes out all dirty pages of the file to disk.
+	 * Writes out all dirty pages of the file, and the header cached by the file, to disk.
+	 * The pages are written in order of page number, adjacent ones together, followed
+	 * by a single sync of the file.
 	 * All the frames assigned to the file need to be unpinned from buffer pool before this function can be successfully called.
 	 * Otherwise Error returned.
 	 *
@@ -271,6 +610,76 @@ class BufMgr
   void disposePage(File* file, const PageId PageNo);
 
 	/**
+	 * Asks for pages to be read into the buffer pool in the background. Pages are
+	 * left unpinned and pages already in the pool are not read again. This is a
+	 * hint only: requests are dropped when too many are queued, and pages that can
+	 * not be read (or find no free frame) are skipped without error.
+	 *
+	 * @param file   	File object
+	 * @param pageNos	Page numbers to read
+	 */
+  void prefetch(File* file, const std::vector<PageId>& pageNos);
+
+	/**
+	 * Asks for count consecutive pages, starting at pageNo, to be read into the
+	 * buffer pool in the background. See prefetch(File*, const std::vector<PageId>&).
+	 *
+	 * @param file   	File object
+	 * @param pageNo	First page number to read
+	 * @param count		Number of pages to read
+	 */
+  void prefetch(File* file, const PageId pageNo, const std::uint32_t count);
+
+	/**
+	 * Asks for up to count pages of a chain, starting at pageNo, to be read into
+	 * the buffer pool in the background. The successor of each page is taken from
+	 * the page once it is in the pool, so the chain is followed as it is read.
+	 * See prefetch(File*, const std::vector<PageId>&).
+	 *
+	 * @param file   	File object
+	 * @param pageNo	First page of the chain to read
+	 * @param count		Number of pages to read
+	 * @param next		Returns the successor of a page in the chain
+	 */
+  void prefetchChain(File* file, const PageId pageNo, const std::uint32_t count, NextPageFn next);
+
+	/**
+	 * Drops prefetch requests for the file and waits for one in progress to
+	 * finish. Called by flushFile(); must be called before deleting a File object
+	 * that prefetch has been requested for, if flushFile() is not.
+	 *
+	 * @param file   	File object
+	 */
+  void cancelPrefetch(const File* file);
+
+	/**
+	 * Starts a background thread that writes dirty, unpinned frames back to disk
+	 * shortly before the replacement policy would evict them, so that threads
+	 * allocating a frame rarely have to write one first. The writer only cleans
+	 * pages; they stay in the pool. Does nothing if the writer is running.
+	 *
+	 * @param config	Rate and watermarks of the writer
+	 */
+  void startBgWriter(const BgWriterConfig& config = BgWriterConfig());
+
+	/**
+	 * Stops the background writer, waiting for its current write to finish.
+	 * Called by the destructor.
+	 */
+  void stopBgWriter();
+
+	/**
+	 * Has hook told of every page requested through readPage() and allocPage(),
+	 * e.g. to record a trace for the policies benchmark. The hook is called from
+	 * the requesting thread, before a read is served and once an allocated page
+	 * has its number, and may be called concurrently. Set it while no other
+	 * thread uses the buffer manager.
+	 *
+	 * @param hook		Function to call, or NULL for none
+	 */
+  void setTraceHook(PageTraceFn hook) { traceHook = hook; }
+
+	/**
    * Print member variable values. 
 	 */
   void  printSelf();
@@ -0,0 +1,22 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "bad_file_format_exception.h"
+
+#include <sstream>
+#include <string>
+
+namespace badgerdb {
+
+BadFileFormatException::BadFileFormatException(const std::string& name)
+    : BadgerDbException(""), filename_(name) {
+  std::stringstream ss;
+  ss << "File is not in a known page file format: " << filename_;
+  message_.assign(ss.str());
+}
+
+}
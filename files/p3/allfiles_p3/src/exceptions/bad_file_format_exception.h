@@ -0,0 +1,47 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "badgerdb_exception.h"
+
+namespace badgerdb {
+
+/**
+ * @brief An exception that is thrown when a file being opened is not laid out
+ *        in any format this version can read or upgrade.
+ */
+class BadFileFormatException : public BadgerDbException {
+ public:
+  /**
+   * Constructs a bad file format exception for the given file.
+   *
+   * @param name  Name of file whose format is not recognized.
+   */
+  explicit BadFileFormatException(const std::string& name);
+
+  /**
+   * Destroys the exception.  Does nothing special; just included to make the
+   * compiler happy.
+   */
+  virtual ~BadFileFormatException() throw() {}
+
+  /**
+   * Returns the name of the file that caused this exception.
+   */
+  virtual const std::string& filename() const { return filename_; }
+
+ protected:
+  /**
+   * Name of file that caused this exception.
+   */
+  const std::string filename_;
+};
+
+}
@@ -0,0 +1,71 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "badgerdb_exception.h"
+#include "types.h"
+
+namespace badgerdb {
+
+/**
+ * @brief An exception that is thrown when the operating system fails a read or
+ *        write on a file.
+ */
+class FileIOException : public BadgerDbException {
+ public:
+  /**
+   * Constructs a file I/O exception for the given page, file and error.
+   *
+   * @param page_number   Page being read or written.
+   * @param file          Name of file that the request was made to.
+   * @param error         errno value reported by the operating system.
+   */
+  FileIOException(const PageId page_number, const std::string& file,
+                  const int error);
+
+  /**
+   * Destroys the exception.  Does nothing special; just included to make the
+   * compiler happy.
+   */
+  virtual ~FileIOException() throw() {}
+
+  /**
+   * Returns the page number that caused this exception.
+   */
+  virtual PageId page_number() const { return page_number_; }
+
+  /**
+   * Returns name of the file that caused this exception.
+   */
+  virtual const std::string& filename() const { return filename_; }
+
+  /**
+   * Returns the errno value reported by the operating system.
+   */
+  virtual int error() const { return error_; }
+
+ protected:
+  /**
+   * Page number which caused this exception.
+   */
+  const PageId page_number_;
+
+  /**
+   * Name of file which caused this exception.
+   */
+  const std::string filename_;
+
+  /**
+   * errno value reported by the operating system.
+   */
+  const int error_;
+};
+
+}
@@ -0,0 +1,29 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "invalid_record_length_exception.h"
+
+#include <sstream>
+#include <string>
+
+namespace badgerdb {
+
+InvalidRecordLengthException::InvalidRecordLengthException(
+    const PageId page_num, const std::size_t record_length,
+    const std::size_t expected_length)
+    : BadgerDbException(""),
+      page_number_(page_num),
+      record_length_(record_length),
+      expected_length_(expected_length) {
+  std::stringstream ss;
+  ss << "Record of " << record_length_ << " bytes does not fit page "
+     << page_number_ << ", which holds records of " << expected_length_
+     << " bytes.";
+  message_.assign(ss.str());
+}
+
+}
@@ -0,0 +1,66 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "badgerdb_exception.h"
+#include "types.h"
+
+namespace badgerdb {
+
+/**
+ * @brief An exception that is thrown when a record is attempted to be stored
+ *        in a page of fixed-length records that have a different length.
+ */
+class InvalidRecordLengthException : public BadgerDbException {
+ public:
+  /**
+   * Constructs an invalid record length exception for the given page.
+   *
+   * @param page_num          Number of page with fixed-length records.
+   * @param record_length     Length of record given, in bytes.
+   * @param expected_length   Length of the records of the page, in bytes.
+   */
+  InvalidRecordLengthException(const PageId page_num,
+                               const std::size_t record_length,
+                               const std::size_t expected_length);
+
+  /**
+   * Returns the page number of the page that caused this exception.
+   */
+  PageId page_number() const { return page_number_; }
+
+  /**
+   * Returns the length of the record given when this exception was thrown.
+   */
+  std::size_t record_length() const { return record_length_; }
+
+  /**
+   * Returns the length of the records of the page.
+   */
+  std::size_t expected_length() const { return expected_length_; }
+
+ protected:
+  /**
+   * Page number of the page that caused this exception.
+   */
+  const PageId page_number_;
+
+  /**
+   * Length of the record given when this exception was thrown.
+   */
+  const std::size_t record_length_;
+
+  /**
+   * Length of the records of the page.
+   */
+  const std::size_t expected_length_;
+};
+
+}
@@ -0,0 +1,47 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "badgerdb_exception.h"
+
+namespace badgerdb {
+
+/**
+ * @brief An exception that is thrown when a file opened read-only is asked to
+ *        allocate, write or delete a page.
+ */
+class ReadOnlyFileException : public BadgerDbException {
+ public:
+  /**
+   * Constructs a read-only file exception for the given file.
+   *
+   * @param name  Name of file that is read-only.
+   */
+  explicit ReadOnlyFileException(const std::string& name);
+
+  /**
+   * Destroys the exception.  Does nothing special; just included to make the
+   * compiler happy.
+   */
+  virtual ~ReadOnlyFileException() throw() {}
+
+  /**
+   * Returns the name of the file that caused this exception.
+   */
+  virtual const std::string& filename() const { return filename_; }
+
+ protected:
+  /**
+   * Name of file that caused this exception.
+   */
+  const std::string filename_;
+};
+
+}
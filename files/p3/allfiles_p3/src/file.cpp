@@ -7,40 +7,86 @@
 
 #include "file.h"
 
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
 #include <fstream>
 #include <iostream>
 #include <memory>
 #include <string>
 #include <cstdio>
+#include <cstring>
 #include <cassert>
+#include <vector>
 
+#include "exceptions/bad_file_format_exception.h"
 #include "exceptions/file_exists_exception.h"
+#include "exceptions/file_io_exception.h"
 #include "exceptions/file_not_found_exception.h"
 #include "exceptions/file_open_exception.h"
+#include "exceptions/insufficient_space_exception.h"
 #include "exceptions/invalid_page_exception.h"
 #include "file_iterator.h"
+#include "free_space_map.h"
 #include "page.h"
 
 namespace badgerdb {
 
-File::StreamMap File::open_streams_;
-File::CountMap File::open_counts_;
+File::IdMap File::open_ids_;
+std::vector<File::OpenFile> File::open_files_(1 /* INVALID_ID */);
+std::vector<FileId> File::free_ids_;
+std::mutex File::registry_latch_;
 
 void File::remove(const std::string& filename) {
   if (!exists(filename)) {
     throw FileNotFoundException(filename);
   }
-  if (isOpen(filename)) {
+  std::lock_guard<std::mutex> guard(registry_latch_);
+  if (open_ids_.find(filename) != open_ids_.end()) {
     throw FileOpenException(filename);
   }
   std::remove(filename.c_str());
+  std::remove(FreeSpaceMap::mapFilename(filename).c_str());
 }
 
 bool File::isOpen(const std::string& filename) {
   if (!exists(filename)) {
     return false;
   }
-  return open_counts_.find(filename) != open_counts_.end();
+  std::lock_guard<std::mutex> guard(registry_latch_);
+  return open_ids_.find(filename) != open_ids_.end();
+}
+
+std::string File::filename(const FileId file_id) {
+  std::lock_guard<std::mutex> guard(registry_latch_);
+  if (file_id >= open_files_.size()) {
+    return std::string();
+  }
+  return open_files_[file_id].name;
+}
+
+bool File::withOpenFile(const FileId file_id, const File* preferred,
+                        const std::function<void(File&)>& fn) {
+  std::unique_lock<std::mutex> guard(registry_latch_);
+  if (file_id >= open_files_.size() || open_files_[file_id].count == 0) {
+    return false;
+  }
+  const OpenFile& entry = open_files_[file_id];
+  File* file = entry.objects.front();
+  if (std::find(entry.objects.begin(), entry.objects.end(), preferred) !=
+      entry.objects.end()) {
+    file = const_cast<File*>(preferred);
+  }
+  // close() takes the latch of the file before leaving the registry
+  const std::shared_ptr<std::recursive_mutex> latch = entry.latch;
+  std::lock_guard<std::recursive_mutex> latch_guard(*latch);
+  guard.unlock();
+  fn(*file);
+  return true;
 }
 
 bool File::exists(const std::string& filename) {
@@ -59,26 +105,79 @@ File::~File() {
 }
 
 
+Page File::allocatePage(PageId &new_page_number) {
+  Page new_page;
+  allocatePageInto(new_page_number, new_page);
+  return new_page;
+}
+
+Page File::readPage(const PageId page_number) const {
+  Page page;
+  readPageInto(page_number, page);
+  return page;
+}
+
+void File::readPages(const std::size_t count, const PageId* page_numbers,
+                     Page* const* pages) const {
+  for (std::size_t i = 0; i < count; ++i) {
+    readPageInto(page_numbers[i], *pages[i]);
+  }
+}
+
+void File::writePages(const std::size_t count, const PageId* page_numbers,
+                      const Page* const* pages) {
+  for (std::size_t i = 0; i < count; ++i) {
+    writePage(page_numbers[i], *pages[i]);
+  }
+}
+
+void File::flush() const {
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
+  writeBackHeader();
+  free_space_->save();
+  stream_->flush();
+}
+
+void File::sync() const {
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
+  flush();
+  if (fdatasync(descriptor()) != 0) {
+    throw FileIOException(Page::INVALID_NUMBER, filename_, errno);
+  }
+}
+
 PageId File::getFirstPageNo() {
   const FileHeader& header = readHeader();
   return header.first_used_page;
 }
 
-File::File(const std::string& name, const bool create_new) : filename_(name) {
+File::File(const std::string& name, const bool create_new)
+    : filename_(name), id_(INVALID_ID) {
   openIfNeeded(create_new);
 
   if (create_new) {
     // File starts with 1 page (the header).
     FileHeader header = {1 /* num_pages */, 0 /* first_used_page */,
-                         0 /* num_free_pages */, 0 /* first_free_page */};
+                         0 /* num_free_pages */, 0 /* first_free_page */,
+                         0 /* last_used_page */, FORMAT_VERSION};
     writeHeader(header);
   }
 }
 
 void File::openIfNeeded(const bool create_new) {
-  if (open_counts_.find(filename_) != open_counts_.end()) {	//exists an entry already
-    ++open_counts_[filename_];
-    stream_ = open_streams_[filename_];
+  std::lock_guard<std::mutex> guard(registry_latch_);
+  const IdMap::const_iterator it = open_ids_.find(filename_);
+  if (it != open_ids_.end()) {	//exists an entry already
+    id_ = it->second;
+    OpenFile& entry = open_files_[id_];
+    ++entry.count;
+    entry.objects.push_back(this);
+    stream_ = entry.stream;
+    latch_ = entry.latch;
+    header_ = entry.header;
+    free_space_ = entry.free_space;
+    links_ = entry.links;
+    descriptor_ = entry.descriptor;
   } else {
     std::ios_base::openmode mode =
         std::fstream::in | std::fstream::out | std::fstream::binary;
@@ -97,35 +196,190 @@ void File::openIfNeeded(const bool create_new) {
       }
     }
     stream_.reset(new std::fstream(filename_, mode));
-    open_streams_[filename_] = stream_;
-    open_counts_[filename_] = 1;
+    latch_.reset(new std::recursive_mutex);
+    header_.reset(new CachedHeader);
+    header_->header = FileHeader();
+    header_->loaded = false;
+    header_->dirty = false;
+    free_space_.reset(new FreeSpaceMap(filename_));
+    links_.reset(new std::vector<CachedLinks>);
+    descriptor_.reset(new int(-1));
+
+    if (free_ids_.empty()) {
+      id_ = static_cast<FileId>(open_files_.size());
+      open_files_.push_back(OpenFile());
+    } else {
+      id_ = free_ids_.back();
+      free_ids_.pop_back();
+    }
+    OpenFile& entry = open_files_[id_];
+    entry.name = filename_;
+    entry.count = 1;
+    entry.objects.assign(1, this);
+    entry.stream = stream_;
+    entry.latch = latch_;
+    entry.header = header_;
+    entry.free_space = free_space_;
+    entry.links = links_;
+    entry.descriptor = descriptor_;
+    open_ids_[filename_] = id_;
   }
 }
 
 void File::close() {
-	if(open_counts_[filename_] > 0)
-  	--open_counts_[filename_];
+  std::lock_guard<std::mutex> guard(registry_latch_);
+  if (id_ == INVALID_ID) {
+    return;
+  }
+  OpenFile& entry = open_files_[id_];
+  // wait for anyone writing through this object; see withOpenFile()
+  const std::shared_ptr<std::recursive_mutex> latch = latch_;
+  std::lock_guard<std::recursive_mutex> latch_guard(*latch);
+  --entry.count;
+  assert(entry.count >= 0);
+  entry.objects.erase(
+      std::find(entry.objects.begin(), entry.objects.end(), this));
+
+  if (entry.count == 0) {
+    // last one out writes the header back
+    writeBackHeader();
+    free_space_->save();
+    if (*descriptor_ >= 0) {
+      ::close(*descriptor_);
+    }
+  }
 
   stream_.reset();
-	assert(open_counts_[filename_] >= 0);
-
-  if (open_counts_[filename_] == 0) {
-    open_streams_.erase(filename_);
-    open_counts_.erase(filename_);
+  latch_.reset();
+  header_.reset();
+  free_space_.reset();
+  links_.reset();
+  descriptor_.reset();
+
+  if (entry.count == 0) {
+    open_ids_.erase(entry.name);
+    entry = OpenFile();
+    free_ids_.push_back(id_);
   }
+  id_ = INVALID_ID;
 }
 
 FileHeader File::readHeader() const {
-  FileHeader header;
-  stream_->seekg(0 /* pos */, std::ios::beg);
-  stream_->read(reinterpret_cast<char*>(&header), sizeof(FileHeader));
-  return header;
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
+  if (!header_->loaded) {
+    stream_->seekg(0 /* pos */, std::ios::beg);
+    stream_->read(reinterpret_cast<char*>(&header_->header), sizeof(FileHeader));
+    if (!*stream_) {
+      // shorter than a header, e.g. an empty file of an older format
+      stream_->clear();
+    }
+    header_->loaded = true;
+  }
+  return header_->header;
 }
 
 void File::writeHeader(const FileHeader& header) {
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
+  header_->header = header;
+  header_->loaded = true;
+  header_->dirty = true;
+}
+
+void File::writeBackHeader() const {
+  if (!header_->dirty) {
+    return;
+  }
   stream_->seekp(0 /* pos */, std::ios::beg);
-  stream_->write(reinterpret_cast<const char*>(&header), sizeof(FileHeader));
+  stream_->write(reinterpret_cast<const char*>(&header_->header), sizeof(FileHeader));
+  stream_->flush();
+  header_->dirty = false;
+}
+
+int File::descriptor() const {
+  if (*descriptor_ < 0) {
+    *descriptor_ = ::open(filename_.c_str(), O_RDWR);
+    if (*descriptor_ < 0) {
+      throw FileIOException(Page::INVALID_NUMBER, filename_, errno);
+    }
+  }
+  return *descriptor_;
+}
+
+namespace {
+
+/**
+ * Returns the free space the free space map offers for a page.  Pages of
+ * fixed-length records are not offered, since they only take records of their
+ * own length.
+ */
+std::size_t mappedFreeSpace(const PageHeader& header) {
+  if (header.record_length != 0) {
+    return 0;
+  }
+  return header.free_space_upper_bound - header.free_space_lower_bound +
+         header.fragmented_space;
+}
+
+/**
+ * Writes all of the given buffers at the given offset, retrying short and
+ * interrupted writes.
+ *
+ * @return  0, or the errno value of the failed write.
+ */
+int pwritevFully(const int fd, struct iovec* iov, int iovcnt, off_t offset) {
+  while (iovcnt > 0) {
+    const ssize_t written = pwritev(fd, iov, iovcnt, offset);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return errno;
+    }
+    offset += written;
+    std::size_t left = static_cast<std::size_t>(written);
+    while (iovcnt > 0 && left >= iov->iov_len) {
+      left -= iov->iov_len;
+      ++iov;
+      --iovcnt;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+      iov->iov_len -= left;
+    }
+  }
+  return 0;
+}
+
+}
+
+void File::writeRuns(const std::size_t count, const PageId* page_numbers,
+                     const struct iovec* iovecs,
+                     const std::size_t parts_per_page) {
+  if (count == 0) {
+    return;
+  }
+  // writes through the stream must not land after ours
   stream_->flush();
+  const int fd = descriptor();
+
+  const std::size_t max_run = std::max<std::size_t>(IOV_MAX / parts_per_page, 1);
+  std::vector<struct iovec> run;
+  std::size_t first = 0;
+  while (first < count) {
+    std::size_t end = first + 1;
+    while (end < count && end - first < max_run &&
+           page_numbers[end] == page_numbers[end - 1] + 1) {
+      ++end;
+    }
+    // pwritev may advance the entries on a short write, so use a copy
+    run.assign(iovecs + first * parts_per_page, iovecs + end * parts_per_page);
+    const int error = pwritevFully(fd, run.data(), static_cast<int>(run.size()),
+                                   pagePosition(page_numbers[first]));
+    if (error != 0) {
+      throw FileIOException(page_numbers[first], filename_, error);
+    }
+    first = end;
+  }
 }
 
 
@@ -143,9 +397,18 @@ PageFile PageFile::open(const std::string& filename) {
 PageFile::PageFile(const std::string& name, const bool create_new)
 : File(name, create_new)
 {
+  // the free space map of an upgraded file is rebuilt from its pages
+  const bool upgrade =
+      !create_new && readHeader().format_version != FORMAT_VERSION;
+  if (upgrade) {
+    upgradeFormat();
+  }
+  loadFreeSpace(create_new || upgrade);
 }
 
 PageFile::~PageFile() {
+  // leave the registry before this object is torn down; see withOpenFile()
+  close();
 }
 
 PageFile::PageFile(const PageFile& other)
@@ -162,146 +425,235 @@ PageFile& PageFile::operator=(const PageFile& rhs) {
   return *this;
 }
 
-Page PageFile::allocatePage(PageId &new_page_number) {
+void PageFile::allocatePageInto(PageId &new_page_number, Page& new_page) {
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
   FileHeader header = readHeader();
-  Page new_page;
-  Page existing_page;
   if (header.num_free_pages > 0) {
-    new_page = readPage(header.first_free_page, true /* allow_free */);
-    new_page.set_page_number(header.first_free_page);
-		new_page_number = new_page.page_number();
-    header.first_free_page = new_page.next_page_number();
+    // Reuse the page at the head of the free list; only its header is needed
+    // to find the next free page.
+    new_page_number = header.first_free_page;
+    header.first_free_page = readPageHeader(new_page_number).next_page_number;
     --header.num_free_pages;
 
-    if (header.first_used_page == Page::INVALID_NUMBER ||
-        header.first_used_page > new_page.page_number()) {
-      // Either have no pages used or the head of the used list is a page later
-      // than the one we just allocated, so add the new page to the head.
-      if (header.first_used_page > new_page.page_number()) {
-        new_page.set_next_page_number(header.first_used_page);
-      }
-      header.first_used_page = new_page.page_number();
-    } else {
-      // New page is reused from somewhere after the beginning, so we need to
-      // find where in the used list to insert it.
-      PageId next_page_number = Page::INVALID_NUMBER;
-      for (FileIterator iter = begin(); iter != end(); ++iter) {
-        next_page_number = (*iter).next_page_number();
-        if (next_page_number > new_page.page_number() ||
-            next_page_number == Page::INVALID_NUMBER) {
-          existing_page = *iter;
-          break;
-        }
-      }
-      existing_page.set_next_page_number(new_page.page_number());
-      new_page.set_next_page_number(next_page_number);
-    }
-
     assert((header.num_free_pages == 0) ==
            (header.first_free_page == Page::INVALID_NUMBER));
   }
 	else
 	{
-    new_page.set_page_number(header.num_pages);
-		new_page_number = new_page.page_number();
-
-    if (header.first_used_page == Page::INVALID_NUMBER)
-		{
-      header.first_used_page = new_page.page_number();
-    }
-		else
-		{
-      // If we have pages allocated, we need to add the new page to the tail
-      // of the linked list.
-      for (FileIterator iter = begin(); iter != end(); ++iter) {
-        if ((*iter).next_page_number() == Page::INVALID_NUMBER) {
-          existing_page = *iter;
-          break;
-        }
-      }
-      assert(existing_page.isUsed());
-      existing_page.set_next_page_number(new_page.page_number());
+    new_page_number = header.num_pages;
+    if ((new_page_number - 1) % EXTENT_PAGES == 0) {
+      reserveExtent(new_page_number);
     }
     ++header.num_pages;
   }
-  writePage(new_page_number, new_page.header_, new_page);
-  if (existing_page.page_number() != Page::INVALID_NUMBER) {
-    // If we updated an existing page by inserting the new page into the
-    // used list, we need to write it out.
-    writePage(existing_page.page_number(), existing_page.header_, existing_page);
+
+  new_page.initialize();
+  new_page.set_page_number(new_page_number);
+  new_page.set_prev_page_number(header.last_used_page);
+
+  // Append the new page to the tail of the used list.
+  if (header.last_used_page == Page::INVALID_NUMBER)
+	{
+    header.first_used_page = new_page_number;
   }
-  writeHeader(header);
+	else
+	{
+    PageHeader tail_header = readPageHeader(header.last_used_page);
+    assert(tail_header.next_page_number == Page::INVALID_NUMBER);
+    tail_header.next_page_number = new_page_number;
+    writePageHeader(header.last_used_page, tail_header);
+  }
+  header.last_used_page = new_page_number;
 
-  return new_page;
+  writePage(new_page_number, new_page.header_, new_page);
+  writeHeader(header);
+  free_space_->update(new_page_number, mappedFreeSpace(new_page.header_));
 }
 
-Page PageFile::readPage(const PageId page_number) const {
+void PageFile::readPageInto(const PageId page_number, Page& page) const {
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
   FileHeader header = readHeader();
 
 	if (page_number >= header.num_pages)
 	{
 		throw InvalidPageException(page_number, filename_);
 	}
-	return readPage(page_number, false /* allow_free */);
+	readPageInto(page_number, page, false /* allow_free */);
 }
 
-Page PageFile::readPage(const PageId page_number, const bool allow_free) const {
-  Page page;
+void PageFile::readPageInto(const PageId page_number, Page& page,
+                            const bool allow_free) const {
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
   stream_->seekg(pagePosition(page_number), std::ios::beg);
   stream_->read(reinterpret_cast<char*>(&page.header_), sizeof(PageHeader));
   stream_->read(reinterpret_cast<char*>(&page.data_[0]), Page::DATA_SIZE);
+  cacheLinks(page_number, page.header_);
   if (!allow_free && !page.isUsed()) {
     throw InvalidPageException(page_number, filename_);
   }
-
-  return page;
 }
 
 void PageFile::writePage(const PageId new_page_number, const Page& new_page) {
-	PageHeader header = readPageHeader(new_page_number);
-	if (header.current_page_number == Page::INVALID_NUMBER)
+	std::lock_guard<std::recursive_mutex> guard(*latch_);
+	const CachedLinks links = readLinks(new_page_number);
+	if (!links.used)
 	{
 		// Page has been deleted since it was read.
 		throw InvalidPageException(new_page_number, filename_);
 	}
-	// Page on disk may have had its next page pointer updated since it was read;
-	// we don't modify that, but we do keep all the other modifications to the
-	// page header.
-	const PageId next_page_number = header.next_page_number;
-	header = new_page.header_;
-	header.next_page_number = next_page_number;
+	// Page on disk may have had its next or previous page pointer updated since
+	// it was read; we don't modify those, but we do keep all the other
+	// modifications to the page header.
+	PageHeader header = new_page.header_;
+	header.next_page_number = links.next_page_number;
+	header.prev_page_number = links.prev_page_number;
 	writePage(new_page_number, header, new_page);
+	free_space_->update(new_page_number, mappedFreeSpace(new_page.header_));
+}
+
+void PageFile::writePages(const std::size_t count, const PageId* page_numbers,
+                          const Page* const* pages) {
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
+  std::vector<std::size_t> order(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(),
+            [page_numbers](const std::size_t a, const std::size_t b) {
+              return page_numbers[a] < page_numbers[b];
+            });
+
+  // Keep the pointers on disk as writePage() does, checking every page before
+  // anything is written. Each page goes out as its patched header followed by
+  // its data.
+  std::vector<PageId> sorted_numbers(count);
+  std::vector<PageHeader> headers(count);
+  std::vector<struct iovec> iovecs(2 * count);
+  for (std::size_t i = 0; i < count; ++i) {
+    const PageId page_number = page_numbers[order[i]];
+    const Page& page = *pages[order[i]];
+    const CachedLinks on_disk = readLinks(page_number);
+    if (!on_disk.used) {
+      throw InvalidPageException(page_number, filename_);
+    }
+    sorted_numbers[i] = page_number;
+    headers[i] = page.header_;
+    headers[i].next_page_number = on_disk.next_page_number;
+    headers[i].prev_page_number = on_disk.prev_page_number;
+    iovecs[2 * i].iov_base = &headers[i];
+    iovecs[2 * i].iov_len = sizeof(PageHeader);
+    iovecs[2 * i + 1].iov_base = const_cast<char*>(&page.data_[0]);
+    iovecs[2 * i + 1].iov_len = Page::DATA_SIZE;
+  }
+  writeRuns(count, sorted_numbers.data(), iovecs.data(), 2 /* parts_per_page */);
+  for (std::size_t i = 0; i < count; ++i) {
+    cacheLinks(sorted_numbers[i], headers[i]);
+    free_space_->update(page_numbers[i], mappedFreeSpace(pages[i]->header_));
+  }
 }
 
 void PageFile::deletePage(const PageId page_number) {
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
   FileHeader header = readHeader();
 
-  Page existing_page = readPage(page_number);
-  Page previous_page;
-  // If this page is the head of the used list, update the header to point to
-  // the next page in line.
-  if (page_number == header.first_used_page) {
-    header.first_used_page = existing_page.next_page_number();
+  if (page_number >= header.num_pages) {
+    throw InvalidPageException(page_number, filename_);
+  }
+  const PageHeader existing_header = readPageHeader(page_number);
+  if (existing_header.current_page_number == Page::INVALID_NUMBER) {
+    throw InvalidPageException(page_number, filename_);
+  }
+
+  // Unlink the page from its neighbours in the used list, or from the header
+  // at either end.
+  const PageId prev_page_number = existing_header.prev_page_number;
+  const PageId next_page_number = existing_header.next_page_number;
+  if (prev_page_number == Page::INVALID_NUMBER) {
+    header.first_used_page = next_page_number;
   } else {
-    // Walk the used list so we can update the page that points to this one.
-    for (FileIterator iter = begin(); iter != end(); ++iter) {
-      previous_page = *iter;
-      if (previous_page.next_page_number() == existing_page.page_number()) {
-        previous_page.set_next_page_number(existing_page.next_page_number());
-        break;
-      }
-    }
+    PageHeader prev_header = readPageHeader(prev_page_number);
+    prev_header.next_page_number = next_page_number;
+    writePageHeader(prev_page_number, prev_header);
+  }
+  if (next_page_number == Page::INVALID_NUMBER) {
+    header.last_used_page = prev_page_number;
+  } else {
+    PageHeader next_header = readPageHeader(next_page_number);
+    next_header.prev_page_number = prev_page_number;
+    writePageHeader(next_page_number, next_header);
   }
+
   // Clear the page and add it to the head of the free list.
-  existing_page.initialize();
+  Page existing_page;
   existing_page.set_next_page_number(header.first_free_page);
   header.first_free_page = page_number;
   ++header.num_free_pages;
-  if (previous_page.isUsed()) {
-    writePage(previous_page.page_number(), previous_page.header_, previous_page);
-  }
   writePage(page_number, existing_page.header_, existing_page);
   writeHeader(header);
+  free_space_->update(page_number, 0);
+}
+
+RecordId PageFile::insertRecord(const std::string& record_data) {
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
+  // a new slot may be needed as well as room for the data
+  const std::size_t needed = record_data.length() + Page::MAX_SLOT_SIZE;
+  if (needed > Page::DATA_SIZE) {
+    throw InsufficientSpaceException(Page::INVALID_NUMBER, record_data.length(),
+                                     Page::DATA_SIZE - Page::MAX_SLOT_SIZE);
+  }
+
+  Page page;
+  while (true) {
+    PageId page_number = free_space_->find(needed);
+    if (page_number == Page::INVALID_NUMBER) {
+      allocatePageInto(page_number, page);
+      break;
+    }
+    std::size_t free_space = 0;
+    if (page_number < readHeader().num_pages) {
+      readPageInto(page_number, page, true /* allow_free */);
+      if (page.isUsed()) {
+        if (page.hasSpaceForRecord(record_data)) {
+          break;
+        }
+        free_space = mappedFreeSpace(page.header_);
+      }
+    }
+    // the map was out of date; correct it and look again
+    free_space_->update(page_number, free_space);
+  }
+
+  const RecordId record_id = page.insertRecord(record_data);
+  writePage(record_id.page_number, page);
+  return record_id;
+}
+
+void PageFile::deleteRecord(const RecordId& record_id) {
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
+  Page page;
+  readPageInto(record_id.page_number, page);
+  page.deleteRecord(record_id);
+  writePage(record_id.page_number, page);
+}
+
+void PageFile::loadFreeSpace(const bool rebuild) {
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
+  if (free_space_->isLoaded()) {
+    return;
+  }
+  const FileHeader header = readHeader();
+  if (!rebuild && free_space_->load(header.num_pages)) {
+    return;
+  }
+
+  // Free pages stay in category 0, so only the used list needs reading.
+  free_space_->reset(header.num_pages);
+  for (PageId page_number = header.first_used_page;
+       page_number != Page::INVALID_NUMBER;) {
+    const PageHeader page_header = readPageHeader(page_number);
+    free_space_->update(page_number, mappedFreeSpace(page_header));
+    page_number = page_header.next_page_number;
+  }
 }
 
 FileIterator PageFile::begin() {
@@ -315,20 +667,330 @@ FileIterator PageFile::end() {
 
 void PageFile::writePage(const PageId page_number, const PageHeader& header,
                      const Page& new_page) {
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
   stream_->seekp(pagePosition(page_number), std::ios::beg);
   stream_->write(reinterpret_cast<const char*>(&header), sizeof(PageHeader));
   stream_->write(reinterpret_cast<const char*>(&new_page.data_[0]),
                  Page::DATA_SIZE);
   stream_->flush();
+  cacheLinks(page_number, header);
+}
+
+namespace {
+
+/**
+ * Format of files written before slots were grouped under occupancy words.
+ */
+const std::uint32_t UNGROUPED_SLOTS_VERSION = 0x42440001;
+
+/**
+ * Format of files written before pages could hold fixed-length records, whose
+ * record length lies in what was then padding of the page header.
+ */
+const std::uint32_t VARIABLE_LENGTH_VERSION = 0x42440002;
+
+/**
+ * Header of a file in the original format, before the header tracked the tail
+ * of the used list.
+ */
+struct BaselineFileHeader {
+  PageId num_pages;
+  PageId first_used_page;
+  PageId num_free_pages;
+  PageId first_free_page;
+};
+
+/**
+ * Header of a file written before the format was versioned.
+ */
+struct LegacyFileHeader {
+  PageId num_pages;
+  PageId first_used_page;
+  PageId num_free_pages;
+  PageId first_free_page;
+  PageId last_used_page;
+};
+
+/**
+ * Header of a page written before pages had back pointers.
+ */
+struct LegacyPageHeader {
+  std::uint16_t free_space_lower_bound;
+  std::uint16_t free_space_upper_bound;
+  SlotId num_slots;
+  SlotId num_free_slots;
+  PageId current_page_number;
+  PageId next_page_number;
+};
+
+/**
+ * Header of a page written before pages kept the size of their holes.
+ */
+struct UngroupedPageHeader {
+  std::uint16_t free_space_lower_bound;
+  std::uint16_t free_space_upper_bound;
+  SlotId num_slots;
+  SlotId num_free_slots;
+  PageId current_page_number;
+  PageId next_page_number;
+  PageId prev_page_number;
+};
+
+/**
+ * Slot written before slots were grouped, which kept its own used flag.
+ */
+struct LegacySlot {
+  bool used;
+  std::uint16_t item_offset;
+  std::uint16_t item_length;
+};
+
+/**
+ * Returns the position of a page in a file whose header has the given size.
+ */
+std::streampos legacyPagePosition(const std::size_t file_header_size,
+                                  const PageId page_number) {
+  return file_header_size + (static_cast<std::streamoff>(page_number) - 1) * Page::SIZE;
+}
+
+}
+
+void PageFile::upgradeFormat() {
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
+  // The older formats differ in the size of the file header: the original
+  // one, one that also tracks the tail of the used list, and the versioned
+  // one. Pages follow the header back to back and are written whole, so the
+  // length of the file tells the formats apart. Files written before the
+  // format was versioned also have a shorter page header; the rest of the
+  // layout is common to all of them.
+  stream_->seekg(0 /* pos */, std::ios::end);
+  const std::streamoff length = stream_->tellg();
+  std::size_t file_header_size = 0;
+  const std::size_t file_header_sizes[] = {
+      sizeof(BaselineFileHeader), sizeof(LegacyFileHeader), sizeof(FileHeader)};
+  for (const std::size_t size : file_header_sizes) {
+    if (length >= static_cast<std::streamoff>(size) &&
+        (length - size) % Page::SIZE == 0) {
+      file_header_size = size;
+    }
+  }
+  const bool versioned = file_header_size == sizeof(FileHeader);
+  if (versioned && readHeader().format_version == VARIABLE_LENGTH_VERSION) {
+    // The layout is unchanged, but the padding that is now the record length
+    // was never cleared and may hold anything.
+    FileHeader header = readHeader();
+    if (header.num_pages == 0 ||
+        header.num_pages - 1 > (length - file_header_size) / Page::SIZE) {
+      throw BadFileFormatException(filename_);
+    }
+    for (PageId page_number = 1; page_number < header.num_pages; ++page_number) {
+      PageHeader page_header = readPageHeader(page_number);
+      page_header.record_length = 0;
+      writePageHeader(page_number, page_header);
+    }
+    header.format_version = FORMAT_VERSION;
+    writeHeader(header);
+    flush();
+    return;
+  }
+  if (file_header_size == 0 ||
+      versioned != (readHeader().format_version == UNGROUPED_SLOTS_VERSION)) {
+    throw BadFileFormatException(filename_);
+  }
+  const std::size_t page_header_size =
+      versioned ? sizeof(UngroupedPageHeader) : sizeof(LegacyPageHeader);
+
+  // The original header lacks the tail of the used list, which is found by
+  // the walk of the used list below.
+  LegacyFileHeader legacy = LegacyFileHeader();
+  const std::size_t legacy_size =
+      std::min(file_header_size, sizeof(LegacyFileHeader));
+  stream_->seekg(0 /* pos */, std::ios::beg);
+  stream_->read(reinterpret_cast<char*>(&legacy), legacy_size);
+  if (stream_->fail() ||
+      stream_->gcount() != static_cast<std::streamsize>(legacy_size)) {
+    stream_->clear();
+    throw BadFileFormatException(filename_);
+  }
+
+  // Nothing read from the file is trusted: page numbers must name pages the
+  // file holds, and slots must stay within their page.
+  const PageId pages_in_file =
+      static_cast<PageId>((length - file_header_size) / Page::SIZE);
+  if (legacy.num_pages == 0 || legacy.num_pages - 1 > pages_in_file) {
+    throw BadFileFormatException(filename_);
+  }
+  auto checkPageNumber = [&](const PageId page_number) {
+    if (page_number != Page::INVALID_NUMBER &&
+        page_number >= legacy.num_pages) {
+      throw BadFileFormatException(filename_);
+    }
+  };
+  checkPageNumber(legacy.first_used_page);
+  checkPageNumber(legacy.first_free_page);
+
+  std::vector<char> buffer(Page::SIZE);
+  auto readLegacyPage = [&](const PageId page_number) -> LegacyPageHeader {
+    stream_->seekg(legacyPagePosition(file_header_size, page_number),
+                   std::ios::beg);
+    stream_->read(buffer.data(), Page::SIZE);
+    if (stream_->fail() || stream_->gcount() != static_cast<std::streamsize>(Page::SIZE)) {
+      stream_->clear();
+      throw BadFileFormatException(filename_);
+    }
+    LegacyPageHeader page_header;
+    std::memcpy(&page_header, buffer.data(), sizeof(LegacyPageHeader));
+    return page_header;
+  };
+  auto legacySlot = [&](const SlotId slot_number) -> LegacySlot {
+    LegacySlot slot;
+    std::memcpy(&slot, buffer.data() + page_header_size +
+                           (slot_number - 1) * sizeof(LegacySlot),
+                sizeof(LegacySlot));
+    return slot;
+  };
+
+  // Check every page and make sure its records fit the new layout before
+  // changing anything.
+  std::vector<PageId> next_page_numbers(legacy.num_pages,
+                                       static_cast<PageId>(Page::INVALID_NUMBER));
+  for (PageId page_number = 1; page_number < legacy.num_pages; ++page_number) {
+    const LegacyPageHeader page_header = readLegacyPage(page_number);
+    checkPageNumber(page_header.next_page_number);
+    next_page_numbers[page_number] = page_header.next_page_number;
+    if (page_header.current_page_number == Page::INVALID_NUMBER) {
+      continue;
+    }
+    if (page_header.current_page_number != page_number ||
+        page_header_size + page_header.num_slots * sizeof(LegacySlot) >
+            Page::SIZE) {
+      throw BadFileFormatException(filename_);
+    }
+    std::size_t needed = Page::directorySize(page_header.num_slots);
+    for (SlotId slot_number = 1; slot_number <= page_header.num_slots;
+         ++slot_number) {
+      const LegacySlot slot = legacySlot(slot_number);
+      if (slot.used) {
+        if (slot.item_offset + slot.item_length >
+            Page::SIZE - page_header_size) {
+          throw BadFileFormatException(filename_);
+        }
+        needed += slot.item_length;
+      }
+    }
+    if (needed > Page::DATA_SIZE) {
+      throw InsufficientSpaceException(page_number, needed, Page::DATA_SIZE);
+    }
+  }
+
+  // Walk the used list to find every page's predecessor. A list longer than
+  // the file has a cycle.
+  std::vector<PageId> prev_page_numbers(legacy.num_pages,
+                                       static_cast<PageId>(Page::INVALID_NUMBER));
+  PageId prev_page_number = Page::INVALID_NUMBER;
+  PageId list_length = 0;
+  for (PageId page_number = legacy.first_used_page;
+       page_number != Page::INVALID_NUMBER;
+       page_number = next_page_numbers[page_number]) {
+    if (++list_length >= legacy.num_pages) {
+      throw BadFileFormatException(filename_);
+    }
+    prev_page_numbers[page_number] = prev_page_number;
+    prev_page_number = page_number;
+  }
+  legacy.last_used_page = prev_page_number;
+
+  // An unversioned file header is shorter, so every page may move towards the
+  // end of the file, by less than a page; rewrite them from the last one back
+  // so none is overwritten before it has been read. Records are inserted again
+  // into the same slots, packed at the end of the page.
+  Page page;
+  for (PageId page_number = legacy.num_pages - 1; page_number >= 1; --page_number) {
+    const LegacyPageHeader page_header = readLegacyPage(page_number);
+    const char* legacy_data = buffer.data() + page_header_size;
+
+    page.initialize();
+    page.header_.current_page_number = page_header.current_page_number;
+    page.header_.next_page_number = page_header.next_page_number;
+    page.header_.prev_page_number = prev_page_numbers[page_number];
+    if (page_header.current_page_number != Page::INVALID_NUMBER) {
+      for (SlotId slot_number = 1; slot_number <= page_header.num_slots;
+           ++slot_number) {
+        page.appendSlot();
+      }
+      for (SlotId slot_number = 1; slot_number <= page_header.num_slots;
+           ++slot_number) {
+        const LegacySlot slot = legacySlot(slot_number);
+        if (slot.used) {
+          page.insertRecordInSlot(
+              slot_number,
+              RecordView(legacy_data + slot.item_offset, slot.item_length));
+        }
+      }
+    }
+    writePage(page_number, page.header_, page);
+  }
+
+  FileHeader header = {legacy.num_pages, legacy.first_used_page,
+                       legacy.num_free_pages, legacy.first_free_page,
+                       legacy.last_used_page, FORMAT_VERSION};
+  writeHeader(header);
+  flush();
+}
+
+void PageFile::writePageHeader(const PageId page_number,
+                               const PageHeader& header) {
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
+  stream_->seekp(pagePosition(page_number), std::ios::beg);
+  stream_->write(reinterpret_cast<const char*>(&header), sizeof(PageHeader));
+  stream_->flush();
+  cacheLinks(page_number, header);
+}
+
+void PageFile::reserveExtent(const PageId first_page_number) {
+  // The size of the file is kept, so that it still ends with its last page.
+  int result;
+  do {
+    result = fallocate(descriptor(), FALLOC_FL_KEEP_SIZE,
+                       pagePosition(first_page_number),
+                       static_cast<off_t>(EXTENT_PAGES) * Page::SIZE);
+  } while (result != 0 && errno == EINTR);
+  // Allocation works without the reservation where the file system cannot
+  // make one.
+  if (result != 0 && errno != EOPNOTSUPP && errno != ENOSYS) {
+    throw FileIOException(first_page_number, filename_, errno);
+  }
 }
 
 PageHeader PageFile::readPageHeader(PageId page_number) const {
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
   PageHeader header;
   stream_->seekg(pagePosition(page_number), std::ios::beg);
   stream_->read(reinterpret_cast<char*>(&header), sizeof(PageHeader));
+  cacheLinks(page_number, header);
   return header;
 }
 
+File::CachedLinks PageFile::readLinks(const PageId page_number) const {
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
+  if (page_number >= links_->size() || !(*links_)[page_number].known) {
+    readPageHeader(page_number);
+  }
+  return (*links_)[page_number];
+}
+
+void PageFile::cacheLinks(const PageId page_number,
+                          const PageHeader& header) const {
+  if (page_number >= links_->size()) {
+    links_->resize(page_number + 1, CachedLinks());
+  }
+  CachedLinks& links = (*links_)[page_number];
+  links.next_page_number = header.next_page_number;
+  links.prev_page_number = header.prev_page_number;
+  links.used = header.current_page_number != Page::INVALID_NUMBER;
+  links.known = true;
+}
+
 
 
 
@@ -345,6 +1007,8 @@ BlobFile::BlobFile(const std::string& name, const bool create_new)
 }
 
 BlobFile::~BlobFile() {
+  // leave the registry before this object is torn down; see withOpenFile()
+  close();
 }
 
 BlobFile::BlobFile(const BlobFile& other)
@@ -361,9 +1025,10 @@ BlobFile& BlobFile::operator=(const BlobFile& rhs) {
   return *this;
 }
 
-Page BlobFile::allocatePage(PageId &new_page_number) {
+void BlobFile::allocatePageInto(PageId &new_page_number, Page& new_page) {
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
   FileHeader header = readHeader();
-	Page new_page;
+	new_page.initialize();
 
 	new_page_number = header.num_pages;
 
@@ -375,23 +1040,48 @@ Page BlobFile::allocatePage(PageId &new_page_number) {
 
 	writePage(new_page_number, new_page);
 	writeHeader(header);
-
-	return new_page;
 }
 
-Page BlobFile::readPage(const PageId page_number) const {
-	Page page;
+void BlobFile::readPageInto(const PageId page_number, Page& page) const {
+	std::lock_guard<std::recursive_mutex> guard(*latch_);
 	stream_->seekg(pagePosition(page_number), std::ios::beg);
 	stream_->read(reinterpret_cast<char*>(&page), Page::SIZE);
-	return page;
+	if (!*stream_) {
+		// past the end of the file; reset the shared stream for other readers
+		stream_->clear();
+		throw InvalidPageException(page_number, filename_);
+	}
 }
 
 void BlobFile::writePage(const PageId new_page_number, const Page& new_page) {
+	std::lock_guard<std::recursive_mutex> guard(*latch_);
 	stream_->seekp(pagePosition(new_page_number), std::ios::beg);
 	stream_->write(reinterpret_cast<const char*>(&new_page), Page::SIZE);
 	stream_->flush();
 }
 
+void BlobFile::writePages(const std::size_t count, const PageId* page_numbers,
+                          const Page* const* pages) {
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
+  std::vector<std::size_t> order(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(),
+            [page_numbers](const std::size_t a, const std::size_t b) {
+              return page_numbers[a] < page_numbers[b];
+            });
+
+  std::vector<PageId> sorted_numbers(count);
+  std::vector<struct iovec> iovecs(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    sorted_numbers[i] = page_numbers[order[i]];
+    iovecs[i].iov_base = const_cast<Page*>(pages[order[i]]);
+    iovecs[i].iov_len = Page::SIZE;
+  }
+  writeRuns(count, sorted_numbers.data(), iovecs.data(), 1 /* parts_per_page */);
+}
+
 //delePage should not be called for a blob_file, not supported
 void BlobFile::deletePage(const PageId page_number) {
 	throw InvalidPageException(page_number, filename_);
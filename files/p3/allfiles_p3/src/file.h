@@ -8,15 +8,21 @@
 #pragma once
 
 #include <fstream>
+#include <functional>
 #include <string>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include "page.h"
 
+struct iovec;
+
 namespace badgerdb {
 
 class FileIterator;
+class FreeSpaceMap;
 
 /**
  * @brief Header metadata for files on disk which contain pages.
@@ -42,6 +48,18 @@ struct FileHeader {
    */
   PageId first_free_page;
 
+  /**
+   * Page number of the last used page in the file, where new pages are linked
+   * into the used list.
+   */
+  PageId last_used_page;
+
+  /**
+   * On-disk format of the file; File::FORMAT_VERSION for files written by this
+   * version.
+   */
+  std::uint32_t format_version;
+
   /**
    * Returns true if this file header is equal to the other.
    *
@@ -52,7 +70,9 @@ struct FileHeader {
     return num_pages == rhs.num_pages &&
         num_free_pages == rhs.num_free_pages &&
         first_used_page == rhs.first_used_page &&
-        first_free_page == rhs.first_free_page;
+        first_free_page == rhs.first_free_page &&
+        last_used_page == rhs.last_used_page &&
+        format_version == rhs.format_version;
   }
 };
 
@@ -65,15 +85,40 @@ struct FileHeader {
  * deleted pages if possible).  If multiple File objects refer to the same
  * underlying file, they will share the stream in memory.
  * If a file that has already been opened (possibly by another query), then the File class
- * detects this (by looking in the open_streams_ map) and just returns a file object with
+ * detects this (by looking in the open_ids_ map) and just returns a file object with
  * the already created stream for the file without actually opening the UNIX file again. 
  *
- * @warning This class is not threadsafe.
+ * Each open file has a small integer id(), shared by all File objects on it,
+ * which identifies it to the buffer manager and iterators. Ids are handed out
+ * densely and reused once the last File object on a file is closed.
+ *
+ * File objects may be used from several threads: every access to a stream
+ * takes a latch shared by all File objects on that file, and opening and
+ * closing files is serialized on the registry of open files. Iterators are
+ * not protected beyond the individual reads they make.
+ *
+ * The file header is read from disk once, when the file is opened, and kept
+ * in memory, shared by all File objects on the file. Changes to it are
+ * written back by flush() and when the last File object on the file closes.
+ * The same goes for the free space map kept by PageFile.
  */
 
 
 class File {
  public:
+  /**
+   * Format of files written by this version: "BD" followed by the version
+   * number. The prefix can't be mistaken for the page data that follows the
+   * shorter header of files written before the format was versioned. Version
+   * 2 groups the slots of a page under occupancy words, and version 3 keeps
+   * the record length of pages of fixed-length records in their header.
+   */
+  static const std::uint32_t FORMAT_VERSION = 0x42440003;
+
+  /**
+   * Id that no open file has.
+   */
+  static const FileId INVALID_ID = 0;
 
   /**
    * Constructs a file object representing a file on the filesystem.
@@ -88,7 +133,7 @@ class File {
   File(const std::string& name, const bool create_new);
 
   /**
-   * Deletes an existing file.
+   * Deletes an existing file, along with its free space map.
    *
    * @param filename  Name of the file.
    * @throws  FileNotFoundException   If the file doesn't exist.
@@ -122,7 +167,16 @@ class File {
    *
    * @return The new page.
    */
-  virtual Page allocatePage(PageId &new_page_number) = 0;
+  Page allocatePage(PageId &new_page_number);
+
+  /**
+   * Allocates a new page in the file, building it in a caller-provided page
+   * (such as a buffer frame) instead of returning a copy.
+   *
+   * @param new_page_number   Number of the new page, returned via this variable.
+   * @param new_page          Page to build the new page in.
+   */
+  virtual void allocatePageInto(PageId &new_page_number, Page& new_page) = 0;
 
   /**
    * Reads an existing page from the file.
@@ -132,7 +186,18 @@ class File {
    * @throws  InvalidPageException  If the page doesn't exist in the file or is
    *                                not currently used.
    */
-  virtual Page readPage(const PageId page_number) const = 0;
+  Page readPage(const PageId page_number) const;
+
+  /**
+   * Reads an existing page from the file into a caller-provided page (such as
+   * a buffer frame), overwriting all of it, instead of returning a copy.
+   *
+   * @param page_number   Number of page to read.
+   * @param page          Page to read into.
+   * @throws  InvalidPageException  If the page doesn't exist in the file or is
+   *                                not currently used.
+   */
+  virtual void readPageInto(const PageId page_number, Page& page) const = 0;
 
   /**
    * Writes a page into the file at the given page number.
@@ -150,6 +215,44 @@ class File {
    */
   virtual void deletePage(const PageId page_number) = 0;
 
+  /**
+   * Reads several existing pages into caller-provided pages. Backends that can
+   * keep many requests in flight (see IoUringFile) issue them together; the
+   * default reads them one at a time.
+   *
+   * @param count         Number of pages to read.
+   * @param page_numbers  Numbers of pages to read.
+   * @param pages         Pages to read into, one per page number.
+   * @throws  InvalidPageException  If one of the pages doesn't exist in the file
+   *                                or is not currently used.
+   */
+  virtual void readPages(const std::size_t count, const PageId* page_numbers,
+                         Page* const* pages) const;
+
+  /**
+   * Writes several pages into the file. See readPages().
+   *
+   * @param count         Number of pages to write.
+   * @param page_numbers  Numbers of pages whose contents to replace.
+   * @param pages         Pages to write, one per page number.
+   */
+  virtual void writePages(const std::size_t count, const PageId* page_numbers,
+                          const Page* const* pages);
+
+  /**
+   * Writes the cached file header and free space map back to disk if they
+   * have changed, and flushes the stream.
+   */
+  void flush() const;
+
+  /**
+   * Flushes the file like flush(), then waits for its data to reach stable
+   * storage with a single fdatasync.
+   *
+   * @throws  FileIOException       If the operating system fails the sync.
+   */
+  void sync() const;
+
   /**
    * Returns the name of the file this object represents.
    *
@@ -157,6 +260,38 @@ class File {
    */
   const std::string& filename() const { return filename_; }
 
+  /**
+   * Returns the id of the open file this object represents, which is the same
+   * for all File objects on the file.
+   *
+   * @return Id of file.
+   */
+  FileId id() const { return id_; }
+
+  /**
+   * Returns the name of the open file with the given id.
+   *
+   * @param file_id   Id of an open file.
+   * @return Name of file, or an empty string if no file has the id.
+   */
+  static std::string filename(const FileId file_id);
+
+  /**
+   * Calls fn with a File object open on the file with the given id, holding
+   * the latch of the file, so that no File object on the file can be closed
+   * until fn returns. The buffer manager writes pages back through this, as
+   * the File object a page was read through may have been closed since while
+   * others stay open.
+   *
+   * @param file_id     Id of the file.
+   * @param preferred   File object to use if it is still open on the file;
+   *                    otherwise the one opened first is used.
+   * @param fn          Function to call.
+   * @return  False, without calling fn, if no File object is open on the file.
+   */
+  static bool withOpenFile(const FileId file_id, const File* preferred,
+                           const std::function<void(File&)>& fn);
+
  	/**
    * Returns pageid of first page in the file.
    *
@@ -197,31 +332,166 @@ class File {
   void close();
 
   /**
-   * Reads the header for this file from disk.
+   * Returns the header for this file, reading it from disk on first use.
    *
    * @return  The file header.
    */
   FileHeader readHeader() const;
 
   /**
-   * Writes the given header to the disk as the header for this file.
+   * Replaces the header for this file. The header is written to disk later,
+   * by flush() or when the file is closed.
    *
    * @param header  File header to write.
    */
   void writeHeader(const FileHeader& header);
 
-  typedef std::map<std::string, std::shared_ptr<std::fstream> > StreamMap;
-  typedef std::map<std::string, int> CountMap;
+  /**
+   * @brief In-memory copy of the header of an open file.
+   */
+  struct CachedHeader {
+    /**
+     * The header
+     */
+    FileHeader header;
+
+    /**
+     * True once header has been read from disk or set by writeHeader()
+     */
+    bool loaded;
+
+    /**
+     * True if header differs from the copy on disk
+     */
+    bool dirty;
+  };
 
   /**
-   * Streams for opened files.
+   * @brief In-memory copy of the used-list pointers in the header of a page.
    */
-  static StreamMap open_streams_;
+  struct CachedLinks {
+    /**
+     * Number of the next page in the page's list, as on disk
+     */
+    PageId next_page_number;
+
+    /**
+     * Number of the previous page in the page's list, as on disk
+     */
+    PageId prev_page_number;
+
+    /**
+     * True if the page is used rather than free
+     */
+    bool used;
+
+    /**
+     * True once the page's header has been read from or written to disk
+     */
+    bool known;
+  };
 
   /**
-   * Counts for opened files.
+   * Writes the cached header to the stream if it is dirty. Caller holds latch_.
+   */
+  void writeBackHeader() const;
+
+  /**
+   * Returns a descriptor of the file for the system calls the stream can't
+   * make, opening it on first use. It is shared with all File objects on the
+   * file and closed with the last of them. Caller holds latch_.
+   *
+   * @return  File descriptor, open for reading and writing.
+   * @throws  FileIOException       If the operating system fails to open it.
    */
-  static CountMap open_counts_;
+  int descriptor() const;
+
+  /**
+   * Writes pages to their positions in the file, bypassing the stream. Pages
+   * with consecutive numbers are merged into runs, each written with as few
+   * pwritev calls as IOV_MAX allows. Caller holds latch_.
+   *
+   * @param count           Number of pages to write.
+   * @param page_numbers    Numbers of the pages, in increasing order.
+   * @param iovecs          Buffers to write, parts_per_page per page, which
+   *                        together hold Page::SIZE bytes for each page.
+   * @param parts_per_page  Number of buffers per page.
+   * @throws  FileIOException       If the operating system fails a write.
+   */
+  void writeRuns(const std::size_t count, const PageId* page_numbers,
+                 const struct iovec* iovecs, const std::size_t parts_per_page);
+
+  /**
+   * @brief Entry of the registry of open files.
+   */
+  struct OpenFile {
+    /**
+     * Name of the file
+     */
+    std::string name;
+
+    /**
+     * Number of File objects on the file; 0 if the entry is unused
+     */
+    int count;
+
+    /**
+     * The File objects on the file, in the order they were opened
+     */
+    std::vector<File*> objects;
+
+    /**
+     * Stream shared by the File objects
+     */
+    std::shared_ptr<std::fstream> stream;
+
+    /**
+     * Latch for the stream
+     */
+    std::shared_ptr<std::recursive_mutex> latch;
+
+    /**
+     * Cached header of the file
+     */
+    std::shared_ptr<CachedHeader> header;
+
+    /**
+     * Free space map of the file
+     */
+    std::shared_ptr<FreeSpaceMap> free_space;
+
+    /**
+     * Used-list pointers of the pages of the file
+     */
+    std::shared_ptr<std::vector<CachedLinks> > links;
+
+    /**
+     * Descriptor of the file, or -1 until descriptor() opens it
+     */
+    std::shared_ptr<int> descriptor;
+  };
+
+  typedef std::map<std::string, FileId> IdMap;
+
+  /**
+   * Ids of opened files, by name. Only consulted when a file is opened by name.
+   */
+  static IdMap open_ids_;
+
+  /**
+   * Opened files, indexed by id. Entry INVALID_ID is never used.
+   */
+  static std::vector<OpenFile> open_files_;
+
+  /**
+   * Ids of unused entries of open_files_.
+   */
+  static std::vector<FileId> free_ids_;
+
+  /**
+   * Guards open_ids_, open_files_ and free_ids_.
+   */
+  static std::mutex registry_latch_;
 
   /**
    * Name of the file this object represents.
@@ -233,6 +503,42 @@ class File {
    */
   std::shared_ptr<std::fstream> stream_;
 
+  /**
+   * Latch held while using stream_, shared with all File objects on the file.
+   * Recursive, as public operations are built from one another.
+   */
+  std::shared_ptr<std::recursive_mutex> latch_;
+
+  /**
+   * Cached header of the file, shared with all File objects on the file and
+   * guarded by latch_.
+   */
+  std::shared_ptr<CachedHeader> header_;
+
+  /**
+   * Free space map of the file, shared with all File objects on the file and
+   * guarded by latch_. Only file types that place records load it.
+   */
+  std::shared_ptr<FreeSpaceMap> free_space_;
+
+  /**
+   * Used-list pointers of the pages of the file by page number, shared with
+   * all File objects on the file and guarded by latch_. Only file types with a
+   * used list fill it, so that writing a page back needs no read of its header.
+   */
+  std::shared_ptr<std::vector<CachedLinks> > links_;
+
+  /**
+   * Descriptor of the file, or -1 until descriptor() opens it; shared with all
+   * File objects on the file and guarded by latch_.
+   */
+  std::shared_ptr<int> descriptor_;
+
+  /**
+   * Id of the file, or INVALID_ID once closed.
+   */
+  FileId id_;
+
   friend class FileIterator;
 };
 
@@ -250,9 +556,9 @@ class PageFile : public File {
   /**
    * Opens the file named fileName and returns the corresponding File object.
 	 * It first checks if the file is already open. If so, then the new File object created uses the same input-output stream to read to or write fom
-	 * that already open file. Reference count (open_counts_ static variable inside the File object) is incremented whenever an already open file is
-	 * opened again. Otherwise the UNIX file is actually opened. The fileName and the stream associated with this File object are inserted into the
-	 * open_streams_ map.
+	 * that already open file. Reference count (count of its entry in the open_files_ registry) is incremented whenever an already open file is
+	 * opened again. Otherwise the UNIX file is actually opened. The stream associated with this File object is entered in the registry under a
+	 * new id, and the fileName is mapped to that id in the open_ids_ map.
    *
    * @param filename  Name of the file.
    * @throws  FileNotFoundException   If the requested file doesn't exist.
@@ -261,6 +567,9 @@ class PageFile : public File {
 
   /**
    * Constructs a file object representing a file on the filesystem.
+   * An existing file written in an older format, including the original one,
+   * is upgraded in place. The free space map of the file is read, or rebuilt from the page
+   * headers if it is missing or out of date.
    *
    * @param name        Name of file.
    * @param create_new  Whether to create a new file.
@@ -268,6 +577,8 @@ class PageFile : public File {
    *                                  create_new is true.
    * @throws  FileNotFoundException   If the underlying file doesn't exist and
    *                                  create_new is false.
+   * @throws  InsufficientSpaceException  If an older file can't be upgraded.
+   * @throws  BadFileFormatException  If the file is in no known format.
    */
   PageFile(const std::string& name, const bool create_new);
 
@@ -294,21 +605,29 @@ class PageFile : public File {
   ~PageFile();
 
   /**
-   * Allocates a new page in the file.
+   * Allocates a new page in the file, reusing the most recently freed page if
+   * there is one, and appends it to the used list. Takes constant time: the
+   * header tracks the tail of the used list, and freed pages are kept on a
+   * stack. Space for the file is reserved EXTENT_PAGES pages at a time.
    *
-   * @return The new page.
+   * @see File::allocatePageInto()
    */
-  Page allocatePage(PageId &new_page_number);
+  void allocatePageInto(PageId &new_page_number, Page& new_page);
+
+  /**
+   * Number of pages the file system is asked to reserve whenever the file
+   * grows past its reserved space.
+   */
+  static const PageId EXTENT_PAGES = 64;
 
   /**
    * Reads an existing page from the file.
    *
-   * @param page_number   Number of page to read.
-   * @return  The page.
+   * @see File::readPageInto()
    * @throws  InvalidPageException  If the page doesn't exist in the file or is
    *                                not currently used.
    */
-  Page readPage(const PageId page_number) const;
+  void readPageInto(const PageId page_number, Page& page) const;
 
   /**
    * Writes a page into the file at the given page number.
@@ -319,6 +638,19 @@ class PageFile : public File {
    */
   void writePage(const PageId page_number, const Page& new_page);
 
+  /**
+   * Writes several pages into the file in order of page number, merging
+   * adjacent pages into vectored writes. As with writePage(), the next and
+   * previous page pointers on disk are kept.
+   *
+   * @see File::writePages()
+   * @throws  InvalidPageException  If one of the pages is not currently used;
+   *                                nothing is written then.
+   * @throws  FileIOException       If the operating system fails a write.
+   */
+  void writePages(const std::size_t count, const PageId* page_numbers,
+                  const Page* const* pages);
+
   /**
    * Deletes a page from the file.
    *
@@ -326,6 +658,31 @@ class PageFile : public File {
    */
   void deletePage(const PageId page_number);
 
+  /**
+   * Inserts a record into a page of the file with room for it, allocating a
+   * new page only if the free space map knows of none. Finding the page takes
+   * constant time, and space freed by deleteRecord() is reused.
+   *
+   * Records are read from and written to disk directly, so the pages used
+   * must not be held in a buffer pool at the same time.
+   *
+   * @param record_data   Bytes that compose the record.
+   * @return  ID of the newly inserted record.
+   * @throws  InsufficientSpaceException  If the record does not fit on an
+   *                                      empty page.
+   */
+  RecordId insertRecord(const std::string& record_data);
+
+  /**
+   * Deletes a record from the page that holds it, making its space available
+   * to insertRecord(). See insertRecord() about buffered pages.
+   *
+   * @param record_id   ID of the record to delete.
+   * @throws  InvalidPageException    If the page is not currently used.
+   * @throws  InvalidRecordException  If the record does not exist.
+   */
+  void deleteRecord(const RecordId& record_id);
+
   /**
    * Returns an iterator at the first page in the file.
    *
@@ -351,12 +708,13 @@ class PageFile : public File {
    * an exception if the page is past the end of the file.
    *
    * @param page_number   Number of page to read.
+   * @param page          Page to read into.
    * @param allow_free    Whether to allow reading a free (unused) page.
-   * @return  The page.
    * @throws  InvalidPageException  If the page is free (unused) and
    *                                allow_free is false.
    */
-  Page readPage(const PageId page_number, const bool allow_free) const;
+  void readPageInto(const PageId page_number, Page& page,
+                    const bool allow_free) const;
 
   /**
    * Writes a page into the file at the given page number with the given header.
@@ -379,6 +737,72 @@ class PageFile : public File {
    */
   PageHeader readPageHeader(const PageId page_number) const;
 
+  /**
+   * Returns the used-list pointers of the given page as they are on disk,
+   * reading its header only if it has not been read or written yet.
+   *
+   * @param page_number   Number of page whose pointers are wanted.
+   * @return  Pointers of page.
+   */
+  CachedLinks readLinks(const PageId page_number) const;
+
+  /**
+   * Records the used-list pointers of a page header just read from or written
+   * to disk. Caller holds latch_.
+   *
+   * @param page_number   Number of page.
+   * @param header        Header of page as on disk.
+   */
+  void cacheLinks(const PageId page_number, const PageHeader& header) const;
+
+  /**
+   * Writes only the header of the given page to disk.  No bounds checking is
+   * performed.
+   *
+   * @param page_number   Number of page whose header is to be written.
+   * @param header        Header to write.
+   */
+  void writePageHeader(const PageId page_number, const PageHeader& header);
+
+  /**
+   * Asks the file system to reserve space for EXTENT_PAGES pages starting at
+   * the given page, so that a growing file is laid out in large extents. The
+   * size of the file is left alone; it still grows a page at a time.
+   *
+   * @param first_page_number   Number of first page of the extent.
+   * @throws  FileIOException   If the file system refuses the reservation for
+   *                            any reason but not supporting it.
+   */
+  void reserveExtent(const PageId first_page_number);
+
+  /**
+   * Converts a file written in an older format to the current format in
+   * place: either one written before the format was versioned, whose pages
+   * have no back pointers and whose header may lack the tail of the used list
+   * as in the original format, or one whose slots each kept a used flag. The
+   * records of every page are packed again under the new slot directory.
+   * Files of version 2 only have their page headers' record length cleared,
+   * since it takes two bytes those files left as padding.
+   *
+   * @throws  InsufficientSpaceException  If a page is too full to be
+   *                                      converted; the file is left unchanged.
+   * @throws  BadFileFormatException  If the length of the file matches none
+   *                                  of the older formats, or a header or
+   *                                  slot in it is out of bounds; the file is
+   *                                  left unchanged.
+   */
+  void upgradeFormat();
+
+  /**
+   * Loads the free space map of the file, unless another File object on the
+   * file already has, rebuilding it from the used pages if its file is
+   * missing or was written for a different number of pages.
+   *
+   * @param rebuild   Whether any map file left behind must be ignored, as for
+   *                  a file just created or converted from an older format.
+   */
+  void loadFreeSpace(const bool rebuild);
+
   friend class FileIterator;
 };
 
@@ -396,9 +820,9 @@ class BlobFile : public File {
   /**
    * Opens the file named fileName and returns the corresponding File object.
 	 * It first checks if the file is already open. If so, then the new File object created uses the same input-output stream to read to or write fom
-	 * that already open file. Reference count (open_counts_ static variable inside the File object) is incremented whenever an already open file is
-	 * opened again. Otherwise the UNIX file is actually opened. The fileName and the stream associated with this File object are inserted into the
-	 * open_streams_ map.
+	 * that already open file. Reference count (count of its entry in the open_files_ registry) is incremented whenever an already open file is
+	 * opened again. Otherwise the UNIX file is actually opened. The stream associated with this File object is entered in the registry under a
+	 * new id, and the fileName is mapped to that id in the open_ids_ map.
    *
    * @param filename  Name of the file.
    * @throws  FileNotFoundException   If the requested file doesn't exist.
@@ -442,21 +866,19 @@ class BlobFile : public File {
   ~BlobFile();
 
   /**
-   * Allocates a new page in the file.
+   * Allocates a new page at the end of the file.
    *
-   * @return The new page.
+   * @see File::allocatePageInto()
    */
-  Page allocatePage(PageId &new_page_number);
+  void allocatePageInto(PageId &new_page_number, Page& new_page);
 
   /**
    * Reads an existing page from the file.
    *
-   * @param page_number   Number of page to read.
-   * @return  The page.
-   * @throws  InvalidPageException  If the page doesn't exist in the file or is
-   *                                not currently used.
+   * @see File::readPageInto()
+   * @throws  InvalidPageException  If the page doesn't exist in the file.
    */
-  Page readPage(const PageId page_number) const;
+  void readPageInto(const PageId page_number, Page& page) const;
 
   /**
    * Writes a page into the file at the given page number.
@@ -467,6 +889,16 @@ class BlobFile : public File {
    */
   void writePage(const PageId page_number, const Page& new_page);
 
+  /**
+   * Writes several pages into the file in order of page number, merging
+   * adjacent pages into vectored writes. No bounds checking is performed.
+   *
+   * @see File::writePages()
+   * @throws  FileIOException       If the operating system fails a write.
+   */
+  void writePages(const std::size_t count, const PageId* page_numbers,
+                  const Page* const* pages);
+
   /**
    * Deletes a page from the file.
    *
@@ -6,17 +6,58 @@
  */
 
 #include "filescan.h"
+#include "mmap_page_file.h"
 #include "exceptions/end_of_file_exception.h"
 
 namespace badgerdb { 
 
-FileScan::FileScan(const std::string &name, BufMgr *bufferMgr)
+// successor of a page in the used-page chain, for read-ahead
+static PageId nextUsedPage(const Page& page)
+{
+  return page.next_page_number();
+}
+
+FileScan::FileScan(const std::string &name, BufMgr *bufferMgr, const std::uint32_t depth)
 {
   file = new PageFile(name, false);	//dont create new file
+  ownsFile = true;
+  mappedFile = NULL;
 	bufMgr = bufferMgr;
 	curDirtyFlag = false;
   curPage = NULL;
-	filePageIter = file->begin();
+  curPageNo = Page::INVALID_NUMBER;
+  atEnd = false;
+	prefetchDepth = depth;
+	pagesUntilPrefetch = 0;
+}
+
+FileScan::FileScan(PageFile *scanFile, BufMgr *bufferMgr, const std::uint32_t depth)
+{
+  file = scanFile;
+  ownsFile = false;
+  mappedFile = NULL;
+	bufMgr = bufferMgr;
+	curDirtyFlag = false;
+  curPage = NULL;
+  curPageNo = Page::INVALID_NUMBER;
+  atEnd = false;
+	prefetchDepth = depth;
+	pagesUntilPrefetch = 0;
+}
+
+FileScan::FileScan(MmapPageFile *scanFile)
+{
+  file = NULL;
+  ownsFile = false;
+  mappedFile = scanFile;
+  mappedFile->advise(MmapPageFile::SEQUENTIAL_ACCESS);
+	bufMgr = NULL;
+	curDirtyFlag = false;
+  curPage = NULL;
+  curPageNo = Page::INVALID_NUMBER;
+  atEnd = false;
+	prefetchDepth = 0;
+	pagesUntilPrefetch = 0;
 }
 
 FileScan::~FileScan()
@@ -24,36 +65,43 @@ FileScan::~FileScan()
   // generally must unpin last page of the scan
   if (curPage != NULL)
   {
-    bufMgr->unPinPage(file, (*filePageIter).page_number(), curDirtyFlag);
-    curPage = NULL;
-		curDirtyFlag = false;
-    filePageIter = file->begin();
+    releaseCurPage();
+  }
+  if (ownsFile)
+  {
+    bufMgr->flushFile(file);
+    delete file;
   }
-  bufMgr->flushFile(file);
-  delete file;
 }
 
 void FileScan::scanNext(RecordId& outRid)
 {
-  std::string rec;
-
-  if (filePageIter == file->end())
+  if (!next(outRid))
 	{
 		throw EndOfFileException();
 	}
+}
+
+bool FileScan::next(RecordId& outRid)
+{
+  if (atEnd)
+	{
+		return false;
+	}
 
   // special case of the first record of the first page of the file
   if (curPage == NULL)
   {
     // need to get the first page of the file
-		filePageIter = file->begin();
-    if(filePageIter == file->end())
+    curPageNo = mappedFile != NULL ? mappedFile->getFirstPageNo() : file->getFirstPageNo();
+    if (curPageNo == Page::INVALID_NUMBER)
 		{
-			throw EndOfFileException();
+			atEnd = true;
+			return false;
 		}
 	 
 		// read the first page of the file
-    bufMgr->readPage(file, (*filePageIter).page_number(), curPage); 
+    readCurPage();
 		curDirtyFlag = false;
 
 		// get the first record off the page
@@ -61,11 +109,8 @@ void FileScan::scanNext(RecordId& outRid)
 
 		if(pageRecordIter != curPage->end()) 
 		{
-		  // get pointer to record
-		  rec = *pageRecordIter;
-
 			outRid = pageRecordIter.getCurrentRecord();
-			return;
+			return true;
 		}
   }
 
@@ -75,40 +120,80 @@ void FileScan::scanNext(RecordId& outRid)
 
   while (pageRecordIter == curPage->end())
   {
-    // unpin the current page
-    bufMgr->unPinPage(file, (*filePageIter).page_number(), curDirtyFlag);
-    curPage = NULL;
-    curDirtyFlag = false;
+    // take the next page from the pinned frame, then unpin the current page
+    const PageId nextPageNo = curPage->next_page_number();
+    releaseCurPage();
 
-    filePageIter++;
-    if (filePageIter == file->end())
+    curPageNo = nextPageNo;
+    if (curPageNo == Page::INVALID_NUMBER)
     {
-      curPage = NULL;
-			throw EndOfFileException();
+      atEnd = true;
+			return false;
     }
 
     // read the next page of the file
-    bufMgr->readPage(file, (*filePageIter).page_number(), curPage);
+    readCurPage();
 
     // get the first record off the page
     pageRecordIter = curPage->begin(); 
   }
 
   // curRec points at a valid record
-  // see if the record satisfies the scan's predicate 
-  // get a pointer to the record
-  rec = *pageRecordIter;
 
 	// return rid of the record
 	outRid = pageRecordIter.getCurrentRecord();
-	return;
+	return true;
+}
+
+void FileScan::readCurPage()
+{
+  if (mappedFile != NULL)
+  {
+    // PageIterator only reads through the page
+    curPage = const_cast<Page*>(mappedFile->mappedPage(curPageNo));
+    return;
+  }
+  bufMgr->readPage(file, curPageNo, curPage);
+  prefetchAhead();
+}
+
+void FileScan::releaseCurPage()
+{
+  if (mappedFile == NULL)
+  {
+    bufMgr->unPinPage(file, curPageNo, curDirtyFlag);
+  }
+  curPage = NULL;
+  curDirtyFlag = false;
+}
+
+void FileScan::prefetchAhead()
+{
+  if (prefetchDepth == 0)
+    return;
+
+  // re-issue once half of the previous read-ahead has been consumed, so the
+  // scan stays between prefetchDepth / 2 and prefetchDepth pages behind. The
+  // pages already in the pool cost the prefetch thread a lookup only.
+  if (pagesUntilPrefetch > 0)
+  {
+    pagesUntilPrefetch--;
+    return;
+  }
+  bufMgr->prefetchChain(file, curPage->next_page_number(), prefetchDepth, nextUsedPage);
+  pagesUntilPrefetch = prefetchDepth / 2;
 }
 
 // returns pointer to the current record.  page is left pinned
 // and the scan logic is required to unpin the page 
 std::string FileScan::getRecord()
 {
-  return *pageRecordIter;
+  return getRecordView().str();
+}
+
+RecordView FileScan::getRecordView()
+{
+  return pageRecordIter.getRecordView();
 }
 
 // mark current page of scan dirty
@@ -12,28 +12,51 @@
 #include "types.h"
 #include "page.h"
 #include "buffer.h"
-#include "file_iterator.h"
 #include "page_iterator.h"
 
 namespace badgerdb {
 
+class MmapPageFile;
+
 /**
  * @brief This class is used to sequentially scan records in a relation.
+ *
+ * The scan follows the used-page chain through the pages it has pinned in the
+ * buffer pool, so a relation that is cached is scanned without any I/O. A
+ * scan of an MmapPageFile reads the pages in place in the mapping instead.
  */
 class FileScan
 {
  public:
 
-  FileScan(const std::string &name, BufMgr *bufMgr);
+  //prefetchDepth is the number of pages read ahead of the scan in the
+  //background; 0 turns read-ahead off
+  FileScan(const std::string &name, BufMgr *bufMgr, const std::uint32_t prefetchDepth = 16);
+
+  //scans a file that is already open, whose pages may already be in the
+  //buffer pool. The file is neither flushed nor closed by the scan
+  FileScan(PageFile *file, BufMgr *bufMgr, const std::uint32_t prefetchDepth = 16);
+
+  //scans a memory-mapped file without going through a buffer manager. The
+  //pages are read-only, so markDirty has no effect
+  explicit FileScan(MmapPageFile *file);
 
   ~FileScan();
 
   //return RecordId of next record that satisfies the scan 
+  //throws EndOfFileException once the scan is exhausted
   void scanNext(RecordId& outRid);
 
-  //read current record, returning pointer and length
+  //same as scanNext, but returns false instead of throwing at the end of the file
+  bool next(RecordId& outRid);
+
+  //read current record, returning a copy of it
   std::string getRecord();
 
+  //read current record, returning pointer and length. The view refers to the
+  //current page and is valid until the scan moves to the next page
+  RecordView getRecordView();
+
   //marks current page of scan dirty
   void markDirty();
 
@@ -43,6 +66,16 @@ class FileScan
    */
   PageFile      *file;
 
+  /**
+   * True if the scan opened file itself and must flush and close it.
+   */
+  bool          ownsFile;
+
+  /**
+   * Mapped file being scanned instead of file, or NULL.
+   */
+  MmapPageFile  *mappedFile;
+
   /**
    * Buffer Manager instance used to read/write pages into/from buffer pool.
    */
@@ -53,13 +86,48 @@ class FileScan
    */
   Page*         curPage;
 
-  FileIterator  filePageIter;
+  /**
+   * Number of the current page, or Page::INVALID_NUMBER when none is pinned.
+   */
+  PageId        curPageNo;
+
+  /**
+   * True once the last page of the file has been scanned.
+   */
+  bool          atEnd;
+
   PageIterator  pageRecordIter;
 
   /**
    * True if page has been updated
    */
   bool  	      curDirtyFlag;
+
+  /**
+   * Number of pages to read ahead of the scan
+   */
+  std::uint32_t prefetchDepth;
+
+  /**
+   * Pages left to scan before asking for the next read-ahead
+   */
+  std::uint32_t pagesUntilPrefetch;
+
+  /**
+   * Makes curPage point at page curPageNo, pinning it if it is read through
+   * the buffer manager.
+   */
+  void readCurPage();
+
+  /**
+   * Releases curPage, unpinning it if it was read through the buffer manager.
+   */
+  void releaseCurPage();
+
+  /**
+   * Asks the buffer manager to read ahead of the current page.
+   */
+  void prefetchAhead();
 };
 
 }
@@ -0,0 +1,102 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "free_space_map.h"
+
+#include <algorithm>
+#include <fstream>
+
+namespace badgerdb {
+
+FreeSpaceMap::FreeSpaceMap(const std::string& filename)
+    : filename_(mapFilename(filename)), loaded_(false), dirty_(false) {
+}
+
+bool FreeSpaceMap::load(const PageId num_pages) {
+  std::ifstream in(filename_, std::ios::binary | std::ios::ate);
+  if (!in || in.tellg() != static_cast<std::streampos>(num_pages)) {
+    return false;
+  }
+  std::vector<std::uint8_t> categories(num_pages);
+  in.seekg(0, std::ios::beg);
+  in.read(reinterpret_cast<char*>(categories.data()), num_pages);
+  if (!in) {
+    return false;
+  }
+
+  reset(num_pages);
+  for (PageId page_number = 1; page_number < num_pages; ++page_number) {
+    update(page_number, categories[page_number] * CATEGORY_BYTES);
+  }
+  dirty_ = false;
+  return true;
+}
+
+void FreeSpaceMap::reset(const PageId num_pages) {
+  categories_.assign(num_pages, 0);
+  positions_.assign(num_pages, 0);
+  for (std::size_t category = 0; category < CATEGORIES; ++category) {
+    buckets_[category].clear();
+  }
+  loaded_ = true;
+  dirty_ = true;
+}
+
+void FreeSpaceMap::save() {
+  if (!loaded_ || !dirty_) {
+    return;
+  }
+  std::ofstream out(filename_, std::ios::binary | std::ios::trunc);
+  out.write(reinterpret_cast<const char*>(categories_.data()),
+            categories_.size());
+  if (out) {
+    dirty_ = false;
+  }
+}
+
+void FreeSpaceMap::update(const PageId page_number,
+                          const std::size_t free_space) {
+  if (page_number >= categories_.size()) {
+    categories_.resize(page_number + 1, 0);
+    positions_.resize(page_number + 1, 0);
+    dirty_ = true;
+  }
+  const std::uint8_t category = static_cast<std::uint8_t>(
+      std::min(free_space / CATEGORY_BYTES, CATEGORIES - 1));
+  const std::uint8_t old_category = categories_[page_number];
+  if (category == old_category) {
+    return;
+  }
+
+  // swap the page with the last one of its old bucket to take it out
+  if (old_category != 0) {
+    std::vector<PageId>& bucket = buckets_[old_category];
+    const PageId moved = bucket.back();
+    bucket[positions_[page_number]] = moved;
+    positions_[moved] = positions_[page_number];
+    bucket.pop_back();
+  }
+  if (category != 0) {
+    positions_[page_number] = static_cast<std::uint32_t>(buckets_[category].size());
+    buckets_[category].push_back(page_number);
+  }
+  categories_[page_number] = category;
+  dirty_ = true;
+}
+
+PageId FreeSpaceMap::find(const std::size_t needed) const {
+  // every page of a category at least this one has room
+  for (std::size_t category = (needed + CATEGORY_BYTES - 1) / CATEGORY_BYTES;
+       category < CATEGORIES; ++category) {
+    if (category != 0 && !buckets_[category].empty()) {
+      return buckets_[category].back();
+    }
+  }
+  return Page::INVALID_NUMBER;
+}
+
+}
@@ -0,0 +1,143 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "page.h"
+#include "types.h"
+
+namespace badgerdb {
+
+/**
+ * @brief Map of how much free space each page of a file has, so that a page
+ *        with room for a record can be found without reading any page.
+ *
+ * The free space of each page is kept as a one-byte category: a page in
+ * category k has at least k * CATEGORY_BYTES bytes free. Pages that are not
+ * in use, or nearly full, are in category 0 and never offered. Pages of every
+ * other category are kept in a bucket per category, so that find() only looks
+ * at the top of at most CATEGORIES buckets.
+ *
+ * The categories are stored in a file next to the data file, named by
+ * mapFilename(), one byte per page. The map is only a hint: callers check the
+ * page they are given and correct its entry if it was stale.
+ *
+ * @warning This class is not threadsafe; File objects guard it with the latch
+ *          of their file.
+ */
+class FreeSpaceMap {
+ public:
+  /**
+   * Number of free space categories.
+   */
+  static const std::size_t CATEGORIES = 32;
+
+  /**
+   * Free space, in bytes, covered by each category.
+   */
+  static const std::size_t CATEGORY_BYTES = Page::SIZE / CATEGORIES;
+
+  /**
+   * Constructs an empty map, not yet loaded, for the given data file.
+   *
+   * @param filename  Name of the data file.
+   */
+  explicit FreeSpaceMap(const std::string& filename);
+
+  /**
+   * Returns the name of the file holding the map of the given data file.
+   *
+   * @param filename  Name of the data file.
+   * @return  Name of map file.
+   */
+  static std::string mapFilename(const std::string& filename) {
+    return filename + ".fsm";
+  }
+
+  /**
+   * Returns true once the map has been loaded or reset.
+   */
+  bool isLoaded() const { return loaded_; }
+
+  /**
+   * Reads the map from its file.
+   *
+   * @param num_pages   Number of pages in the data file, header page included.
+   * @return  False if the map file is missing or was written for a different
+   *          number of pages; the map is left unloaded then.
+   */
+  bool load(const PageId num_pages);
+
+  /**
+   * Starts an empty map, in which no page is offered.
+   *
+   * @param num_pages   Number of pages in the data file, header page included.
+   */
+  void reset(const PageId num_pages);
+
+  /**
+   * Writes the map to its file if it has changed since it was last read or
+   * written.
+   */
+  void save();
+
+  /**
+   * Records the free space of a page.
+   *
+   * @param page_number   Number of page.
+   * @param free_space    Bytes free on the page; 0 if it is not in use.
+   */
+  void update(const PageId page_number, const std::size_t free_space);
+
+  /**
+   * Returns a page that has at least the given number of bytes free, going by
+   * the map. Of the pages that qualify, one of the fullest is returned, which
+   * keeps the file dense.
+   *
+   * @param needed  Bytes needed.
+   * @return  Number of page, or Page::INVALID_NUMBER if there is none.
+   */
+  PageId find(const std::size_t needed) const;
+
+ private:
+  /**
+   * Name of the map file.
+   */
+  std::string filename_;
+
+  /**
+   * True once the map has been loaded or reset.
+   */
+  bool loaded_;
+
+  /**
+   * True if the map differs from its file.
+   */
+  bool dirty_;
+
+  /**
+   * Category of every page, by page number.
+   */
+  std::vector<std::uint8_t> categories_;
+
+  /**
+   * Position of every page in the bucket of its category, by page number.
+   */
+  std::vector<std::uint32_t> positions_;
+
+  /**
+   * Pages of each category. Bucket 0 is always empty.
+   */
+  std::vector<PageId> buckets_[CATEGORIES];
+};
+
+}
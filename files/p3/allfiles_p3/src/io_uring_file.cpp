@@ -0,0 +1,392 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "io_uring_file.h"
+
+#include <fcntl.h>
+#include <sched.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "exceptions/file_io_exception.h"
+#include "exceptions/invalid_page_exception.h"
+
+namespace badgerdb {
+
+/**
+ * @brief Minimal io_uring instance, driven through the raw system calls.
+ *
+ * Only what IoUringFile needs: submit a batch of vectored reads or writes,
+ * wait for all of them, and report the result of each.
+ */
+class IoUring {
+ public:
+  /**
+   * Sets up a ring with room for entries requests.
+   *
+   * @return  The ring, or NULL if the kernel does not provide io_uring.
+   */
+  static IoUring* create(const unsigned entries);
+
+  ~IoUring();
+
+  /**
+   * Runs count single-buffer reads or writes and waits for all of them.
+   * Never returns while the kernel still holds one of the requests.
+   *
+   * @param fds       Descriptor for each request.
+   * @param results   Bytes transferred by each request, or -errno; requests
+   *                  left unsubmitted when the ring fails get that errno.
+   */
+  void run(const int* fds, const bool write, const std::size_t count,
+           const off_t* offsets, char* const* buffers, int* results);
+
+ private:
+  IoUring() : ring_fd_(-1), sq_ptr_(MAP_FAILED), cq_ptr_(MAP_FAILED),
+              sqes_(static_cast<io_uring_sqe*>(MAP_FAILED)),
+              sq_size_(0), cq_size_(0), sqes_size_(0) {}
+  IoUring(const IoUring&);
+  IoUring& operator=(const IoUring&);
+
+  int ring_fd_;
+  void* sq_ptr_;
+  void* cq_ptr_;
+  io_uring_sqe* sqes_;
+  std::size_t sq_size_;
+  std::size_t cq_size_;
+  std::size_t sqes_size_;
+
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned sq_mask_;
+  unsigned sq_entries_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned cq_mask_;
+  io_uring_cqe* cqes_;
+};
+
+IoUring* IoUring::create(const unsigned entries) {
+  io_uring_params params;
+  std::memset(&params, 0, sizeof(params));
+  const int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+  if (fd < 0) {
+    return NULL;
+  }
+
+  IoUring* ring = new IoUring();
+  ring->ring_fd_ = fd;
+  ring->sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap) {
+    ring->sq_size_ = ring->cq_size_ = std::max(ring->sq_size_, ring->cq_size_);
+  }
+
+  ring->sq_ptr_ = mmap(NULL, ring->sq_size_, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ptr_ == MAP_FAILED) {
+    delete ring;
+    return NULL;
+  }
+  if (single_mmap) {
+    ring->cq_ptr_ = ring->sq_ptr_;
+  } else {
+    ring->cq_ptr_ = mmap(NULL, ring->cq_size_, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ptr_ == MAP_FAILED) {
+      delete ring;
+      return NULL;
+    }
+  }
+  ring->sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+  ring->sqes_ = static_cast<io_uring_sqe*>(
+      mmap(NULL, ring->sqes_size_, PROT_READ | PROT_WRITE,
+           MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+  if (ring->sqes_ == MAP_FAILED) {
+    delete ring;
+    return NULL;
+  }
+
+  char* sq = static_cast<char*>(ring->sq_ptr_);
+  char* cq = static_cast<char*>(ring->cq_ptr_);
+  ring->sq_head_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  ring->sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  ring->sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  ring->sq_entries_ = params.sq_entries;
+  ring->sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+  ring->cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  ring->cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  ring->cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  ring->cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+  return ring;
+}
+
+IoUring::~IoUring() {
+  if (sqes_ != MAP_FAILED) {
+    munmap(sqes_, sqes_size_);
+  }
+  if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) {
+    munmap(cq_ptr_, cq_size_);
+  }
+  if (sq_ptr_ != MAP_FAILED) {
+    munmap(sq_ptr_, sq_size_);
+  }
+  if (ring_fd_ >= 0) {
+    ::close(ring_fd_);
+  }
+}
+
+void IoUring::run(const int* fds, const bool write, const std::size_t count,
+                  const off_t* offsets, char* const* buffers, int* results) {
+  std::vector<iovec> iovecs(count);
+  std::size_t submitted = 0;
+  std::size_t completed = 0;
+  int error = 0;
+
+  // once the ring fails, stop feeding it but keep reaping: the kernel still
+  // owns the iovecs and buffers of everything it has already taken
+  while (completed < submitted || (error == 0 && submitted < count)) {
+    // fill the submission queue as far as it goes
+    unsigned tail = *sq_tail_;
+    const unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    while (error == 0 && submitted < count && tail - head < sq_entries_ &&
+           submitted - completed < sq_entries_) {
+      iovecs[submitted].iov_base = buffers[submitted];
+      iovecs[submitted].iov_len = Page::SIZE;
+
+      const unsigned index = tail & sq_mask_;
+      io_uring_sqe* sqe = &sqes_[index];
+      std::memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = write ? IORING_OP_WRITEV : IORING_OP_READV;
+      sqe->fd = fds[submitted];
+      sqe->off = offsets[submitted];
+      sqe->addr = reinterpret_cast<unsigned long>(&iovecs[submitted]);
+      sqe->len = 1;
+      sqe->user_data = submitted;
+      sq_array_[index] = index;
+
+      ++tail;
+      ++submitted;
+    }
+    __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+    // hand the queued requests to the kernel and wait for at least one
+    // completion
+    int ret;
+    do {
+      ret = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd_, tail - head,
+                                     1, IORING_ENTER_GETEVENTS, NULL, 0));
+    } while (ret < 0 && errno == EINTR);
+    if (ret < 0 && error == 0) {
+      error = errno;
+      // take back whatever the kernel has not consumed; without SQPOLL it
+      // only reads the queue inside io_uring_enter, so those were never
+      // submitted
+      const unsigned consumed = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+      submitted -= tail - consumed;
+      __atomic_store_n(sq_tail_, consumed, __ATOMIC_RELEASE);
+    }
+
+    unsigned cq_head = *cq_head_;
+    const unsigned cq_tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    const bool reaped = cq_head != cq_tail;
+    while (cq_head != cq_tail) {
+      const io_uring_cqe& cqe = cqes_[cq_head & cq_mask_];
+      results[cqe.user_data] = cqe.res;
+      ++cq_head;
+      ++completed;
+    }
+    __atomic_store_n(cq_head_, cq_head, __ATOMIC_RELEASE);
+    if (ret < 0 && !reaped) {
+      // the kernel still posts completions to the ring even when waiting
+      // on it fails, so poll until the requests in flight are done
+      sched_yield();
+    }
+  }
+
+  // fail only the requests the kernel never saw; the caller finishes those
+  // it can synchronously
+  for (std::size_t i = submitted; i < count; ++i) {
+    results[i] = -error;
+  }
+}
+
+
+
+
+IoUringFile IoUringFile::create(const std::string& filename, const bool direct) {
+  return IoUringFile(filename, true /* create_new */, direct);
+}
+
+IoUringFile IoUringFile::open(const std::string& filename, const bool direct) {
+  return IoUringFile(filename, false /* create_new */, direct);
+}
+
+IoUringFile::IoUringFile(const std::string& name, const bool create_new, const bool direct)
+: File(name, create_new), fd_(-1), direct_(direct), direct_fd_(-1), ring_(NULL) {
+  openDescriptor();
+}
+
+IoUringFile::IoUringFile(const IoUringFile& other)
+: File(other.filename_, false /* create_new */), fd_(-1), direct_(other.direct_),
+  direct_fd_(-1), ring_(NULL) {
+  openDescriptor();
+}
+
+IoUringFile& IoUringFile::operator=(const IoUringFile& rhs) {
+  // This accounts for self-assignment and assignment of a File object for the
+  // same file.
+  close();	//close my file and associate me with the new one
+  closeDescriptor();
+  filename_ = rhs.filename_;
+  direct_ = rhs.direct_;
+  openIfNeeded(false /* create_new */);
+  openDescriptor();
+  return *this;
+}
+
+IoUringFile::~IoUringFile() {
+  // leave the registry before this object is torn down; see withOpenFile()
+  close();
+  closeDescriptor();
+}
+
+void IoUringFile::openDescriptor() {
+  fd_ = ::open(filename_.c_str(), O_RDWR);
+  if (fd_ < 0) {
+    throw FileIOException(Page::INVALID_NUMBER, filename_, errno);
+  }
+  if (direct_) {
+    // not every file system supports O_DIRECT; stay on the page cache if not
+    direct_fd_ = ::open(filename_.c_str(), O_RDWR | O_DIRECT);
+  }
+  ring_ = IoUring::create(QUEUE_DEPTH);
+}
+
+void IoUringFile::closeDescriptor() {
+  delete ring_;
+  ring_ = NULL;
+  if (direct_fd_ >= 0) {
+    ::close(direct_fd_);
+    direct_fd_ = -1;
+  }
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+}
+
+void IoUringFile::allocatePageInto(PageId &new_page_number, Page& new_page) {
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
+  FileHeader header = readHeader();
+  new_page.initialize();
+
+  new_page_number = header.num_pages;
+
+  if (header.first_used_page == Page::INVALID_NUMBER) {
+    header.first_used_page = header.num_pages;
+  }
+
+  ++header.num_pages;
+
+  writePage(new_page_number, new_page);
+  writeHeader(header);
+}
+
+void IoUringFile::readPageInto(const PageId page_number, Page& page) const {
+  Page* pages[1] = {&page};
+  readPages(1, &page_number, pages);
+}
+
+void IoUringFile::writePage(const PageId page_number, const Page& new_page) {
+  const Page* pages[1] = {&new_page};
+  writePages(1, &page_number, pages);
+}
+
+//deletePage is not supported, as for a blob file
+void IoUringFile::deletePage(const PageId page_number) {
+  throw InvalidPageException(page_number, filename_);
+}
+
+void IoUringFile::readPages(const std::size_t count, const PageId* page_numbers,
+                            Page* const* pages) const {
+  std::vector<char*> buffers(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    buffers[i] = reinterpret_cast<char*>(pages[i]);
+  }
+  transfer(false /* write */, count, page_numbers, buffers.data());
+}
+
+void IoUringFile::writePages(const std::size_t count, const PageId* page_numbers,
+                             const Page* const* pages) {
+  std::vector<char*> buffers(count);
+  for (std::size_t i = 0; i < count; ++i) {
+    // only read from by the kernel
+    buffers[i] = const_cast<char*>(reinterpret_cast<const char*>(pages[i]));
+  }
+  transfer(true /* write */, count, page_numbers, buffers.data());
+}
+
+void IoUringFile::transfer(const bool write, const std::size_t count,
+                           const PageId* page_numbers, char* const* buffers) const {
+  if (count == 0) {
+    return;
+  }
+
+  std::vector<off_t> offsets(count);
+  std::vector<int> fds(count);
+  std::vector<int> results(count, 0);
+  for (std::size_t i = 0; i < count; ++i) {
+    offsets[i] = pageOffset(page_numbers[i]);
+    const bool aligned =
+        reinterpret_cast<std::uintptr_t>(buffers[i]) % DIRECT_ALIGNMENT == 0;
+    fds[i] = direct_fd_ >= 0 && aligned ? direct_fd_ : fd_;
+  }
+
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
+  if (ring_ != NULL) {
+    ring_->run(fds.data(), write, count, offsets.data(), buffers, results.data());
+  }
+
+  // finish short or interrupted transfers (and everything, without a ring)
+  // with plain pread/pwrite through the page cache
+  for (std::size_t i = 0; i < count; ++i) {
+    std::size_t done = results[i] > 0 ? results[i] : 0;
+    if (results[i] < 0 && results[i] != -EINTR && results[i] != -EAGAIN) {
+      throw FileIOException(page_numbers[i], filename_, -results[i]);
+    }
+    while (done < Page::SIZE) {
+      const ssize_t n = write
+          ? pwrite(fd_, buffers[i] + done, Page::SIZE - done, offsets[i] + done)
+          : pread(fd_, buffers[i] + done, Page::SIZE - done, offsets[i] + done);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        throw FileIOException(page_numbers[i], filename_, errno);
+      }
+      if (n == 0) {
+        // read past the end of the file
+        throw InvalidPageException(page_numbers[i], filename_);
+      }
+      done += n;
+    }
+  }
+}
+
+}
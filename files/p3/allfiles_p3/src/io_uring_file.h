@@ -0,0 +1,221 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+#include <string>
+
+#include "file.h"
+
+namespace badgerdb {
+
+class IoUring;
+
+/**
+ * @brief File of raw pages, like BlobFile, that does its page I/O with
+ *        pread/pwrite and Linux io_uring instead of the shared stream.
+ *
+ * Batches given to readPages() and writePages() are submitted to the ring
+ * together, keeping up to QUEUE_DEPTH requests in flight, so the buffer
+ * manager can read many pages for prefetch or write many back with a single
+ * wait. Writes are not followed by a flush of any user-space buffer, as
+ * there is none. If the kernel does not provide io_uring, the same calls fall
+ * back to one pread/pwrite per page.
+ *
+ * Page n is stored at offset n * Page::SIZE; the file header occupies the
+ * start of page slot 0. Every page is therefore aligned to its size, but the
+ * layout differs from BlobFile's, so neither class can open the other's files.
+ *
+ * Opened for direct I/O, pages are transferred with O_DIRECT, bypassing the
+ * kernel page cache, whenever the caller's buffer is aligned to
+ * DIRECT_ALIGNMENT (as the frames of a BufMgr with a HUGE_PAGE_POOL are).
+ * Unaligned buffers, and file systems without O_DIRECT, use the page cache.
+ *
+ * Each IoUringFile object has its own descriptors and ring. I/O on the file
+ * is serialized with the other File objects on the same file.
+ */
+class IoUringFile : public File {
+ public:
+  /**
+   * Creates a new file.
+   *
+   * @param filename  Name of the file.
+   * @param direct    Whether to use O_DIRECT for aligned buffers.
+   * @throws  FileExistsException     If the requested file already exists.
+   */
+  static IoUringFile create(const std::string& filename, const bool direct = false);
+
+  /**
+   * Opens the file named fileName and returns the corresponding File object.
+   *
+   * @param filename  Name of the file.
+   * @param direct    Whether to use O_DIRECT for aligned buffers.
+   * @throws  FileNotFoundException   If the requested file doesn't exist.
+   */
+  static IoUringFile open(const std::string& filename, const bool direct = false);
+
+  /**
+   * Constructs a file object representing a file on the filesystem.
+   *
+   * @param name        Name of file.
+   * @param create_new  Whether to create a new file.
+   * @param direct      Whether to use O_DIRECT for aligned buffers.
+   * @throws  FileExistsException     If the underlying file exists and
+   *                                  create_new is true.
+   * @throws  FileNotFoundException   If the underlying file doesn't exist and
+   *                                  create_new is false.
+   */
+  IoUringFile(const std::string& name, const bool create_new, const bool direct = false);
+
+  /**
+   * Copy constructor. The copy gets its own descriptor and ring.
+   *
+   * @param other File object to copy.
+   */
+  IoUringFile(const IoUringFile& other);
+
+  /**
+   * Assignment operator.
+   *
+   * @param rhs File object to assign.
+   * @return    Newly assigned file object.
+   */
+  IoUringFile& operator=(const IoUringFile& rhs);
+
+  /**
+   * Destructor that closes the descriptor and ring, and the underlying file if
+   * no other File objects are using it.
+   */
+  ~IoUringFile();
+
+  /**
+   * Allocates a new page at the end of the file.
+   *
+   * @see File::allocatePageInto()
+   * @throws  FileIOException       If the operating system fails the write.
+   */
+  void allocatePageInto(PageId &new_page_number, Page& new_page);
+
+  /**
+   * Reads an existing page from the file.
+   *
+   * @see File::readPageInto()
+   * @throws  InvalidPageException  If the page doesn't exist in the file.
+   * @throws  FileIOException       If the operating system fails the read.
+   */
+  void readPageInto(const PageId page_number, Page& page) const;
+
+  /**
+   * Writes a page into the file at the given page number.
+   * No bounds checking is performed.
+   *
+   * @param page_number Number of page whose contents to replace.
+   * @param new_page    Page to write.
+   * @throws  FileIOException       If the operating system fails the write.
+   */
+  void writePage(const PageId page_number, const Page& new_page);
+
+  /**
+   * Deletes a page from the file. Not supported, as for BlobFile.
+   *
+   * @param page_number   Number of page to delete.
+   * @throws  InvalidPageException  Always.
+   */
+  void deletePage(const PageId page_number);
+
+  /**
+   * Reads several existing pages, all in flight at once.
+   *
+   * @see File::readPages()
+   * @throws  InvalidPageException  If one of the pages doesn't exist in the file.
+   * @throws  FileIOException       If the operating system fails a read.
+   */
+  void readPages(const std::size_t count, const PageId* page_numbers,
+                 Page* const* pages) const;
+
+  /**
+   * Writes several pages, all in flight at once.
+   *
+   * @see File::writePages()
+   * @throws  FileIOException       If the operating system fails a write.
+   */
+  void writePages(const std::size_t count, const PageId* page_numbers,
+                  const Page* const* pages);
+
+  /**
+   * Returns true if I/O goes through io_uring, false if it fell back to
+   * pread/pwrite.
+   */
+  bool usesIoUring() const { return ring_ != NULL; }
+
+  /**
+   * Returns true if aligned buffers are transferred with O_DIRECT.
+   */
+  bool usesDirectIO() const { return direct_fd_ >= 0; }
+
+  /**
+   * Most requests kept in flight on the ring.
+   */
+  static const unsigned QUEUE_DEPTH = 64;
+
+  /**
+   * Alignment a buffer needs for O_DIRECT transfers.
+   */
+  static const std::size_t DIRECT_ALIGNMENT = 4096;
+
+ private:
+  /**
+   * Opens the descriptor and sets up the ring for filename_.
+   */
+  void openDescriptor();
+
+  /**
+   * Tears down the ring and closes the descriptor.
+   */
+  void closeDescriptor();
+
+  /**
+   * Reads or writes whole pages, completing short transfers synchronously.
+   *
+   * @param write         True to write, false to read.
+   * @param count         Number of pages.
+   * @param page_numbers  Numbers of the pages.
+   * @param buffers       Page-sized buffers, one per page.
+   */
+  void transfer(const bool write, const std::size_t count,
+                const PageId* page_numbers, char* const* buffers) const;
+
+  /**
+   * Returns the offset of the page with the given number in the file.
+   */
+  static off_t pageOffset(const PageId page_number) {
+    return static_cast<off_t>(page_number) * Page::SIZE;
+  }
+
+  /**
+   * Descriptor of the file.
+   */
+  int fd_;
+
+  /**
+   * Whether direct I/O was asked for.
+   */
+  bool direct_;
+
+  /**
+   * O_DIRECT descriptor of the file, or -1.
+   */
+  int direct_fd_;
+
+  /**
+   * Ring used for page I/O, or NULL to use pread/pwrite.
+   */
+  IoUring* ring_;
+};
+
+}
@@ -0,0 +1,69 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+
+namespace badgerdb {
+
+/**
+ * @brief Lightweight exclusive latch on a buffer frame.
+ *
+ * Latches are held for short critical sections only (a frame being loaded,
+ * written back or evicted), so waiters spin and yield instead of sleeping.
+ * They protect the frame's state in the buffer manager, not the contents of
+ * the page it holds: callers that share a pinned page coordinate their own
+ * access to it, as BTreeIndex does. The latch is not recursive and has no
+ * fairness guarantees.
+ */
+class FrameLatch {
+ public:
+  /**
+   * Constructs an unlatched latch.
+   */
+  FrameLatch() : held_(false) {}
+
+  /**
+   * Acquires the latch, waiting for the current holder to release it.
+   */
+  void lock() {
+    while (!tryLock()) {
+      std::this_thread::yield();
+    }
+  }
+
+  /**
+   * Tries to acquire the latch.
+   *
+   * @return  True if the latch was acquired.
+   */
+  bool tryLock() {
+    bool expected = false;
+    return held_.compare_exchange_strong(expected, true,
+                                         std::memory_order_acquire);
+  }
+
+  /**
+   * Releases the latch.
+   */
+  void unlock() {
+    held_.store(false, std::memory_order_release);
+  }
+
+ private:
+  /**
+   * Whether the latch is currently held.
+   */
+  std::atomic<bool> held_;
+
+  FrameLatch(const FrameLatch&);
+  FrameLatch& operator=(const FrameLatch&);
+};
+
+}
@@ -5,12 +5,18 @@
  * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
  */
 
+#include <fstream>
+#include <map>
+#include <mutex>
 #include <vector>
 #include "btree.h"
 #include "page.h"
 #include "filescan.h"
 #include "page_iterator.h"
 #include "file_iterator.h"
+#include "replacementPolicy.h"
+#include "free_space_map.h"
+#include "mmap_page_file.h"
 #include "exceptions/insufficient_space_exception.h"
 #include "exceptions/index_scan_completed_exception.h"
 #include "exceptions/file_not_found_exception.h"
@@ -19,6 +25,9 @@
 #include "exceptions/bad_opcodes_exception.h"
 #include "exceptions/scan_not_initialized_exception.h"
 #include "exceptions/end_of_file_exception.h"
+#include "exceptions/bad_file_format_exception.h"
+#include "exceptions/invalid_record_length_exception.h"
+#include "exceptions/invalid_record_exception.h"
 
 #define checkPassFail(a, b) 																				\
 {																																		\
@@ -60,6 +69,13 @@ std::string dbRecord1;
 
 BufMgr * bufMgr = new BufMgr(100);
 
+// Trace of the pages requested from bufMgr, written when the driver is given a
+// file name: one line per request with the file, numbered in order of first
+// use, and the page number. The policies benchmark replays it.
+std::ofstream traceOut;
+std::map<std::string, int> traceFiles;
+std::mutex traceLatch;
+
 // -----------------------------------------------------------------------------
 // Forward declarations
 // -----------------------------------------------------------------------------
@@ -72,6 +88,13 @@ void createRelationForward_size(int size);
 void createRelationForward_range(int start, int end);
 void intTests();
 int intScan(BTreeIndex *index, int lowVal, Operator lowOp, int highVal, Operator highOp);
+void cursorTests();
+int cursorScan(IndexCursor *cursor, int lowVal, Operator lowOp, int highVal, Operator highOp, bool rewind);
+void doubleTests();
+int doubleScan(BTreeIndex *index, double lowVal, Operator lowOp, double highVal, Operator highOp);
+void stringTests();
+int stringScan(BTreeIndex *index, int lowVal, Operator lowOp, int highVal, Operator highOp);
+int printRecordsFound(BTreeIndex *index);
 void indexTests();
 void test1();
 void test2();
@@ -81,14 +104,27 @@ void test5();
 void test6();
 void test7();
 void test8();
+void test9();
+void test10();
+void test11();
+void test12();
+void test13();
+void test14();
+void test15();
 
 
 void errorTests();
 void deleteRelation();
+void tracePage(const File* file, const PageId pageNo);
 
 int main(int argc, char **argv)
 {
-	
+  if (argc > 1)
+  {
+    traceOut.open(argv[1]);
+    bufMgr->setTraceHook(tracePage);
+  }
+
   std::cout << "leaf size:" << INTARRAYLEAFSIZE << " non-leaf size:" << INTARRAYNONLEAFSIZE << std::endl;
 
   // Clean up from any previous runs that crashed.
@@ -156,6 +192,13 @@ int main(int argc, char **argv)
     test6();
     test7();
     test8();
+    test9();
+    test10();
+    test11();
+    test12();
+    test13();
+    test14();
+    test15();
   return 1;
 }
 
@@ -214,6 +257,7 @@ void createRelationForward()
   memset(record1.s, ' ', sizeof(record1.s));
 	PageId new_page_number;
   Page new_page = file1->allocatePage(new_page_number);
+  new_page.formatFixedLength(sizeof(RECORD));
 
   // Insert a bunch of tuples into the relation.
   for(int i = 0; i < relationSize; i++ )
@@ -234,6 +278,7 @@ void createRelationForward()
 			{
 				file1->writePage(new_page_number, new_page);
   			new_page = file1->allocatePage(new_page_number);
+  			new_page.formatFixedLength(sizeof(RECORD));
 			}
 		}
   }
@@ -261,6 +306,7 @@ void createRelationBackward()
   memset(record1.s, ' ', sizeof(record1.s));
 	PageId new_page_number;
   Page new_page = file1->allocatePage(new_page_number);
+  new_page.formatFixedLength(sizeof(RECORD));
 
   // Insert a bunch of tuples into the relation.
   for(int i = relationSize - 1; i >= 0; i-- )
@@ -282,6 +328,7 @@ void createRelationBackward()
 			{
 				file1->writePage(new_page_number, new_page);
   			new_page = file1->allocatePage(new_page_number);
+  			new_page.formatFixedLength(sizeof(RECORD));
 			}
 		}
   }
@@ -309,6 +356,7 @@ void createRelationRandom()
   memset(record1.s, ' ', sizeof(record1.s));
 	PageId new_page_number;
   Page new_page = file1->allocatePage(new_page_number);
+  new_page.formatFixedLength(sizeof(RECORD));
 
   // insert records in random order
 
@@ -342,6 +390,7 @@ void createRelationRandom()
 			{
       	file1->writePage(new_page_number, new_page);
   			new_page = file1->allocatePage(new_page_number);
+  			new_page.formatFixedLength(sizeof(RECORD));
 			}
 		}
 
@@ -377,17 +426,135 @@ void intTests()
 
 int intScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operator highOp)
 {
+  std::cout << "Scan for ";
+  if( lowOp == GT ) { std::cout << "("; } else { std::cout << "["; }
+  std::cout << lowVal << "," << highVal;
+  if( highOp == LT ) { std::cout << ")"; } else { std::cout << "]"; }
+  std::cout << std::endl;
+
+	try
+	{
+  	index->startScan(&lowVal, lowOp, &highVal, highOp);
+	}
+	catch(const NoSuchKeyFoundException &e)
+	{
+    std::cout << "No Key Found satisfying the scan criteria." << std::endl;
+		return 0;
+	}
+
+	return printRecordsFound(index);
+}
+
+// -----------------------------------------------------------------------------
+// cursorTests
+// -----------------------------------------------------------------------------
+
+void cursorTests()
+{
+  std::cout << "Scan the integer B+ Tree index with cursors" << std::endl;
+  BTreeIndex index(relationName, intIndexName, bufMgr, offsetof(tuple,i), INTEGER);
+  IndexCursor cursor1(&index), cursor2(&index);
+
+	// interleave two cursors and the scan of the index
+	int lowVal1 = 25, highVal1 = 40, lowVal2 = 20, highVal2 = 35;
+	cursor1.startScan(&lowVal1, GT, &highVal1, LT);
+	cursor2.startScan(&lowVal2, GTE, &highVal2, LTE);
+	index.startScan(&lowVal2, GTE, &highVal1, LT);
+	RecordId rid1, rid2, rid3;
+	int count1 = 0, count2 = 0, count3 = 0;
+	while(true)
+	{
+		bool found1 = cursor1.next(rid1), found2 = cursor2.next(rid2), found3 = index.next(rid3);
+		count1 += found1, count2 += found2, count3 += found3;
+		if(!found1 and !found2 and !found3) break;
+	}
+	cursor1.endScan();
+	cursor2.endScan();
+	index.endScan();
+	checkPassFail(count1, 14)
+	checkPassFail(count2, 16)
+	checkPassFail(count3, 20)
+
+	// rewind with new bounds, ahead of and behind the last leaf read
+	checkPassFail(cursorScan(&cursor1,300,GT,400,LT,true), 99)
+	checkPassFail(cursorScan(&cursor1,350,GTE,360,LTE,true), 11)
+	checkPassFail(cursorScan(&cursor1,3000,GTE,4000,LT,true), 1000)
+	checkPassFail(cursorScan(&cursor1,-3,GT,3,LT,true), 3)
+	checkPassFail(cursorScan(&cursor1,0,GT,1,LT,true), 0)
+
+	// inner loop of an index nested loop join over ascending keys
+	int matches = 0;
+	for(int key = 0; key < relationSize; key += 7)
+	{
+		try
+		{
+			cursor2.rewind(&key, GTE, &key, LTE);
+		}
+		catch(const NoSuchKeyFoundException &e)
+		{
+			continue;
+		}
+		while(cursor2.next(rid2)) matches++;
+		cursor2.endScan();
+	}
+	checkPassFail(matches, (relationSize + 6) / 7)
+}
+
+int cursorScan(IndexCursor * cursor, int lowVal, Operator lowOp, int highVal, Operator highOp, bool rewind)
+{
+  std::cout << "Cursor scan for ";
+  if( lowOp == GT ) { std::cout << "("; } else { std::cout << "["; }
+  std::cout << lowVal << "," << highVal;
+  if( highOp == LT ) { std::cout << ")"; } else { std::cout << "]"; }
+  std::cout << std::endl;
+
+	try
+	{
+		if(rewind) cursor->rewind(&lowVal, lowOp, &highVal, highOp);
+		else cursor->startScan(&lowVal, lowOp, &highVal, highOp);
+	}
+	catch(const NoSuchKeyFoundException &e)
+	{
+    std::cout << "No Key Found satisfying the scan criteria." << std::endl;
+		return 0;
+	}
+
   RecordId scanRid;
-	Page *curPage;
+  int numResults = 0;
+	while(cursor->next(scanRid)) numResults++;
+  cursor->endScan();
+
+	return numResults;
+}
+
+// -----------------------------------------------------------------------------
+// doubleTests
+// -----------------------------------------------------------------------------
 
+void doubleTests()
+{
+  std::cout << "Create a B+ Tree index on the double field" << std::endl;
+  BTreeIndex index(relationName, doubleIndexName, bufMgr, offsetof(tuple,d), DOUBLE);
+
+	// run some tests
+	checkPassFail(doubleScan(&index,25,GT,40,LT), 14)
+	checkPassFail(doubleScan(&index,20,GTE,35,LTE), 16)
+	checkPassFail(doubleScan(&index,-3,GT,3,LT), 3)
+	checkPassFail(doubleScan(&index,996,GT,1001,LT), 4)
+	checkPassFail(doubleScan(&index,0,GT,1,LT), 0)
+	checkPassFail(doubleScan(&index,300,GT,400,LT), 99)
+	checkPassFail(doubleScan(&index,3000,GTE,4000,LT), 1000)
+	checkPassFail(doubleScan(&index,24.5,GT,26.5,LT), 2)
+}
+
+int doubleScan(BTreeIndex * index, double lowVal, Operator lowOp, double highVal, Operator highOp)
+{
   std::cout << "Scan for ";
   if( lowOp == GT ) { std::cout << "("; } else { std::cout << "["; }
   std::cout << lowVal << "," << highVal;
   if( highOp == LT ) { std::cout << ")"; } else { std::cout << "]"; }
   std::cout << std::endl;
 
-  int numResults = 0;
-	
 	try
 	{
   	index->startScan(&lowVal, lowOp, &highVal, highOp);
@@ -398,6 +565,65 @@ int intScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operato
 		return 0;
 	}
 
+	return printRecordsFound(index);
+}
+
+// -----------------------------------------------------------------------------
+// stringTests
+// -----------------------------------------------------------------------------
+
+void stringTests()
+{
+  std::cout << "Create a B+ Tree index on the string field" << std::endl;
+  BTreeIndex index(relationName, stringIndexName, bufMgr, offsetof(tuple,s), STRING);
+
+	// run some tests
+	checkPassFail(stringScan(&index,25,GT,40,LT), 14)
+	checkPassFail(stringScan(&index,20,GTE,35,LTE), 16)
+	checkPassFail(stringScan(&index,-3,GT,3,LT), 3)
+	checkPassFail(stringScan(&index,996,GT,1001,LT), 4)
+	checkPassFail(stringScan(&index,0,GT,1,LT), 0)
+	checkPassFail(stringScan(&index,300,GT,400,LT), 99)
+	checkPassFail(stringScan(&index,3000,GTE,4000,LT), 1000)
+}
+
+int stringScan(BTreeIndex * index, int lowVal, Operator lowOp, int highVal, Operator highOp)
+{
+  char lowValStr[100];
+  sprintf(lowValStr,"%05d string record",lowVal);
+  char highValStr[100];
+  sprintf(highValStr,"%05d string record",highVal);
+
+  std::cout << "Scan for ";
+  if( lowOp == GT ) { std::cout << "("; } else { std::cout << "["; }
+  std::cout << lowValStr << "," << highValStr;
+  if( highOp == LT ) { std::cout << ")"; } else { std::cout << "]"; }
+  std::cout << std::endl;
+
+	try
+	{
+  	index->startScan(lowValStr, lowOp, highValStr, highOp);
+	}
+	catch(const NoSuchKeyFoundException &e)
+	{
+    std::cout << "No Key Found satisfying the scan criteria." << std::endl;
+		return 0;
+	}
+
+	return printRecordsFound(index);
+}
+
+// -----------------------------------------------------------------------------
+// printRecordsFound
+// -----------------------------------------------------------------------------
+
+int printRecordsFound(BTreeIndex * index)
+{
+  RecordId scanRid;
+	Page *curPage;
+
+  int numResults = 0;
+
 	while(1)
 	{
 		try
@@ -444,11 +670,28 @@ void indexTests()
     if(testNum == 1)
     {
         intTests();
+        cursorTests();
         try
         {
             File::remove(intIndexName);
         }
-        catch(FileNotFoundException e)
+        catch(const FileNotFoundException &e)
+        {
+        }
+        doubleTests();
+        try
+        {
+            File::remove(doubleIndexName);
+        }
+        catch(const FileNotFoundException &e)
+        {
+        }
+        stringTests();
+        try
+        {
+            File::remove(stringIndexName);
+        }
+        catch(const FileNotFoundException &e)
         {
         }
     }
@@ -748,6 +991,561 @@ void negativeval_test()
     checkPassFail(intScan(&index,3000,GTE,4000,LT), 0)
     
 }
+
+// test upgrade of a file written in the original format: a 16 byte file
+// header, and pages whose slots each keep a used flag
+void upgrade_test()
+{
+    struct BaselineFileHeader { PageId num_pages, first_used_page, num_free_pages, first_free_page; };
+    struct BaselinePageHeader { std::uint16_t lower, upper; SlotId num_slots, num_free_slots; PageId current_page_number, next_page_number; };
+    struct BaselineSlot { bool used; std::uint16_t item_offset, item_length; };
+    const std::string upgradeName = "upgrade.0";
+    const int dataSize = Page::SIZE - sizeof(BaselinePageHeader);
+
+    // pages 1 and 3 are used, page 2 was deleted; the middle slot of page 3 is empty
+    std::vector<std::vector<std::string> > records = {{"first page"}, {}, {"third page, slot 1", "", "third page, slot 3"}};
+    std::vector<char> bytes(sizeof(BaselineFileHeader) + records.size() * Page::SIZE, 0);
+    BaselineFileHeader fileHeader = {4, 1, 1, 2};
+    memcpy(&bytes[0], &fileHeader, sizeof(fileHeader));
+    for(PageId pageNo = 1; pageNo <= records.size(); pageNo++)
+    {
+        char* page = &bytes[sizeof(BaselineFileHeader) + (pageNo - 1) * Page::SIZE];
+        char* data = page + sizeof(BaselinePageHeader);
+        const std::vector<std::string>& pageRecords = records[pageNo - 1];
+        BaselinePageHeader pageHeader = {0, (std::uint16_t)dataSize, (SlotId)pageRecords.size(), 0, pageNo == 2 ? Page::INVALID_NUMBER : pageNo, pageNo == 1 ? 3u : 0u};
+        int end = dataSize;
+        for(std::size_t i = 0; i < pageRecords.size(); i++)
+        {
+            BaselineSlot slot = {!pageRecords[i].empty(), 0, (std::uint16_t)pageRecords[i].size()};
+            if(slot.used)
+            {
+                end -= pageRecords[i].size();
+                slot.item_offset = end;
+                memcpy(data + end, pageRecords[i].data(), pageRecords[i].size());
+            }
+            else
+            {
+                pageHeader.num_free_slots++;
+            }
+            memcpy(data + i * sizeof(BaselineSlot), &slot, sizeof(slot));
+        }
+        pageHeader.lower = pageRecords.size() * sizeof(BaselineSlot);
+        pageHeader.upper = end;
+        memcpy(page, &pageHeader, sizeof(pageHeader));
+    }
+
+    // a copy whose used list leads past the end of the file is refused
+    std::vector<char> damaged(bytes);
+    BaselinePageHeader* damagedHeader = (BaselinePageHeader*)&damaged[sizeof(BaselineFileHeader)];
+    damagedHeader->next_page_number = 77;
+    std::ofstream(upgradeName, std::ios::binary).write(&damaged[0], damaged.size());
+    int refused = 0;
+    try
+    {
+        PageFile file = PageFile::open(upgradeName);
+    }
+    catch(const BadFileFormatException &e)
+    {
+        refused = 1;
+    }
+    checkPassFail(refused, 1)
+    File::remove(upgradeName);
+
+    std::ofstream(upgradeName, std::ios::binary).write(&bytes[0], bytes.size());
+    {
+        PageFile file = PageFile::open(upgradeName);
+        std::string found;
+        int numRecords = 0;
+        for(FileIterator iter = file.begin(); iter != file.end(); ++iter)
+        {
+            Page page = *iter;
+            found += std::to_string(page.page_number()) + ":";
+            for(PageIterator pageIter = page.begin(); pageIter != page.end(); ++pageIter)
+            {
+                found += *pageIter + ";";
+                numRecords++;
+            }
+        }
+        checkPassFail(numRecords, 3)
+        checkPassFail(found, std::string("1:first page;3:third page, slot 1;third page, slot 3;"))
+
+        // the deleted page is reused, and new pages go after the last used page
+        PageId pageNo;
+        file.allocatePage(pageNo);
+        checkPassFail(pageNo, 2)
+        file.allocatePage(pageNo);
+        checkPassFail(pageNo, 4)
+        file.deletePage(3);
+        found.clear();
+        for(FileIterator iter = file.begin(); iter != file.end(); ++iter)
+        {
+            found += std::to_string((*iter).page_number()) + " ";
+        }
+        checkPassFail(found, std::string("1 2 4 "))
+    }
+    File::remove(upgradeName);
+}
+// test a page of fixed-length records used directly: inserts until full,
+// deletes, iteration, slot reuse and records of the wrong length
+void fixedlength_test()
+{
+    Page page;
+    page.formatFixedLength(sizeof(RECORD));
+    checkPassFail(page.isFixedLength(), true)
+    checkPassFail(page.record_length(), (int)sizeof(RECORD))
+
+    std::vector<RecordId> rids;
+    int full = 0;
+    while(!full)
+    {
+        record1.i = rids.size();
+        std::string data(reinterpret_cast<char*>(&record1), sizeof(record1));
+        try
+        {
+            rids.push_back(page.insertRecord(data));
+        }
+        catch(const InsufficientSpaceException &e)
+        {
+            full = 1;
+        }
+    }
+    const int capacity = rids.size();
+    checkPassFail((capacity > 1), true)
+    checkPassFail(page.getFreeSpace(), 0)
+
+    // delete every other record; the rest still iterate in slot order
+    int deleted = 0;
+    for(int i = 0; i < capacity; i += 2)
+    {
+        page.deleteRecord(rids[i]);
+        deleted++;
+    }
+    checkPassFail(page.getFreeSpace(), deleted * (int)sizeof(RECORD))
+    int found = 0;
+    int inOrder = 1;
+    for(PageIterator iter = page.begin(); iter != page.end(); ++iter)
+    {
+        const std::string data = *iter;
+        const RECORD* record = reinterpret_cast<const RECORD*>(data.data());
+        if(record->i != 2 * found + 1)
+            inOrder = 0;
+        found++;
+    }
+    checkPassFail(found, capacity - deleted)
+    checkPassFail(inOrder, 1)
+    record1.i = 1;
+    checkPassFail(page.getRecord(rids[1]), std::string(reinterpret_cast<char*>(&record1), sizeof(record1)))
+
+    // the freed slots are taken again before the page counts as full
+    int reused = 0;
+    for(int i = 0; i < deleted; i++)
+    {
+        record1.i = capacity + i;
+        std::string data(reinterpret_cast<char*>(&record1), sizeof(record1));
+        if(page.insertRecord(data).slot_number % 2 == 1)
+            reused++;
+    }
+    checkPassFail(reused, deleted)
+    checkPassFail(page.getFreeSpace(), 0)
+
+    // a record of any other length is refused, and the page is unchanged
+    page.deleteRecord(rids[0]);
+    int refused = 0;
+    try
+    {
+        page.insertRecord(std::string(sizeof(RECORD) - 1, 'x'));
+    }
+    catch(const InvalidRecordLengthException &e)
+    {
+        refused++;
+    }
+    try
+    {
+        page.updateRecord(rids[1], std::string(sizeof(RECORD) + 1, 'x'));
+    }
+    catch(const InvalidRecordLengthException &e)
+    {
+        refused++;
+    }
+    checkPassFail(refused, 2)
+    checkPassFail(page.getFreeSpace(), (int)sizeof(RECORD))
+    record1.i = 1;
+    checkPassFail(page.getRecord(rids[1]), std::string(reinterpret_cast<char*>(&record1), sizeof(record1)))
+}
+
+// test upgrade of a version 2 file, whose page headers may hold garbage where
+// the record length now is
+void versiontwo_upgrade_test()
+{
+    const std::string upgradeName = "upgrade.0";
+    try
+    {
+        File::remove(upgradeName);
+    }
+    catch(const FileNotFoundException &e)
+    {
+    }
+    {
+        PageFile file = PageFile::create(upgradeName);
+        for(int i = 0; i < 3; i++)
+        {
+            PageId pageNo;
+            Page page = file.allocatePage(pageNo);
+            page.insertRecord("record on page " + std::to_string(pageNo));
+            file.writePage(pageNo, page);
+        }
+    }
+
+    std::fstream stream(upgradeName, std::ios::in | std::ios::out | std::ios::binary);
+    const std::uint32_t version = 0x42440002;
+    stream.seekp(offsetof(FileHeader, format_version));
+    stream.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    const std::uint16_t garbage = 0xbeef;
+    for(PageId pageNo = 1; pageNo <= 3; pageNo++)
+    {
+        stream.seekp(sizeof(FileHeader) + (pageNo - 1) * Page::SIZE + offsetof(PageHeader, record_length));
+        stream.write(reinterpret_cast<const char*>(&garbage), sizeof(garbage));
+    }
+    stream.close();
+
+    {
+        PageFile file = PageFile::open(upgradeName);
+        std::string found;
+        int fixedLength = 0;
+        for(FileIterator iter = file.begin(); iter != file.end(); ++iter)
+        {
+            Page page = *iter;
+            if(page.isFixedLength())
+                fixedLength++;
+            for(PageIterator pageIter = page.begin(); pageIter != page.end(); ++pageIter)
+                found += *pageIter + ";";
+        }
+        checkPassFail(fixedLength, 0)
+        checkPassFail(found, std::string("record on page 1;record on page 2;record on page 3;"))
+    }
+    File::remove(upgradeName);
+}
+// number of used pages in a file
+int countPages(PageFile& file)
+{
+    int numPages = 0;
+    for(FileIterator iter = file.begin(); iter != file.end(); ++iter)
+        numPages++;
+    return numPages;
+}
+
+// test the free space map behind PageFile::insertRecord: space freed by
+// deleteRecord is reused before the file grows, and the map is kept in its
+// sidecar file across reopening
+void freespace_test()
+{
+    const std::string spaceName = "freespace.0";
+    const std::string mapName = FreeSpaceMap::mapFilename(spaceName);
+    try
+    {
+        File::remove(spaceName);
+    }
+    catch(const FileNotFoundException &e)
+    {
+    }
+
+    const int numRecords = 400;
+    int densePages;
+    {
+        PageFile file = PageFile::create(spaceName);
+        std::vector<RecordId> rids;
+        for(int i = 0; i < numRecords; i++)
+            rids.push_back(file.insertRecord(std::string(100 + (i * 37) % 300, 'a' + i % 26)));
+        densePages = countPages(file);
+        checkPassFail((densePages > 1), true)
+
+        // delete every other record and insert smaller ones in their place;
+        // they all land on the existing pages
+        for(int i = 0; i < numRecords; i += 2)
+            file.deleteRecord(rids[i]);
+        int reused = 0;
+        for(int i = 0; i < numRecords; i += 2)
+        {
+            const RecordId newRid = file.insertRecord(std::string(50 + (i * 37) % 150, 'A' + i % 26));
+            if(newRid.page_number <= (PageId)densePages)
+                reused++;
+        }
+        checkPassFail(reused, numRecords / 2)
+        checkPassFail(countPages(file), densePages)
+
+        int found = 0;
+        for(FileIterator iter = file.begin(); iter != file.end(); ++iter)
+        {
+            Page page = *iter;
+            for(PageIterator pageIter = page.begin(); pageIter != page.end(); ++pageIter)
+                found++;
+        }
+        checkPassFail(found, numRecords)
+    }
+
+    // the sidecar holds a category for every page of the file, header included
+    FileHeader header;
+    std::ifstream(spaceName, std::ios::binary).read(reinterpret_cast<char*>(&header), sizeof(header));
+    std::ifstream mapIn(mapName, std::ios::binary | std::ios::ate);
+    checkPassFail(mapIn.good(), true)
+    checkPassFail((int)mapIn.tellg(), (int)header.num_pages)
+    mapIn.close();
+
+    // reopened, the file still has room for a small record
+    {
+        PageFile file = PageFile::open(spaceName);
+        file.insertRecord("small record");
+        checkPassFail(countPages(file), densePages)
+    }
+
+    // a map that offers no page is believed, so it must be the one read
+    const std::streamoff mapSize = header.num_pages;
+    std::ofstream(mapName, std::ios::binary | std::ios::trunc).write(std::string(mapSize, '\0').data(), mapSize);
+    {
+        PageFile file = PageFile::open(spaceName);
+        file.insertRecord("small record");
+        checkPassFail(countPages(file), densePages + 1)
+    }
+
+    // one written for a different number of pages is rebuilt from the pages
+    std::ofstream(mapName, std::ios::binary | std::ios::trunc).write("\0", 1);
+    {
+        PageFile file = PageFile::open(spaceName);
+        file.insertRecord("small record");
+        checkPassFail(countPages(file), densePages + 1)
+    }
+
+    File::remove(spaceName);
+    checkPassFail(std::ifstream(mapName).good(), false)
+}
+// 1 if the records on a page, in slot order, are exactly the non-empty entries
+// of records (indexed by slot number), read the same way as copies and views
+int matchesSlots(Page& page, const std::vector<std::string>& records)
+{
+    std::string expected, found;
+    for(std::size_t slot = 1; slot < records.size(); slot++)
+    {
+        if(!records[slot].empty())
+            expected += std::to_string(slot) + ":" + records[slot] + ";";
+    }
+    for(PageIterator iter = page.begin(); iter != page.end(); ++iter)
+    {
+        const RecordId current = iter.getCurrentRecord();
+        const std::string record = page.getRecord(current);
+        if(*iter != record || iter.getRecordView().str() != record || page.getRecordView(current).str() != record)
+            return 0;
+        found += std::to_string(current.slot_number) + ":" + record + ";";
+    }
+    return expected == found;
+}
+
+// test the slot directory of a page past its first occupancy words: slots
+// freed by deleteRecord are taken again lowest first, on either side of the
+// boundaries between groups of 64, and the directory shrinks and regrows
+// across them
+void slot_test()
+{
+    Page page;
+    const int numSlots = 200;
+    std::vector<std::string> records(numSlots + 1);
+    int inOrder = 1;
+    for(int slot = 1; slot <= numSlots; slot++)
+    {
+        records[slot] = "record " + std::to_string(slot);
+        if(page.insertRecord(records[slot]).slot_number != slot)
+            inOrder = 0;
+    }
+    checkPassFail(inOrder, 1)
+    checkPassFail(matchesSlots(page, records), 1)
+
+    // the slots at the ends of the first groups, and one inside the first
+    const SlotId freed[] = {10, 64, 65, 128, 129};
+    for(int i = 0; i < 5; i++)
+    {
+        page.deleteRecord({page.page_number(), freed[i]});
+        records[freed[i]].clear();
+    }
+    int missing = 0;
+    for(int i = 0; i < 5; i++)
+    {
+        try
+        {
+            page.getRecord({page.page_number(), freed[i]});
+        }
+        catch(const InvalidRecordException &e)
+        {
+            missing++;
+        }
+    }
+    checkPassFail(missing, 5)
+    checkPassFail(matchesSlots(page, records), 1)
+
+    // inserted again in slot order, from views of bytes that are not strings
+    std::string reused;
+    for(int i = 0; i < 5; i++)
+    {
+        char bytes[16];
+        const int length = snprintf(bytes, sizeof(bytes), "reused %d", i);
+        const SlotId slot = page.insertRecord(RecordView(bytes, length)).slot_number;
+        reused += std::to_string(slot) + " ";
+        records[slot] = bytes;
+    }
+    checkPassFail(reused, std::string("10 64 65 128 129 "))
+    checkPassFail(matchesSlots(page, records), 1)
+
+    // updates through a view keep the slot
+    const RecordId boundary = {page.page_number(), 65};
+    records[65] = "updated across the group boundary";
+    page.updateRecord(boundary, RecordView(records[65]));
+    checkPassFail(page.getRecord(boundary), records[65])
+    checkPassFail(matchesSlots(page, records), 1)
+
+    // deleting the tail of the directory trims it back into the second group,
+    // and the third group starts empty when it is reached again
+    for(int slot = numSlots; slot > 128; slot--)
+    {
+        page.deleteRecord({page.page_number(), (SlotId)slot});
+        records[slot].clear();
+    }
+    reused.clear();
+    for(int i = 0; i < 2; i++)
+    {
+        const std::string record = "regrown " + std::to_string(i);
+        const SlotId slot = page.insertRecord(record).slot_number;
+        reused += std::to_string(slot) + " ";
+        records[slot] = record;
+    }
+    checkPassFail(reused, std::string("129 130 "))
+    checkPassFail(matchesSlots(page, records), 1)
+
+    // the same on a page of fixed-length records, whose slots are never trimmed
+    Page fixedPage;
+    fixedPage.formatFixedLength(8);
+    std::vector<std::string> fixedRecords(1);
+    int full = 0;
+    while(!full)
+    {
+        char bytes[16];
+        snprintf(bytes, sizeof(bytes), "%08d", (int)fixedRecords.size());
+        try
+        {
+            fixedPage.insertRecord(RecordView(bytes, 8));
+            fixedRecords.push_back(bytes);
+        }
+        catch(const InsufficientSpaceException &e)
+        {
+            full = 1;
+        }
+    }
+    checkPassFail((fixedRecords.size() > 130), true)
+    for(int i = 0; i < 5; i++)
+    {
+        fixedPage.deleteRecord({fixedPage.page_number(), freed[5 - 1 - i]});
+        fixedRecords[freed[5 - 1 - i]].clear();
+    }
+    checkPassFail(matchesSlots(fixedPage, fixedRecords), 1)
+    reused.clear();
+    for(int i = 0; i < 5; i++)
+    {
+        const std::string record = "reused " + std::to_string(i);
+        const SlotId slot = fixedPage.insertRecord(record).slot_number;
+        reused += std::to_string(slot) + " ";
+        fixedRecords[slot] = record;
+    }
+    checkPassFail(reused, std::string("10 64 65 128 129 "))
+    checkPassFail(matchesSlots(fixedPage, fixedRecords), 1)
+}
+// test that space reserved for pages in extents leaves the length of the file
+// alone, so that it ends with its last page and maps as it is
+void extent_test()
+{
+    const std::string extentName = "extent.0";
+    try
+    {
+        File::remove(extentName);
+    }
+    catch(const FileNotFoundException &e)
+    {
+    }
+
+    const int numPages = PageFile::EXTENT_PAGES + 6;
+    {
+        PageFile file = PageFile::create(extentName);
+        for(int i = 0; i < numPages; i++)
+        {
+            PageId pageNo;
+            Page page = file.allocatePage(pageNo);
+            page.insertRecord("record on page " + std::to_string(pageNo));
+            file.writePage(pageNo, page);
+        }
+    }
+    std::ifstream in(extentName, std::ios::binary | std::ios::ate);
+    checkPassFail((long)in.tellg(), (long)(sizeof(FileHeader) + numPages * Page::SIZE))
+    in.close();
+
+    {
+        MmapPageFile file = MmapPageFile::open(extentName);
+        Page page = file.readPage(numPages);
+        checkPassFail(*page.begin(), "record on page " + std::to_string(numPages))
+    }
+    File::remove(extentName);
+}
+void tracePage(const File* file, const PageId pageNo)
+{
+  std::lock_guard<std::mutex> guard(traceLatch);
+  const int fileNo = traceFiles.insert(std::make_pair(file->filename(), (int)traceFiles.size())).first->second;
+  traceOut << fileNo << ' ' << pageNo << '\n';
+}
+
+// claimer that takes every frame proposed, or none, and records the proposals
+class TestClaimer : public FrameClaimer
+{
+ public:
+    TestClaimer(bool take) : take(take) {}
+    bool tryClaim(const FrameId frame, const bool secondChance)
+    {
+        proposed.push_back(frame);
+        return take;
+    }
+    bool take;
+    std::vector<FrameId> proposed;
+};
+
+// a victim handed back with restore() keeps its place in the eviction order,
+// and its page is not taken for an evicted one when it is looked at again
+void policy_restore_test()
+{
+    const ReplacementPolicyType types[] = {LRUK_POLICY, TWOQ_POLICY, ARC_POLICY};
+    for(int t = 0; t < 3; t++)
+    {
+        const std::uint32_t numBufs = 8;
+        ReplacementPolicy* policy = ReplacementPolicy::create(types[t], numBufs);
+        for(FrameId frame = 0; frame < numBufs; frame++)
+            policy->recordLoad(frame, 1, frame + 1);
+
+        TestClaimer taker(true);
+        FrameId victim = numBufs;
+        checkPassFail(policy->pickVictim(taker, victim), true)
+        checkPassFail(victim, 0)
+        policy->restore(victim);
+
+        // every frame is proposed, the restored one still first
+        TestClaimer refuser(false);
+        checkPassFail(policy->pickVictim(refuser, victim), false)
+        checkPassFail(refuser.proposed.size(), numBufs)
+        checkPassFail(refuser.proposed[0], 0)
+        checkPassFail(refuser.proposed[1], 1)
+
+        // an eviction that goes through still moves the frame on
+        checkPassFail(policy->pickVictim(taker, victim), true)
+        checkPassFail(victim, 0)
+        policy->recordLoad(victim, 1, numBufs + 1);
+        refuser.proposed.clear();
+        policy->pickVictim(refuser, victim);
+        checkPassFail(refuser.proposed[0], 1)
+        delete policy;
+    }
+}
 void test4()
 {
     // Create a relation with tuple valued 0 to spesific size in fowarding order
@@ -836,10 +1634,78 @@ void test8()
     intTests();
     deleteRelation();
 }
+void test9()
+{
+    std::cout << "---------------------" << std::endl;
+    std::cout << "TEST:upgrade_test" << std::endl;
+    std::cout << "---------------------" << std::endl;
+    upgrade_test();
+}
 
+void test10()
+{
+    std::cout << "---------------------" << std::endl;
+    std::cout << "TEST:fixedlength_test" << std::endl;
+    std::cout << "---------------------" << std::endl;
+    fixedlength_test();
+    versiontwo_upgrade_test();
+}
 
+void test11()
+{
+    std::cout << "---------------------" << std::endl;
+    std::cout << "TEST:policy_restore_test" << std::endl;
+    std::cout << "---------------------" << std::endl;
+    policy_restore_test();
+}
 
+void test12()
+{
+    std::cout << "---------------------" << std::endl;
+    std::cout << "TEST:freespace_test" << std::endl;
+    std::cout << "---------------------" << std::endl;
+    freespace_test();
+}
 
+void test13()
+{
+    std::cout << "---------------------" << std::endl;
+    std::cout << "TEST:slot_test" << std::endl;
+    std::cout << "---------------------" << std::endl;
+    slot_test();
+}
 
+void test14()
+{
+    // Run the index tests with the AVX2 search inside nodes and without it
+    std::cout << "---------------------" << std::endl;
+    std::cout << "TEST:vector and portable search inside nodes" << std::endl;
+    std::cout << "---------------------" << std::endl;
+    createRelationRandom();
+    const bool vectorSearch = BTreeIndex::setVectorSearch(true);
+    std::cout << "AVX2 search available: " << vectorSearch << std::endl;
+    for(int vector = 1; vector >= 0; vector--)
+    {
+        checkPassFail(BTreeIndex::setVectorSearch(vector), (vector && vectorSearch))
+        intTests();
+        doubleTests();
+        try
+        {
+            File::remove(intIndexName);
+            File::remove(doubleIndexName);
+        }
+        catch(const FileNotFoundException &e)
+        {
+        }
+    }
+    BTreeIndex::setVectorSearch(true);
+    deleteRelation();
+}
 
-
+void test15()
+{
+    std::cout << "---------------------" << std::endl;
+    std::cout << "TEST:extent_test" << std::endl;
+    std::cout << "---------------------" << std::endl;
+    extent_test();
+}
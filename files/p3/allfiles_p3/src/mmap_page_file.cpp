@@ -0,0 +1,151 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include "mmap_page_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "exceptions/bad_file_format_exception.h"
+#include "exceptions/file_io_exception.h"
+#include "exceptions/invalid_page_exception.h"
+#include "exceptions/read_only_file_exception.h"
+
+namespace badgerdb {
+
+MmapPageFile MmapPageFile::open(const std::string& filename) {
+  return MmapPageFile(filename);
+}
+
+MmapPageFile::MmapPageFile(const std::string& name)
+: File(name, false /* create_new */), mapping_(NULL), mapping_length_(0),
+  num_pages_(0) {
+  if (readHeader().format_version != FORMAT_VERSION) {
+    // let PageFile bring the file up to date before mapping it
+    PageFile upgraded(filename_, false /* create_new */);
+  }
+  map();
+}
+
+MmapPageFile::MmapPageFile(const MmapPageFile& other)
+: File(other.filename_, false /* create_new */), mapping_(NULL),
+  mapping_length_(0), num_pages_(0) {
+  map();
+}
+
+MmapPageFile& MmapPageFile::operator=(const MmapPageFile& rhs) {
+  // This accounts for self-assignment and assignment of a File object for the
+  // same file.
+  close();	//close my file and associate me with the new one
+  unmap();
+  filename_ = rhs.filename_;
+  openIfNeeded(false /* create_new */);
+  map();
+  return *this;
+}
+
+MmapPageFile::~MmapPageFile() {
+  // leave the registry before this object is torn down; see withOpenFile()
+  close();
+  unmap();
+}
+
+void MmapPageFile::map() {
+  std::lock_guard<std::recursive_mutex> guard(*latch_);
+  // pages written through other File objects must reach the file first
+  flush();
+
+  const int fd = ::open(filename_.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw FileIOException(Page::INVALID_NUMBER, filename_, errno);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    const int error = errno;
+    ::close(fd);
+    throw FileIOException(Page::INVALID_NUMBER, filename_, error);
+  }
+
+  // new pages are written out in full as they are allocated, and space is
+  // reserved without growing the file, so the pages the header counts are
+  // all there and any older reserved tail is left unmapped
+  num_pages_ = readHeader().num_pages;
+  if (num_pages_ > 1) {
+    const std::size_t length = static_cast<std::size_t>(pagePosition(num_pages_));
+    if (static_cast<std::size_t>(st.st_size) < length) {
+      ::close(fd);
+      num_pages_ = 0;
+      throw BadFileFormatException(filename_);
+    }
+    void* mem = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+      const int error = errno;
+      ::close(fd);
+      throw FileIOException(Page::INVALID_NUMBER, filename_, error);
+    }
+    mapping_ = static_cast<char*>(mem);
+    mapping_length_ = length;
+  }
+  ::close(fd);
+}
+
+void MmapPageFile::unmap() {
+  if (mapping_ != NULL) {
+    munmap(mapping_, mapping_length_);
+  }
+  mapping_ = NULL;
+  mapping_length_ = 0;
+  num_pages_ = 0;
+}
+
+void MmapPageFile::allocatePageInto(PageId &new_page_number, Page& new_page) {
+  throw ReadOnlyFileException(filename_);
+}
+
+void MmapPageFile::readPageInto(const PageId page_number, Page& page) const {
+  std::memcpy(&page, mappedPage(page_number), Page::SIZE);
+}
+
+void MmapPageFile::writePage(const PageId page_number, const Page& new_page) {
+  throw ReadOnlyFileException(filename_);
+}
+
+void MmapPageFile::deletePage(const PageId page_number) {
+  throw ReadOnlyFileException(filename_);
+}
+
+const Page* MmapPageFile::mappedPage(const PageId page_number) const {
+  if (page_number == Page::INVALID_NUMBER || page_number >= num_pages_) {
+    throw InvalidPageException(page_number, filename_);
+  }
+  const Page* page = reinterpret_cast<const Page*>(
+      mapping_ + static_cast<std::size_t>(pagePosition(page_number)));
+  if (!page->isUsed()) {
+    throw InvalidPageException(page_number, filename_);
+  }
+  return page;
+}
+
+void MmapPageFile::advise(const AccessPattern pattern) {
+  if (mapping_ == NULL) {
+    return;
+  }
+  int advice = MADV_NORMAL;
+  if (pattern == SEQUENTIAL_ACCESS) {
+    advice = MADV_SEQUENTIAL;
+  } else if (pattern == RANDOM_ACCESS) {
+    advice = MADV_RANDOM;
+  }
+  madvise(mapping_, mapping_length_, advice);
+}
+
+}
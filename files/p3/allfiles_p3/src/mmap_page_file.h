@@ -0,0 +1,159 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <string>
+
+#include "file.h"
+
+namespace badgerdb {
+
+/**
+ * @brief Read-only view of a PageFile through a memory mapping of the whole
+ *        file.
+ *
+ * Meant for read-mostly relations: mappedPage() returns a pointer to a page
+ * in the mapping, with no system call and no copy, and readPageInto() copies
+ * straight from the mapping. advise() passes the expected access pattern on
+ * to the kernel. Allocating, writing or deleting pages is not supported.
+ *
+ * The mapping covers the file as it was when the object was created. Pages
+ * appended later through other File objects on the same file are not
+ * visible; pages changed through them are, once they have been written.
+ */
+class MmapPageFile : public File {
+ public:
+  /**
+   * How the pages of the file are expected to be accessed.
+   */
+  enum AccessPattern {
+    NORMAL_ACCESS,      /* No particular order */
+    SEQUENTIAL_ACCESS,  /* In file order, as by a scan; read ahead aggressively */
+    RANDOM_ACCESS       /* Point probes; don't read ahead */
+  };
+
+  /**
+   * Opens the file named fileName and returns the corresponding File object.
+   *
+   * @param filename  Name of the file.
+   * @throws  FileNotFoundException   If the requested file doesn't exist.
+   * @throws  FileIOException         If the file can't be mapped.
+   * @throws  BadFileFormatException  If the file is shorter than its header
+   *                                  says.
+   */
+  static MmapPageFile open(const std::string& filename);
+
+  /**
+   * Constructs a file object mapping an existing file. A file written before
+   * the format was versioned is upgraded first, as by PageFile.
+   *
+   * @param name  Name of file.
+   * @throws  FileNotFoundException   If the underlying file doesn't exist.
+   * @throws  FileIOException         If the file can't be mapped.
+   * @throws  BadFileFormatException  If the file is shorter than its header
+   *                                  says.
+   */
+  explicit MmapPageFile(const std::string& name);
+
+  /**
+   * Copy constructor. The copy gets its own mapping.
+   *
+   * @param other File object to copy.
+   */
+  MmapPageFile(const MmapPageFile& other);
+
+  /**
+   * Assignment operator.
+   *
+   * @param rhs File object to assign.
+   * @return    Newly assigned file object.
+   */
+  MmapPageFile& operator=(const MmapPageFile& rhs);
+
+  /**
+   * Destructor that unmaps the file, and closes it if no other File objects
+   * are using it.
+   */
+  ~MmapPageFile();
+
+  /**
+   * Not supported.
+   *
+   * @throws  ReadOnlyFileException  Always.
+   */
+  void allocatePageInto(PageId &new_page_number, Page& new_page);
+
+  /**
+   * Copies an existing page out of the mapping.
+   *
+   * @see File::readPageInto()
+   * @throws  InvalidPageException  If the page doesn't exist in the mapping or
+   *                                is not currently used.
+   */
+  void readPageInto(const PageId page_number, Page& page) const;
+
+  /**
+   * Not supported.
+   *
+   * @throws  ReadOnlyFileException  Always.
+   */
+  void writePage(const PageId page_number, const Page& new_page);
+
+  /**
+   * Not supported.
+   *
+   * @throws  ReadOnlyFileException  Always.
+   */
+  void deletePage(const PageId page_number);
+
+  /**
+   * Returns a page in place in the mapping. The page stays valid for the life
+   * of this object and must not be modified.
+   *
+   * @param page_number   Number of page.
+   * @return  The page.
+   * @throws  InvalidPageException  If the page doesn't exist in the mapping or
+   *                                is not currently used.
+   */
+  const Page* mappedPage(const PageId page_number) const;
+
+  /**
+   * Tells the kernel how the pages are about to be accessed.
+   *
+   * @param pattern   Expected access pattern.
+   */
+  void advise(const AccessPattern pattern);
+
+ private:
+  /**
+   * Maps filename_.
+   */
+  void map();
+
+  /**
+   * Unmaps the file, if mapped.
+   */
+  void unmap();
+
+  /**
+   * Start of the mapping, or NULL if the file holds no page.
+   */
+  char* mapping_;
+
+  /**
+   * Length of the mapping in bytes.
+   */
+  std::size_t mapping_length_;
+
+  /**
+   * Number of pages in the mapping, counting the (absent) page 0.
+   */
+  PageId num_pages_;
+};
+
+}
@@ -9,6 +9,7 @@
 
 #include <iostream>
 #include "exceptions/insufficient_space_exception.h"
+#include "exceptions/invalid_record_length_exception.h"
 #include "exceptions/invalid_record_exception.h"
 #include "exceptions/invalid_slot_exception.h"
 #include "exceptions/slot_in_use_exception.h"
@@ -23,20 +24,36 @@ Page::Page() {
 }
 
 void Page::initialize() {
-  header_.free_space_lower_bound = 0;
+  // The header is written to disk as it is in memory, so clear all of it,
+  // including any padding, rather than field by field.
+  memset(&header_, '\0', sizeof(header_));
   header_.free_space_upper_bound = DATA_SIZE;
-  header_.num_slots = 0;
-  header_.num_free_slots = 0;
   header_.current_page_number = INVALID_NUMBER;
   header_.next_page_number = INVALID_NUMBER;
+  header_.prev_page_number = INVALID_NUMBER;
   //data_.assign(DATA_SIZE, char());
 	memset(data_, '\0', DATA_SIZE);
 }
 
 RecordId Page::insertRecord(const std::string& record_data) {
+  return insertRecord(RecordView(record_data));
+}
+
+RecordId Page::insertRecord(const RecordView& record_data) {
+  if (isFixedLength() && record_data.length != header_.record_length) {
+    throw InvalidRecordLengthException(
+        page_number(), record_data.length, header_.record_length);
+  }
   if (!hasSpaceForRecord(record_data)) {
     throw InsufficientSpaceException(
-        page_number(), record_data.length(), getFreeSpace());
+        page_number(), record_data.length, getFreeSpace());
+  }
+  // a new slot needs room between the bounds, not just anywhere
+  if (!isFixedLength() && header_.num_free_slots == 0 &&
+      static_cast<std::size_t>(header_.free_space_upper_bound -
+                               header_.free_space_lower_bound) <
+          newSlotSize() + record_data.length) {
+    compact();
   }
   const SlotId slot_number = getAvailableSlot();
   insertRecordInSlot(slot_number, record_data);
@@ -44,22 +61,43 @@ RecordId Page::insertRecord(const std::string& record_data) {
 }
 
 std::string Page::getRecord(const RecordId& record_id) const {
+  return getRecordView(record_id).str();
+}
+
+RecordView Page::getRecordView(const RecordId& record_id) const {
   validateRecordId(record_id);
+  if (isFixedLength()) {
+    return RecordView(&data_[fixedRecordOffset(record_id.slot_number)],
+                      header_.record_length);
+  }
   const PageSlot& slot = getSlot(record_id.slot_number);
-	std::string retStr = std::string(data_, DATA_SIZE).substr(slot.item_offset, slot.item_length);
-
-	return retStr;
+  return RecordView(&data_[slot.item_offset], slot.item_length);
 }
 
 void Page::updateRecord(const RecordId& record_id,
                         const std::string& record_data) {
+  updateRecord(record_id, RecordView(record_data));
+}
+
+void Page::updateRecord(const RecordId& record_id,
+                        const RecordView& record_data) {
   validateRecordId(record_id);
+  if (isFixedLength()) {
+    // the record is overwritten where it is
+    if (record_data.length != header_.record_length) {
+      throw InvalidRecordLengthException(
+          page_number(), record_data.length, header_.record_length);
+    }
+    memcpy(&data_[fixedRecordOffset(record_id.slot_number)], record_data.data,
+           record_data.length);
+    return;
+  }
   const PageSlot* slot = getSlot(record_id.slot_number);
   const std::size_t free_space_after_delete =
       getFreeSpace() + slot->item_length;
-  if (record_data.length() > free_space_after_delete) {
+  if (record_data.length > free_space_after_delete) {
     throw InsufficientSpaceException(
-        page_number(), record_data.length(), free_space_after_delete);
+        page_number(), record_data.length, free_space_after_delete);
   }
   // We have to disallow slot compaction here because we're going to place the
   // record data in the same slot, and compaction might delete the slot if we
@@ -75,135 +113,270 @@ void Page::deleteRecord(const RecordId& record_id) {
 void Page::deleteRecord(const RecordId& record_id,
                         const bool allow_slot_compaction) {
   validateRecordId(record_id);
-  PageSlot* slot = getSlot(record_id.slot_number);
-
-	for(int i = 0; i < slot->item_length; i++)
-		data_[i + slot->item_offset] = '\0';
-
-  //data_.replace(slot->item_offset, slot->item_length, slot->item_length, '\0');
-
-  // Compact the data by removing the hole left by this record (if necessary).
-  std::uint16_t move_offset = slot->item_offset; 
-  std::size_t move_bytes = 0;
-  for (SlotId i = 1; i <= header_.num_slots; ++i) {
-    PageSlot* other_slot = getSlot(i);
-    if (other_slot->used && other_slot->item_offset < slot->item_offset) {
-      if (other_slot->item_offset < move_offset) {
-        move_offset = other_slot->item_offset;
-      }
-      move_bytes += other_slot->item_length;
-      // Update the slot for the other data to reflect the soon-to-be-new
-      // location.
-      other_slot->item_offset += slot->item_length;
-    }
+  if (isFixedLength()) {
+    // slots of a fixed-length page are never freed, so there is nothing to
+    // move or trim
+    memset(&data_[fixedRecordOffset(record_id.slot_number)], '\0',
+           header_.record_length);
+    setSlotUsed(record_id.slot_number, false);
+    ++header_.num_free_slots;
+    return;
   }
-  // If we have data to move, shift it to the right.
-  if (move_bytes > 0) {
-    const std::string& data_to_move = std::string(data_, DATA_SIZE).substr(move_offset, move_bytes);
+  PageSlot* slot = getSlot(record_id.slot_number);
 
-		for(std::uint16_t i = 0; i < move_bytes; i++)
-			data_[i + move_offset + slot->item_length] = data_to_move[i];
+  memset(&data_[slot->item_offset], '\0', slot->item_length);
 
-    //data_.replace(move_offset + slot->item_length, move_bytes, data_to_move);
+  // The lowest record gives its space straight back to the free space; any
+  // other leaves a hole, so that no other record has to move.
+  if (slot->item_offset == header_.free_space_upper_bound) {
+    header_.free_space_upper_bound += slot->item_length;
+  } else {
+    header_.fragmented_space += slot->item_length;
   }
-  header_.free_space_upper_bound += slot->item_length;
 
   // Mark slot as unused.
-  slot->used = false;
+  setSlotUsed(record_id.slot_number, false);
   slot->item_offset = 0;
   slot->item_length = 0;
   ++header_.num_free_slots;
 
   if (allow_slot_compaction && record_id.slot_number == header_.num_slots) {
-    // Last slot in the list, so we need to free any unused slots that are at
-    // the end of the slot list.
-    int num_slots_to_delete = 1;
-    for (SlotId i = 1; i < header_.num_slots; ++i) {
-      // Traverse list backwards, looking for unused slots.
-      const PageSlot* other_slot = getSlot(header_.num_slots - i);
-      if (!other_slot->used) {
-        ++num_slots_to_delete;
-      } else {
-        // Stop at the first used slot we find, since we can't move used slots
-        // without affecting record IDs.
+    // Last slot in the directory, so we need to free any unused slots that are
+    // at the end of the directory: everything after the last used slot, which
+    // the occupancy words give away a group at a time.
+    SlotId last_used_slot = INVALID_SLOT;
+    for (std::size_t group = (header_.num_slots - 1) / SLOTS_PER_GROUP + 1;
+         group > 0; --group) {
+      const std::uint64_t word = getUsedWord(group - 1);
+      if (word != 0) {
+        last_used_slot = static_cast<SlotId>(
+            (group - 1) * SLOTS_PER_GROUP + (63 - __builtin_clzll(word)) + 1);
         break;
       }
     }
+    const int num_slots_to_delete = header_.num_slots - last_used_slot;
     header_.num_slots -= num_slots_to_delete;
     header_.num_free_slots -= num_slots_to_delete;
-    header_.free_space_lower_bound -= sizeof(PageSlot) * num_slots_to_delete;
+    header_.free_space_lower_bound = directorySize(header_.num_slots);
   }
 }
 
 bool Page::hasSpaceForRecord(const std::string& record_data) const {
-  std::size_t record_size = record_data.length();
+  return hasSpaceForRecord(RecordView(record_data));
+}
+
+bool Page::hasSpaceForRecord(const RecordView& record_data) const {
+  if (isFixedLength()) {
+    return record_data.length == header_.record_length &&
+           header_.num_free_slots > 0;
+  }
+  std::size_t record_size = record_data.length;
   if (header_.num_free_slots == 0) {
-    record_size += sizeof(PageSlot);
+    record_size += newSlotSize();
   }
   return record_size <= getFreeSpace();
 }
 
+std::size_t Page::directorySize(const std::size_t num_slots) {
+  const std::size_t num_groups =
+      (num_slots + SLOTS_PER_GROUP - 1) / SLOTS_PER_GROUP;
+  return num_groups * sizeof(std::uint64_t) + num_slots * sizeof(PageSlot);
+}
+
+std::uint64_t Page::getUsedWord(const std::size_t group) const {
+  const std::size_t offset = isFixedLength()
+                                 ? group * sizeof(std::uint64_t)
+                                 : directorySize(group * SLOTS_PER_GROUP);
+  std::uint64_t word;
+  memcpy(&word, &data_[offset], sizeof(word));
+  return word;
+}
+
+void Page::setUsedWord(const std::size_t group, const std::uint64_t word) {
+  const std::size_t offset = isFixedLength()
+                                 ? group * sizeof(std::uint64_t)
+                                 : directorySize(group * SLOTS_PER_GROUP);
+  memcpy(&data_[offset], &word, sizeof(word));
+}
+
+void Page::formatFixedLength(const std::size_t record_length) {
+  if (header_.num_slots != header_.num_free_slots) {
+    throw SlotInUseException(page_number(), getNextUsedSlot(INVALID_SLOT));
+  }
+  const std::size_t num_slots = fixedLengthCapacity(record_length);
+  if (num_slots == 0) {
+    throw InsufficientSpaceException(
+        page_number(), record_length, DATA_SIZE - sizeof(std::uint64_t));
+  }
+  memset(data_, '\0', DATA_SIZE);
+  header_.record_length = record_length;
+  header_.num_slots = num_slots;
+  header_.num_free_slots = num_slots;
+  header_.fragmented_space = 0;
+  // there is no free space between the bitmap and the records to hand out
+  header_.free_space_lower_bound = fixedRecordOffset(num_slots + 1);
+  header_.free_space_upper_bound = header_.free_space_lower_bound;
+}
+
+std::size_t Page::fixedLengthCapacity(const std::size_t record_length) {
+  if (record_length == 0 || record_length > DATA_SIZE) {
+    return 0;
+  }
+  // every slot costs its record and a bit of the bitmap, which is allocated a
+  // word at a time
+  std::size_t num_slots = DATA_SIZE * 8 / (record_length * 8 + 1);
+  while (num_slots > 0 &&
+         (num_slots + SLOTS_PER_GROUP - 1) / SLOTS_PER_GROUP *
+                 sizeof(std::uint64_t) +
+             num_slots * record_length > DATA_SIZE) {
+    --num_slots;
+  }
+  return num_slots;
+}
+
+bool Page::isSlotUsed(const SlotId slot_number) const {
+  const std::size_t index = slot_number - 1;
+  return (getUsedWord(index / SLOTS_PER_GROUP) >> (index % SLOTS_PER_GROUP)) & 1;
+}
+
+void Page::setSlotUsed(const SlotId slot_number, const bool used) {
+  const std::size_t index = slot_number - 1;
+  const std::uint64_t bit = std::uint64_t(1) << (index % SLOTS_PER_GROUP);
+  const std::uint64_t word = getUsedWord(index / SLOTS_PER_GROUP);
+  setUsedWord(index / SLOTS_PER_GROUP, used ? word | bit : word & ~bit);
+}
+
+SlotId Page::getNextUsedSlot(const SlotId start) const {
+  // bits past the last slot are never set
+  for (std::size_t index = start; index < header_.num_slots;) {
+    const std::size_t group = index / SLOTS_PER_GROUP;
+    const std::uint64_t word =
+        getUsedWord(group) & (~std::uint64_t(0) << (index % SLOTS_PER_GROUP));
+    if (word != 0) {
+      return static_cast<SlotId>(group * SLOTS_PER_GROUP +
+                                 __builtin_ctzll(word) + 1);
+    }
+    index = (group + 1) * SLOTS_PER_GROUP;
+  }
+  return INVALID_SLOT;
+}
+
+void Page::compact() {
+  // Only the records, not the whole page, need to be copied aside.
+  const std::uint16_t old_upper_bound = header_.free_space_upper_bound;
+  char records[DATA_SIZE];
+  memcpy(&records[old_upper_bound], &data_[old_upper_bound],
+         DATA_SIZE - old_upper_bound);
+  std::uint16_t upper_bound = DATA_SIZE;
+  const std::size_t num_groups =
+      (header_.num_slots + SLOTS_PER_GROUP - 1) / SLOTS_PER_GROUP;
+  for (std::size_t group = 0; group < num_groups; ++group) {
+    PageSlot* slots = getSlot(group * SLOTS_PER_GROUP + 1);
+    for (std::uint64_t word = getUsedWord(group); word != 0;
+         word &= word - 1) {
+      PageSlot* slot = &slots[__builtin_ctzll(word)];
+      upper_bound -= slot->item_length;
+      memcpy(&data_[upper_bound], &records[slot->item_offset],
+             slot->item_length);
+      slot->item_offset = upper_bound;
+    }
+  }
+  memset(&data_[old_upper_bound], '\0', upper_bound - old_upper_bound);
+  header_.free_space_upper_bound = upper_bound;
+  header_.fragmented_space = 0;
+}
+
 PageSlot* Page::getSlot(const SlotId slot_number) {
-  return reinterpret_cast<PageSlot*>(&data_[(slot_number - 1) * sizeof(PageSlot)]);
+  const std::size_t index = slot_number - 1;
+  return reinterpret_cast<PageSlot*>(
+      &data_[directorySize(index - index % SLOTS_PER_GROUP) +
+             sizeof(std::uint64_t) + (index % SLOTS_PER_GROUP) * sizeof(PageSlot)]);
 }
 
 const PageSlot& Page::getSlot(const SlotId slot_number) const {
-  return *reinterpret_cast<const PageSlot*>(&data_[(slot_number - 1) * sizeof(PageSlot)]);
+  const std::size_t index = slot_number - 1;
+  return *reinterpret_cast<const PageSlot*>(
+      &data_[directorySize(index - index % SLOTS_PER_GROUP) +
+             sizeof(std::uint64_t) + (index % SLOTS_PER_GROUP) * sizeof(PageSlot)]);
 }
 
 SlotId Page::getAvailableSlot() {
-  SlotId slot_number = INVALID_SLOT;
-  if (header_.num_free_slots > 0) {
-    // Have an allocated but unused slot that we can reuse.
-    for (SlotId i = 1; i <= header_.num_slots; ++i) {
-      const PageSlot* slot = getSlot(i);
-      if (!slot->used) {
-        // We don't decrement the number of free slots until someone actually
-        // puts data in the slot.
-        slot_number = i;
-        break;
+  if (header_.num_free_slots == 0 && !isFixedLength()) {
+    // Have to allocate a new slot.
+    const SlotId slot_number = appendSlot();
+    return slot_number;
+  }
+  // Have an allocated but unused slot that we can reuse. We don't decrement
+  // the number of free slots until someone actually puts data in the slot.
+  const std::size_t num_groups =
+      (header_.num_slots + SLOTS_PER_GROUP - 1) / SLOTS_PER_GROUP;
+  for (std::size_t group = 0; group < num_groups; ++group) {
+    const std::uint64_t unused = ~getUsedWord(group);
+    if (unused != 0) {
+      const std::size_t index = group * SLOTS_PER_GROUP + __builtin_ctzll(unused);
+      if (index < header_.num_slots) {
+        return static_cast<SlotId>(index + 1);
       }
     }
-  } else {
-    // Have to allocate a new slot.
-    slot_number = header_.num_slots + 1;
-    ++header_.num_slots;
-    ++header_.num_free_slots;
-    header_.free_space_lower_bound = sizeof(PageSlot) * header_.num_slots;
   }
-  assert(slot_number != INVALID_SLOT);
-  return static_cast<SlotId>(slot_number);
+  assert(false);
+  return INVALID_SLOT;
+}
+
+SlotId Page::appendSlot() {
+  if (header_.num_slots % SLOTS_PER_GROUP == 0) {
+    // start a new group with an empty occupancy word
+    setUsedWord(header_.num_slots / SLOTS_PER_GROUP, 0);
+  }
+  ++header_.num_slots;
+  ++header_.num_free_slots;
+  header_.free_space_lower_bound = directorySize(header_.num_slots);
+  PageSlot* slot = getSlot(header_.num_slots);
+  slot->item_offset = 0;
+  slot->item_length = 0;
+  return header_.num_slots;
 }
 
 void Page::insertRecordInSlot(const SlotId slot_number,
-                              const std::string& record_data) {
+                              const RecordView& record_data) {
   if (slot_number > header_.num_slots ||
       slot_number == INVALID_SLOT) {
     throw InvalidSlotException(page_number(), slot_number);
   }
-  PageSlot* slot = getSlot(slot_number);
-  if (slot->used) {
+  if (isSlotUsed(slot_number)) {
     throw SlotInUseException(page_number(), slot_number);
   }
-  const int record_length = record_data.length();
-  slot->used = true;
+  if (isFixedLength()) {
+    setSlotUsed(slot_number, true);
+    --header_.num_free_slots;
+    memcpy(&data_[fixedRecordOffset(slot_number)], record_data.data,
+           header_.record_length);
+    return;
+  }
+  // reclaim the space of deleted records if the bounds are too close
+  if (static_cast<std::size_t>(header_.free_space_upper_bound -
+                               header_.free_space_lower_bound) <
+      record_data.length) {
+    compact();
+  }
+  PageSlot* slot = getSlot(slot_number);
+  const int record_length = record_data.length;
+  setSlotUsed(slot_number, true);
   slot->item_length = record_length;
   slot->item_offset = header_.free_space_upper_bound - record_length;
   header_.free_space_upper_bound = slot->item_offset;
   --header_.num_free_slots;
 
-	for(int i = 0; i < slot->item_length; i++)
-		data_[i + slot->item_offset] = record_data[i];
-
-  //data_.replace(slot->item_offset, slot->item_length, record_data);
+	memcpy(&data_[slot->item_offset], record_data.data, slot->item_length);
 }
 
 void Page::validateRecordId(const RecordId& record_id) const {
   if (record_id.page_number != page_number()) {
     throw InvalidRecordException(record_id, page_number());
   }
-  const PageSlot& slot = getSlot(record_id.slot_number);
-  if (!slot.used) {
+  if (record_id.slot_number == INVALID_SLOT ||
+      record_id.slot_number > header_.num_slots ||
+      !isSlotUsed(record_id.slot_number)) {
     throw InvalidRecordException(record_id, page_number());
   }
 }
@@ -26,7 +26,7 @@ namespace badgerdb {
 struct PageHeader {
   /**
    * Lower bound of the free space.  This is the offset of the first unused byte
-   * after the slot array.
+   * after the slot directory.
    */
   std::uint16_t free_space_lower_bound;
 
@@ -58,6 +58,24 @@ struct PageHeader {
    */
   PageId next_page_number;
 
+  /**
+   * Number of the previous used page in the file.
+   */
+  PageId prev_page_number;
+
+  /**
+   * Bytes of deleted records between the upper bound of the free space and
+   * the end of the page. They are reclaimed when a record no longer fits
+   * between the bounds.
+   */
+  std::uint16_t fragmented_space;
+
+  /**
+   * Length of every record on the page if it holds fixed-length records, or
+   * 0 if it holds records of any length.
+   */
+  std::uint16_t record_length;
+
   /**
    * Returns true if this page header is equal to the other.
    *
@@ -68,20 +86,20 @@ struct PageHeader {
     return num_slots == rhs.num_slots &&
         num_free_slots == rhs.num_free_slots &&
         current_page_number == rhs.current_page_number &&
-        next_page_number == rhs.next_page_number;
+        next_page_number == rhs.next_page_number &&
+        prev_page_number == rhs.prev_page_number &&
+        fragmented_space == rhs.fragmented_space &&
+        record_length == rhs.record_length;
   }
 };
 
 /**
  * @brief Slot metadata that tracks where a record is in the data space.
+ *
+ * Whether a slot is in use is kept in the occupancy word of its group of
+ * slots rather than in the slot; see Page.
  */
 struct PageSlot {
-  /**
-   * Whether the slot currently holds data.  May be false if this slot's
-   * record has been deleted after insertion.
-   */
-  bool used;
-
   /**
    * Offset of the data item in the page.
    */
@@ -93,6 +111,53 @@ struct PageSlot {
   std::uint16_t item_length;
 };
 
+/**
+ * @brief Bytes of a record, referred to where they are stored rather than
+ *        copied.
+ *
+ * A view returned by a page stays valid as long as the page is neither
+ * changed nor, for a buffer frame, unpinned. Views may also wrap bytes given
+ * to a page, so that they can be inserted without building a string first.
+ */
+struct RecordView {
+  /**
+   * Constructs an empty view.
+   */
+  RecordView() : data(NULL), length(0) {}
+
+  /**
+   * Constructs a view of the given bytes.
+   *
+   * @param record_data   First byte of the record.
+   * @param record_length Length of the record in bytes.
+   */
+  RecordView(const char* record_data, const std::size_t record_length)
+      : data(record_data), length(record_length) {}
+
+  /**
+   * Constructs a view of the bytes of a string, which must outlive it.
+   *
+   * @param record_data   Bytes that compose the record.
+   */
+  RecordView(const std::string& record_data)
+      : data(record_data.data()), length(record_data.length()) {}
+
+  /**
+   * Returns a copy of the bytes.
+   */
+  std::string str() const { return std::string(data, length); }
+
+  /**
+   * First byte of the record.
+   */
+  const char* data;
+
+  /**
+   * Length of the record in bytes.
+   */
+  std::size_t length;
+};
+
 class PageIterator;
 
 /**
@@ -103,6 +168,11 @@ class PageIterator;
  * slots and identified by a RecordId.  Although a record's actual contents may
  * be moved on the page, accessing a record by its slot is consistent.
  *
+ * A page can instead be formatted for records of one fixed length, such as the
+ * tuples of a relation with a fixed schema.  Such a page has no slot
+ * directory: an occupancy bitmap is followed by an array of records, and the
+ * slot number of a record gives its place in the array.
+ *
  * @warning This class is not threadsafe.
  */
 class Page {
@@ -128,6 +198,17 @@ class Page {
    */
   static const SlotId INVALID_SLOT = 0;
 
+  /**
+   * Number of slots in a group sharing an occupancy word.
+   */
+  static const std::size_t SLOTS_PER_GROUP = 64;
+
+  /**
+   * Most bytes a new slot takes from the free space: the slot itself, and the
+   * occupancy word of a new group.
+   */
+  static const std::size_t MAX_SLOT_SIZE = sizeof(PageSlot) + sizeof(std::uint64_t);
+
   /**
    * Constructs a new, uninitialized page.
    */
@@ -141,6 +222,14 @@ class Page {
    */
   RecordId insertRecord(const std::string& record_data);
 
+  /**
+   * Inserts a new record into the page, copying it from the given bytes.
+   *
+   * @param record_data  Bytes that compose the record.
+   * @return  ID of the newly inserted record.
+   */
+  RecordId insertRecord(const RecordView& record_data);
+
   /**
    * Returns the record with the given ID.  Returned data is a copy of what is
    * stored on the page; use updateRecord to change it.
@@ -151,6 +240,16 @@ class Page {
    */
   std::string getRecord(const RecordId& record_id) const;
 
+  /**
+   * Returns the record with the given ID without copying it: the view refers
+   * to the bytes on the page.
+   *
+   * @see RecordView
+   * @param record_id  ID of the record to return.
+   * @return  View of the record.
+   */
+  RecordView getRecordView(const RecordId& record_id) const;
+
   /**
    * Updates the record with the given ID, replacing its data with a new
    * version.  This is equivalent to deleting the old record and inserting a
@@ -162,9 +261,18 @@ class Page {
   void updateRecord(const RecordId& record_id, const std::string& record_data);
 
   /**
-   * Deletes the record with the given ID.  Page is compacted upon delete to
-   * ensure that data of all records is contiguous.  Slot array is compacted if
-   * the slot deleted is at the end of the slot array.
+   * Updates the record with the given ID, copying its new version from the
+   * given bytes, which must not be on this page.
+   *
+   * @param record_id   ID of record to update.
+   * @param record_data Updated bytes that compose the record.
+   */
+  void updateRecord(const RecordId& record_id, const RecordView& record_data);
+
+  /**
+   * Deletes the record with the given ID.  Its space becomes free at once,
+   * but is only reclaimed by moving other records when it is needed.  Slot
+   * directory is compacted if the slot deleted is at the end of it.
    *
    * @param record_id   ID of the record to delete.
    */
@@ -179,12 +287,50 @@ class Page {
   bool hasSpaceForRecord(const std::string& record_data) const;
 
   /**
-   * Returns this page's free space in bytes.
+   * Returns true if the page has enough free space to hold the given bytes.
+   *
+   * @param record_data Bytes that compose the record.
+   * @return  Whether the page can hold the data.
+   */
+  bool hasSpaceForRecord(const RecordView& record_data) const;
+
+  /**
+   * Returns this page's free space in bytes, including the space of deleted
+   * records that has not been reclaimed yet.  For a page of fixed-length
+   * records, this is the space of its free slots.
    *
    * @return  Free space in bytes.
    */
-  std::uint16_t getFreeSpace() const { return header_.free_space_upper_bound -
-                                              header_.free_space_lower_bound; }
+  std::uint16_t getFreeSpace() const {
+    if (isFixedLength()) {
+      return header_.num_free_slots * header_.record_length;
+    }
+    return header_.free_space_upper_bound - header_.free_space_lower_bound +
+           header_.fragmented_space;
+  }
+
+  /**
+   * Formats this page, which must hold no records, for records of the given
+   * length.  Every record inserted afterwards must have that length.
+   *
+   * @param record_length   Length of every record in bytes.
+   * @throws  SlotInUseException if the page holds records.
+   * @throws  InsufficientSpaceException if not even one record fits the page.
+   */
+  void formatFixedLength(const std::size_t record_length);
+
+  /**
+   * Returns true if this page holds records of one fixed length.
+   */
+  bool isFixedLength() const { return header_.record_length != 0; }
+
+  /**
+   * Returns the length of the records of this page, or 0 if it holds records
+   * of any length.
+   *
+   * @return  Record length in bytes.
+   */
+  std::uint16_t record_length() const { return header_.record_length; }
 
   /**
    * Returns this page's number in its file.
@@ -200,6 +346,13 @@ class Page {
    */
   PageId next_page_number() const { return header_.next_page_number; }
 
+  /**
+   * Returns the number of the used page before this page in its file.
+   *
+   * @return  Page number of previous used page in file.
+   */
+  PageId prev_page_number() const { return header_.prev_page_number; }
+
   /**
    * Returns an iterator at the first record in the page.
    *
@@ -240,9 +393,19 @@ class Page {
   }
 
   /**
-   * Deletes the record with the given ID.  Page is compacted upon delete to
-   * ensure that data of all records is contiguous.  Slot array is compacted if
-   * the slot deleted is at the end of the slot array and
+   * Sets the number of the previous used page before this page in its file.
+   *
+   * @param prev_page_number  Page number of previous used page in file.
+   */
+  void set_prev_page_number(const PageId new_prev_page_number) {
+    header_.prev_page_number = new_prev_page_number;
+  }
+
+  /**
+   * Deletes the record with the given ID.  Its space is added to the free
+   * space at once if it is the lowest record on the page, and is otherwise
+   * left as a hole until compact() is needed.  Slot directory is compacted if
+   * the slot deleted is at the end of the slot directory and
    * <allow_slot_compaction> is set.
    *
    * @param record_id             ID of the record to delete.
@@ -276,7 +439,8 @@ class Page {
    * Returns the slot number of an available slot.  If no slots are available
    * to be reused, allocates a new slot.  Updates available slot count in the
    * header metadata, but does not mark returned slot as used.  If a new slot is
-   * allocated, updates the free space lower bound.
+   * allocated, updates the free space lower bound.  The first unused slot is
+   * found a word of the occupancy bitmap at a time.
    *
    * Callers are responsible for making sure there is enough space to allocate a
    * new slot before calling this method.
@@ -288,6 +452,105 @@ class Page {
    */
   SlotId getAvailableSlot();
 
+  /**
+   * Allocates a new, unused slot at the end of the slot directory, starting a
+   * new group if needed.  Callers are responsible for making sure there is
+   * room between the bounds of the free space.
+   *
+   * @return  Slot number of the new slot.
+   */
+  SlotId appendSlot();
+
+  /**
+   * Returns the number of bytes the slot directory takes for the given number
+   * of slots.
+   *
+   * @param num_slots   Number of slots.
+   * @return  Size of slot directory in bytes.
+   */
+  static std::size_t directorySize(const std::size_t num_slots);
+
+  /**
+   * Returns the number of bytes a new slot would take from the free space.
+   */
+  std::size_t newSlotSize() const {
+    return directorySize(header_.num_slots + 1) -
+           directorySize(header_.num_slots);
+  }
+
+  /**
+   * Returns the occupancy word of a group of slots: bit i is set if slot
+   * group * SLOTS_PER_GROUP + i + 1 is in use.
+   *
+   * @param group   Number of group, from 0.
+   * @return  Occupancy word.
+   */
+  std::uint64_t getUsedWord(const std::size_t group) const;
+
+  /**
+   * Replaces the occupancy word of a group of slots.
+   *
+   * @param group   Number of group, from 0.
+   * @param word    Occupancy word.
+   */
+  void setUsedWord(const std::size_t group, const std::uint64_t word);
+
+  /**
+   * Returns whether the slot with the given number is in use.  The slot must
+   * be allocated.
+   *
+   * @param slot_number   Number of slot.
+   * @return  True if the slot holds a record.
+   */
+  bool isSlotUsed(const SlotId slot_number) const;
+
+  /**
+   * Marks the slot with the given number as in use or not.  The slot must be
+   * allocated.
+   *
+   * @param slot_number   Number of slot.
+   * @param used          Whether the slot holds a record.
+   */
+  void setSlotUsed(const SlotId slot_number, const bool used);
+
+  /**
+   * Returns the first slot in use after the given one, skipping a whole group
+   * of unused slots at a time.
+   *
+   * @param start   Slot to start search after.
+   * @return  Number of next used slot or INVALID_SLOT.
+   */
+  SlotId getNextUsedSlot(const SlotId start) const;
+
+  /**
+   * Returns the number of records of the given length that fit a page of
+   * fixed-length records, along with their occupancy bitmap.
+   *
+   * @param record_length   Length of every record in bytes.
+   * @return  Number of slots.
+   */
+  static std::size_t fixedLengthCapacity(const std::size_t record_length);
+
+  /**
+   * Returns the offset in the data of the record in the given slot of a page
+   * of fixed-length records.
+   *
+   * @param slot_number   Number of slot.
+   * @return  Offset of record.
+   */
+  std::size_t fixedRecordOffset(const SlotId slot_number) const {
+    const std::size_t num_groups =
+        (header_.num_slots + SLOTS_PER_GROUP - 1) / SLOTS_PER_GROUP;
+    return num_groups * sizeof(std::uint64_t) +
+           (slot_number - 1) * header_.record_length;
+  }
+
+  /**
+   * Moves all records to the end of the page, next to each other, reclaiming
+   * the space of deleted records.  Record IDs do not change.
+   */
+  void compact();
+
   /**
    * Inserts record data into the given slot.  The slot should not be currently
    * in use.  <slot_number> must be less than <header_.num_slots>.
@@ -302,7 +565,7 @@ class Page {
    * @throws  SlotInUseException  Thrown when given slot is in use.
    */
   void insertRecordInSlot(const SlotId slot_number,
-                          const std::string& record_data);
+                          const RecordView& record_data);
 
   /**
    * Throws an exception if the given record ID is not valid for this page
@@ -328,7 +591,10 @@ class Page {
 
   /**
    * Data stored on the page.  Includes bookkeeping information about slots as
-   * well as actual content.
+   * well as actual content.  The slot directory at the start is made of groups
+   * of SLOTS_PER_GROUP slots, each preceded by the occupancy word of its group.
+   * A page of fixed-length records instead starts with all of its occupancy
+   * words, followed by the records.
    */
 
   char data_[DATA_SIZE];
@@ -336,7 +602,10 @@ class Page {
   friend class File;
   friend class PageFile;
   friend class BlobFile;
+  friend class IoUringFile;
+  friend class MmapPageFile;
   friend class PageIterator;
+  friend class BufMgr;
 };
 
 static_assert(Page::SIZE > sizeof(PageHeader),
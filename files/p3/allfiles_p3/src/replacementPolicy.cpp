@@ -0,0 +1,508 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#include <algorithm>
+#include "replacementPolicy.h"
+
+namespace badgerdb {
+
+ReplacementPolicy* ReplacementPolicy::create(const ReplacementPolicyType type, const std::uint32_t numBufs)
+{
+  switch (type)
+  {
+    case LRUK_POLICY:
+      return new LRUKPolicy(numBufs);
+    case TWOQ_POLICY:
+      return new TwoQPolicy(numBufs);
+    case ARC_POLICY:
+      return new ARCPolicy(numBufs);
+    case CLOCK_POLICY:
+    default:
+      return new ClockPolicy(numBufs);
+  }
+}
+
+//----------------------------------------
+// CLOCK
+//----------------------------------------
+
+ClockPolicy::ClockPolicy(const std::uint32_t numBufs)
+  : numBufs(numBufs), clockHand(numBufs - 1)
+{
+}
+
+bool ClockPolicy::pickVictim(FrameClaimer& claimer, FrameId& frame)
+{
+  // two full turns: the first may only clear reference bits
+  for (std::uint32_t i = 0; i < 2 * numBufs; i++)
+  {
+    const FrameId candidate = (clockHand.fetch_add(1) + 1) % numBufs;
+    if (claimer.tryClaim(candidate, true))
+    {
+      frame = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+void ClockPolicy::nextVictims(const std::uint32_t max, std::vector<FrameId>& frames)
+{
+  // frames under the hand next, regardless of their reference bits; the caller
+  // filters out what it can not use
+  const FrameId hand = clockHand.load();
+  for (std::uint32_t i = 1; i <= max && i <= numBufs; i++)
+    frames.push_back((hand + i) % numBufs);
+}
+
+//----------------------------------------
+// Frame lists and ghost lists
+//----------------------------------------
+
+const FrameLists::ListId FrameLists::NO_LIST;
+
+FrameLists::FrameLists(const std::uint32_t numBufs, const ListId numLists)
+  : END(numBufs),
+    prevs(numBufs, numBufs),
+    nexts(numBufs, numBufs),
+    owner(numBufs, NO_LIST),
+    heads(numLists, numBufs),
+    tails(numLists, numBufs),
+    sizes(numLists, 0)
+{
+}
+
+void FrameLists::pushBack(const ListId list, const FrameId frame)
+{
+  unlink(frame);
+  prevs[frame] = tails[list];
+  nexts[frame] = END;
+  if (tails[list] == END)
+    heads[list] = frame;
+  else
+    nexts[tails[list]] = frame;
+  tails[list] = frame;
+  owner[frame] = list;
+  sizes[list]++;
+}
+
+void FrameLists::unlink(const FrameId frame)
+{
+  const ListId list = owner[frame];
+  if (list == NO_LIST)
+    return;
+
+  if (prevs[frame] == END)
+    heads[list] = nexts[frame];
+  else
+    nexts[prevs[frame]] = nexts[frame];
+  if (nexts[frame] == END)
+    tails[list] = prevs[frame];
+  else
+    prevs[nexts[frame]] = prevs[frame];
+
+  prevs[frame] = nexts[frame] = END;
+  owner[frame] = NO_LIST;
+  sizes[list]--;
+}
+
+void FrameLists::collect(const ListId list, const std::uint32_t max, std::vector<FrameId>& frames) const
+{
+  std::uint32_t n = 0;
+  for (FrameId f = heads[list]; f != END && n < max; f = nexts[f], n++)
+    frames.push_back(f);
+}
+
+void GhostList::push(const PageKey& key)
+{
+  erase(key);
+  order.push_back(key);
+  index[key] = --order.end();
+}
+
+bool GhostList::erase(const PageKey& key)
+{
+  std::unordered_map<PageKey, std::list<PageKey>::iterator, PageKeyHash>::iterator it = index.find(key);
+  if (it == index.end())
+    return false;
+  order.erase(it->second);
+  index.erase(it);
+  return true;
+}
+
+void GhostList::popOldest()
+{
+  if (order.empty())
+    return;
+  index.erase(order.front());
+  order.pop_front();
+}
+
+//----------------------------------------
+// LRU-K
+//----------------------------------------
+
+LRUKPolicy::LRUKPolicy(const std::uint32_t numBufs)
+  : numBufs(numBufs), now(0), history(numBufs), pages(numBufs), resident(numBufs, false),
+    claimed(numBufs, false)
+{
+  for (FrameId i = 0; i < numBufs; i++)
+  {
+    history[i].last = history[i].secondLast = 0;
+    pages[i] = 0;
+    order.insert(orderKey(i));
+  }
+}
+
+LRUKPolicy::OrderKey LRUKPolicy::orderKey(const FrameId frame) const
+{
+  // empty frames sort first as (0, 0); pages referenced once have an infinite
+  // backward 2-distance and sort next, by their last reference
+  return OrderKey(std::make_pair(history[frame].secondLast, history[frame].last), frame);
+}
+
+void LRUKPolicy::recordAccess(const FrameId frame)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  if (!resident[frame] || claimed[frame])
+    return;
+
+  order.erase(orderKey(frame));
+  history[frame].secondLast = history[frame].last;
+  history[frame].last = ++now;
+  order.insert(orderKey(frame));
+}
+
+void LRUKPolicy::recordLoad(const FrameId frame, const FileId fileId, const PageId pageNo)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  settle(frame);
+  order.erase(orderKey(frame));
+
+  const PageKey key = BufHashTbl::key(fileId, pageNo);
+  History h;
+  h.last = h.secondLast = 0;
+
+  RetainedMap::iterator it = retained.find(key);
+  if (it != retained.end())
+  {
+    h = it->second.first;
+    retainedOrder.erase(it->second.second);
+    retained.erase(it);
+  }
+
+  history[frame].secondLast = h.last;
+  history[frame].last = ++now;
+  pages[frame] = key;
+  resident[frame] = true;
+  order.insert(orderKey(frame));
+}
+
+void LRUKPolicy::release(const FrameId frame)
+{
+  order.erase(orderKey(frame));
+  if (resident[frame])
+  {
+    if (retained.size() >= numBufs)
+    {
+      retained.erase(retainedOrder.front());
+      retainedOrder.pop_front();
+    }
+    retainedOrder.push_back(pages[frame]);
+    retained[pages[frame]] = std::make_pair(history[frame], --retainedOrder.end());
+  }
+
+  history[frame].last = history[frame].secondLast = 0;
+  resident[frame] = false;
+  order.insert(orderKey(frame));
+}
+
+void LRUKPolicy::settle(const FrameId frame)
+{
+  if (claimed[frame])
+  {
+    release(frame);
+    claimed[frame] = false;
+  }
+}
+
+void LRUKPolicy::recordRemove(const FrameId frame)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  settle(frame);
+  order.erase(orderKey(frame));
+  history[frame].last = history[frame].secondLast = 0;
+  resident[frame] = false;
+  order.insert(orderKey(frame));
+}
+
+bool LRUKPolicy::pickVictim(FrameClaimer& claimer, FrameId& frame)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  for (std::set<OrderKey>::iterator it = order.begin(); it != order.end(); ++it)
+  {
+    if (claimer.tryClaim(it->second, false))
+    {
+      // released once the eviction is settled
+      frame = it->second;
+      claimed[frame] = true;
+      return true;
+    }
+  }
+  return false;
+}
+
+void LRUKPolicy::restore(const FrameId frame)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  claimed[frame] = false;
+}
+
+void LRUKPolicy::nextVictims(const std::uint32_t max, std::vector<FrameId>& frames)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  std::uint32_t n = 0;
+  for (std::set<OrderKey>::iterator it = order.begin(); it != order.end() && n < max; ++it)
+  {
+    if (resident[it->second])
+    {
+      frames.push_back(it->second);
+      n++;
+    }
+  }
+}
+
+//----------------------------------------
+// 2Q
+//----------------------------------------
+
+TwoQPolicy::TwoQPolicy(const std::uint32_t numBufs)
+  : kin(std::max<std::uint32_t>(1, numBufs / 4)),
+    kout(std::max<std::uint32_t>(1, numBufs / 2)),
+    lists(numBufs, 3),
+    pages(numBufs),
+    claimed(numBufs, false)
+{
+  for (FrameId i = 0; i < numBufs; i++)
+  {
+    pages[i] = 0;
+    lists.pushBack(FREE, i);
+  }
+}
+
+void TwoQPolicy::recordAccess(const FrameId frame)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  // a hit in A1in is deliberately ignored: correlated references right after
+  // a load do not make a page hot
+  if (lists.listOf(frame) == AM && !claimed[frame])
+    lists.pushBack(AM, frame);
+}
+
+void TwoQPolicy::recordLoad(const FrameId frame, const FileId fileId, const PageId pageNo)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  settle(frame);
+  const PageKey key = BufHashTbl::key(fileId, pageNo);
+  pages[frame] = key;
+  lists.pushBack(a1out.erase(key) ? AM : A1IN, frame);
+}
+
+void TwoQPolicy::recordRemove(const FrameId frame)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  settle(frame);
+  lists.pushBack(FREE, frame);
+}
+
+void TwoQPolicy::settle(const FrameId frame)
+{
+  if (!claimed[frame])
+    return;
+  claimed[frame] = false;
+  if (lists.listOf(frame) == A1IN)
+  {
+    a1out.push(pages[frame]);
+    if (a1out.size() > kout)
+      a1out.popOldest();
+  }
+  lists.pushBack(FREE, frame);
+}
+
+bool TwoQPolicy::claimFrom(FrameClaimer& claimer, const FrameLists::ListId list, FrameId& frame)
+{
+  for (FrameId f = lists.front(list); f != lists.END; f = lists.next(f))
+  {
+    if (claimer.tryClaim(f, false))
+    {
+      frame = f;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool TwoQPolicy::pickVictim(FrameClaimer& claimer, FrameId& frame)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  bool found = claimFrom(claimer, FREE, frame);
+  if (!found)
+  {
+    // reclaim from A1in once it exceeds its share, otherwise from Am; fall back
+    // to the other list when every candidate in the preferred one is pinned
+    if (lists.size(A1IN) > kin)
+      found = claimFrom(claimer, A1IN, frame) || claimFrom(claimer, AM, frame);
+    else
+      found = claimFrom(claimer, AM, frame) || claimFrom(claimer, A1IN, frame);
+  }
+  if (!found)
+    return false;
+
+  // the frame stays in its list until the eviction is settled
+  claimed[frame] = true;
+  return true;
+}
+
+void TwoQPolicy::restore(const FrameId frame)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  claimed[frame] = false;
+}
+
+void TwoQPolicy::nextVictims(const std::uint32_t max, std::vector<FrameId>& frames)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  const std::size_t start = frames.size();
+  const bool a1inFirst = lists.size(A1IN) > kin;
+  lists.collect(a1inFirst ? A1IN : AM, max, frames);
+  lists.collect(a1inFirst ? AM : A1IN, max - (frames.size() - start), frames);
+}
+
+//----------------------------------------
+// ARC
+//----------------------------------------
+
+ARCPolicy::ARCPolicy(const std::uint32_t numBufs)
+  : capacity(numBufs), target(0), lists(numBufs, 3), pages(numBufs),
+    claimed(numBufs, false)
+{
+  for (FrameId i = 0; i < numBufs; i++)
+  {
+    pages[i] = 0;
+    lists.pushBack(FREE, i);
+  }
+}
+
+void ARCPolicy::recordAccess(const FrameId frame)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  const FrameLists::ListId list = lists.listOf(frame);
+  if ((list == T1 || list == T2) && !claimed[frame])
+    lists.pushBack(T2, frame);
+}
+
+void ARCPolicy::recordLoad(const FrameId frame, const FileId fileId, const PageId pageNo)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  settle(frame);
+  const PageKey key = BufHashTbl::key(fileId, pageNo);
+  pages[frame] = key;
+
+  // a hit in a ghost list means that list's resident part was too small:
+  // move the T1 target towards it
+  const std::uint32_t sizeB1 = b1.size();
+  const std::uint32_t sizeB2 = b2.size();
+  if (b1.erase(key))
+  {
+    target = std::min(capacity, target + std::max<std::uint32_t>(1, sizeB2 / sizeB1));
+    lists.pushBack(T2, frame);
+  }
+  else if (b2.erase(key))
+  {
+    const std::uint32_t delta = std::max<std::uint32_t>(1, sizeB1 / sizeB2);
+    target = target > delta ? target - delta : 0;
+    lists.pushBack(T2, frame);
+  }
+  else
+  {
+    lists.pushBack(T1, frame);
+  }
+
+  // keep |T1| + |B1| <= c and |T1| + |T2| + |B1| + |B2| <= 2c
+  while (b1.size() > 0 && lists.size(T1) + b1.size() > capacity)
+    b1.popOldest();
+  while (b2.size() > 0 && lists.size(T1) + lists.size(T2) + b1.size() + b2.size() > 2 * capacity)
+    b2.popOldest();
+}
+
+void ARCPolicy::recordRemove(const FrameId frame)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  settle(frame);
+  lists.pushBack(FREE, frame);
+}
+
+void ARCPolicy::settle(const FrameId frame)
+{
+  if (!claimed[frame])
+    return;
+  claimed[frame] = false;
+  if (lists.listOf(frame) == T1)
+    b1.push(pages[frame]);
+  else if (lists.listOf(frame) == T2)
+    b2.push(pages[frame]);
+  lists.pushBack(FREE, frame);
+}
+
+bool ARCPolicy::claimFrom(FrameClaimer& claimer, const FrameLists::ListId list, FrameId& frame)
+{
+  for (FrameId f = lists.front(list); f != lists.END; f = lists.next(f))
+  {
+    if (claimer.tryClaim(f, false))
+    {
+      frame = f;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ARCPolicy::pickVictim(FrameClaimer& claimer, FrameId& frame)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  bool found = claimFrom(claimer, FREE, frame);
+  if (!found)
+  {
+    if (lists.size(T1) > 0 && lists.size(T1) > target)
+      found = claimFrom(claimer, T1, frame) || claimFrom(claimer, T2, frame);
+    else
+      found = claimFrom(claimer, T2, frame) || claimFrom(claimer, T1, frame);
+  }
+  if (!found)
+    return false;
+
+  // the frame stays in its list until the eviction is settled
+  claimed[frame] = true;
+  return true;
+}
+
+void ARCPolicy::restore(const FrameId frame)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  claimed[frame] = false;
+}
+
+void ARCPolicy::nextVictims(const std::uint32_t max, std::vector<FrameId>& frames)
+{
+  std::lock_guard<std::mutex> guard(latch);
+  const std::size_t start = frames.size();
+  const bool t1First = lists.size(T1) > 0 && lists.size(T1) > target;
+  lists.collect(t1First ? T1 : T2, max, frames);
+  lists.collect(t1First ? T2 : T1, max - (frames.size() - start), frames);
+}
+
+}
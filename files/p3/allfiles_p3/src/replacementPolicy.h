@@ -0,0 +1,425 @@
+/**
+ * @author See Contributors.txt for code contributors and overview of BadgerDB.
+ *
+ * @section LICENSE
+ * Copyright (c) 2012 Database Group, Computer Sciences Department, University of Wisconsin-Madison.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "bufHashTbl.h"
+#include "types.h"
+
+namespace badgerdb {
+
+/**
+ * @brief Replacement policies selectable when constructing a BufMgr.
+ */
+enum ReplacementPolicyType
+{
+	CLOCK_POLICY = 0,	/* Second-chance clock sweep */
+	LRUK_POLICY = 1,	/* LRU-K with K = 2 */
+	TWOQ_POLICY = 2,	/* Full 2Q (A1in, A1out, Am) */
+	ARC_POLICY = 3		/* Adaptive Replacement Cache */
+};
+
+/**
+ * @brief Identity of a page, used by policies that remember pages after they
+ * have been evicted: BufHashTbl::key() of the id of its file and its page
+ * number, which is the same through every File object on the file.
+ */
+typedef std::uint64_t PageKey;
+
+/**
+ * @brief Hash function for PageKey.
+ */
+struct PageKeyHash {
+	std::size_t operator()(const PageKey key) const {
+		return static_cast<std::size_t>(key * 0x9E3779B97F4A7C15ULL);
+	}
+};
+
+/**
+ * @brief Callback through which a policy asks the buffer manager for a victim.
+ *
+ * Pin counts and frame latches belong to the buffer manager, so a policy only
+ * proposes frames in its preferred order; the buffer manager decides whether a
+ * proposed frame can actually be taken.
+ */
+class FrameClaimer {
+ public:
+	virtual ~FrameClaimer() {}
+
+	/**
+	 * Tries to take the frame for reuse. On success the frame is owned by the
+	 * caller of ReplacementPolicy::pickVictim(), which unmaps it once its page
+	 * has been written back, or hands it back through
+	 * ReplacementPolicy::restore() if the page was pinned again meanwhile.
+	 *
+	 * @param frame					Frame proposed as victim
+	 * @param secondChance	If true and the frame has been referenced since the last
+	 *                      sweep, clear its reference bit and refuse it
+	 * @return  						True if the frame was taken.
+	 */
+	virtual bool tryClaim(const FrameId frame, const bool secondChance) = 0;
+};
+
+/**
+ * @brief Interface of a buffer pool replacement policy.
+ *
+ * The buffer manager reports hits, loads and removals, and asks for a victim
+ * when it needs a frame. Hooks may be called concurrently but never under a
+ * hash table latch. Loads and removals are reported while the frame's latch is
+ * held; hits are not, so an access may be reported for a frame that has been
+ * evicted since, which policies must tolerate.
+ */
+class ReplacementPolicy {
+ public:
+	/**
+	 * Creates the policy of the given type for a pool of numBufs frames.
+	 */
+	static ReplacementPolicy* create(const ReplacementPolicyType type, const std::uint32_t numBufs);
+
+	virtual ~ReplacementPolicy() {}
+
+	/**
+	 * The page in frame was found in the buffer pool and pinned.
+	 */
+	virtual void recordAccess(const FrameId frame) = 0;
+
+	/**
+	 * A page was read or allocated into frame.
+	 */
+	virtual void recordLoad(const FrameId frame, const FileId fileId, const PageId pageNo) = 0;
+
+	/**
+	 * Frame was emptied by the buffer manager (flushFile, disposePage) rather
+	 * than evicted by this policy, or a victim frame was left empty because the
+	 * page meant for it could not be loaded.
+	 */
+	virtual void recordRemove(const FrameId frame) = 0;
+
+	/**
+	 * Picks a victim frame, proposing candidates to claimer until one is taken.
+	 * The eviction only counts once the buffer manager reports a load into the
+	 * frame or its removal; until then it can be undone with restore().
+	 *
+	 * @param claimer	Buffer manager deciding whether a candidate can be taken
+	 * @param frame		Frame taken, returned via this variable
+	 * @return  			False if no frame could be taken.
+	 */
+	virtual bool pickVictim(FrameClaimer& claimer, FrameId& frame) = 0;
+
+	/**
+	 * The victim frame picked last was not evicted after all; it goes back to
+	 * where it was, and the page it holds is not remembered as evicted.
+	 */
+	virtual void restore(const FrameId frame) = 0;
+
+	/**
+	 * Lists the resident frames this policy expects to evict next, in eviction
+	 * order, without claiming them. Used by the background writer to clean pages
+	 * before they are evicted.
+	 *
+	 * @param max			Maximum number of frames to list
+	 * @param frames	Frames, appended to this vector
+	 */
+	virtual void nextVictims(const std::uint32_t max, std::vector<FrameId>& frames) = 0;
+};
+
+/**
+ * @brief The original second-chance clock sweep.
+ *
+ * Uses the reference bits kept in BufDesc and an atomic clock hand, so neither
+ * hits nor victim selection take a lock.
+ */
+class ClockPolicy : public ReplacementPolicy {
+ public:
+	ClockPolicy(const std::uint32_t numBufs);
+
+	void recordAccess(const FrameId frame) {}
+	void recordLoad(const FrameId frame, const FileId fileId, const PageId pageNo) {}
+	void recordRemove(const FrameId frame) {}
+	bool pickVictim(FrameClaimer& claimer, FrameId& frame);
+	void restore(const FrameId frame) {}
+	void nextVictims(const std::uint32_t max, std::vector<FrameId>& frames);
+
+ private:
+	/**
+	 * Number of frames in the buffer pool
+	 */
+	std::uint32_t numBufs;
+
+	/**
+	 * Current position of clockhand in our buffer pool. Grows without bound; the
+	 * frame under the hand is clockHand % numBufs.
+	 */
+	std::atomic<FrameId> clockHand;
+};
+
+/**
+ * @brief Intrusive doubly linked lists of frames sharing one set of per-frame
+ * links, so that moving a frame between lists never allocates. A frame is in
+ * at most one list at a time.
+ */
+class FrameLists {
+ public:
+	/**
+	 * Identifier of a list
+	 */
+	typedef std::uint8_t ListId;
+
+	/**
+	 * Tag of a frame that is in no list
+	 */
+	static const ListId NO_LIST = 0xFF;
+
+	FrameLists(const std::uint32_t numBufs, const ListId numLists);
+
+	/**
+	 * Appends frame to the most recently used end of list.
+	 */
+	void pushBack(const ListId list, const FrameId frame);
+
+	/**
+	 * Unlinks frame from whatever list it is in.
+	 */
+	void unlink(const FrameId frame);
+
+	/**
+	 * Least recently used frame of list, or numBufs if empty.
+	 */
+	FrameId front(const ListId list) const { return heads[list]; }
+
+	/**
+	 * Frame following frame in its list, or numBufs at the end.
+	 */
+	FrameId next(const FrameId frame) const { return nexts[frame]; }
+
+	/**
+	 * List frame is in, or NO_LIST.
+	 */
+	ListId listOf(const FrameId frame) const { return owner[frame]; }
+
+	/**
+	 * Number of frames in list.
+	 */
+	std::uint32_t size(const ListId list) const { return sizes[list]; }
+
+	/**
+	 * Appends up to max frames of list, least recently used first, to frames.
+	 */
+	void collect(const ListId list, const std::uint32_t max, std::vector<FrameId>& frames) const;
+
+	/**
+	 * Value marking the end of a list
+	 */
+	const FrameId END;
+
+ private:
+	std::vector<FrameId> prevs;
+	std::vector<FrameId> nexts;
+	std::vector<ListId> owner;
+	std::vector<FrameId> heads;
+	std::vector<FrameId> tails;
+	std::vector<std::uint32_t> sizes;
+};
+
+/**
+ * @brief Bounded FIFO of identities of evicted pages ("ghost" entries).
+ */
+class GhostList {
+ public:
+	/**
+	 * Adds key as the most recent entry.
+	 */
+	void push(const PageKey& key);
+
+	/**
+	 * Removes key if present.
+	 *
+	 * @return  True if key was present.
+	 */
+	bool erase(const PageKey& key);
+
+	/**
+	 * Drops the oldest entry, if any.
+	 */
+	void popOldest();
+
+	/**
+	 * Number of entries.
+	 */
+	std::size_t size() const { return index.size(); }
+
+ private:
+	std::list<PageKey> order;
+	std::unordered_map<PageKey, std::list<PageKey>::iterator, PageKeyHash> index;
+};
+
+/**
+ * @brief LRU-K replacement with K = 2.
+ *
+ * Evicts the frame whose second most recent reference is oldest; frames
+ * referenced only once since they were loaded go first, in LRU order. The
+ * reference history of an evicted page is retained for a while, so a page
+ * that comes back is not mistaken for a one-time (e.g. scan) reference.
+ */
+class LRUKPolicy : public ReplacementPolicy {
+ public:
+	LRUKPolicy(const std::uint32_t numBufs);
+
+	void recordAccess(const FrameId frame);
+	void recordLoad(const FrameId frame, const FileId fileId, const PageId pageNo);
+	void recordRemove(const FrameId frame);
+	bool pickVictim(FrameClaimer& claimer, FrameId& frame);
+	void restore(const FrameId frame);
+	void nextVictims(const std::uint32_t max, std::vector<FrameId>& frames);
+
+ private:
+	/**
+	 * Reference times of a page, most recent first; 0 if not referenced.
+	 */
+	struct History {
+		std::uint64_t last;
+		std::uint64_t secondLast;
+	};
+
+	/**
+	 * Eviction order: (second last reference, last reference, frame).
+	 */
+	typedef std::pair<std::pair<std::uint64_t, std::uint64_t>, FrameId> OrderKey;
+
+	OrderKey orderKey(const FrameId frame) const;
+
+	/**
+	 * Forgets frame, retaining the history of its page.
+	 */
+	void release(const FrameId frame);
+
+	/**
+	 * Completes the eviction of frame if it was picked as a victim.
+	 */
+	void settle(const FrameId frame);
+
+	std::mutex latch;
+	std::uint32_t numBufs;
+	std::uint64_t now;
+	std::vector<History> history;
+	std::vector<PageKey> pages;
+	std::vector<bool> resident;
+
+	/**
+	 * Frames picked as victims whose eviction has not been settled yet
+	 */
+	std::vector<bool> claimed;
+	std::set<OrderKey> order;
+
+	/**
+	 * Histories of evicted pages, bounded to numBufs entries, and their
+	 * position in retainedOrder (oldest first)
+	 */
+	typedef std::unordered_map<PageKey, std::pair<History, std::list<PageKey>::iterator>, PageKeyHash> RetainedMap;
+	RetainedMap retained;
+	std::list<PageKey> retainedOrder;
+};
+
+/**
+ * @brief Full 2Q replacement.
+ *
+ * New pages enter the A1in FIFO; pages evicted from it are remembered in the
+ * A1out ghost queue, and only pages re-referenced from there are promoted to
+ * the Am LRU list. A single sequential scan therefore flushes A1in only.
+ */
+class TwoQPolicy : public ReplacementPolicy {
+ public:
+	TwoQPolicy(const std::uint32_t numBufs);
+
+	void recordAccess(const FrameId frame);
+	void recordLoad(const FrameId frame, const FileId fileId, const PageId pageNo);
+	void recordRemove(const FrameId frame);
+	bool pickVictim(FrameClaimer& claimer, FrameId& frame);
+	void restore(const FrameId frame);
+	void nextVictims(const std::uint32_t max, std::vector<FrameId>& frames);
+
+ private:
+	enum { FREE = 0, A1IN = 1, AM = 2 };
+
+	bool claimFrom(FrameClaimer& claimer, const FrameLists::ListId list, FrameId& frame);
+
+	/**
+	 * Completes the eviction of frame if it was picked as a victim.
+	 */
+	void settle(const FrameId frame);
+
+	std::mutex latch;
+	std::uint32_t kin;
+	std::uint32_t kout;
+	FrameLists lists;
+	std::vector<PageKey> pages;
+
+	/**
+	 * Frames picked as victims whose eviction has not been settled yet; they
+	 * stay in their list meanwhile
+	 */
+	std::vector<bool> claimed;
+	GhostList a1out;
+};
+
+/**
+ * @brief Adaptive Replacement Cache.
+ *
+ * Balances a recency list T1 and a frequency list T2, steering the target size
+ * of T1 with hits in the ghost lists B1 and B2 of pages recently evicted from
+ * either.
+ */
+class ARCPolicy : public ReplacementPolicy {
+ public:
+	ARCPolicy(const std::uint32_t numBufs);
+
+	void recordAccess(const FrameId frame);
+	void recordLoad(const FrameId frame, const FileId fileId, const PageId pageNo);
+	void recordRemove(const FrameId frame);
+	bool pickVictim(FrameClaimer& claimer, FrameId& frame);
+	void restore(const FrameId frame);
+	void nextVictims(const std::uint32_t max, std::vector<FrameId>& frames);
+
+ private:
+	enum { FREE = 0, T1 = 1, T2 = 2 };
+
+	bool claimFrom(FrameClaimer& claimer, const FrameLists::ListId list, FrameId& frame);
+
+	/**
+	 * Completes the eviction of frame if it was picked as a victim.
+	 */
+	void settle(const FrameId frame);
+
+	std::mutex latch;
+	std::uint32_t capacity;
+
+	/**
+	 * Target size of T1
+	 */
+	std::uint32_t target;
+	FrameLists lists;
+	std::vector<PageKey> pages;
+
+	/**
+	 * Frames picked as victims whose eviction has not been settled yet; they
+	 * stay in their list meanwhile
+	 */
+	std::vector<bool> claimed;
+	GhostList b1;
+	GhostList b2;
+};
+
+}